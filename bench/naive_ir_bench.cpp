@@ -0,0 +1,372 @@
+#include "api/naivejit.hpp"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Runs every workload under every execution mode and reports the results as
+// JSON.  Each measurement happens in a forked child, so code that crashes or
+// hangs only loses its own entry, and peak RSS and instruction counts cover
+// exactly one run.
+
+namespace {
+
+/// One way of running a program.  New tiers and flags get a row here.
+struct Mode {
+  const char *name;
+  const char *description;
+  void (*configure)(JITOptions &Opts, LoadOptions &LoadOpts);
+  bool warm_caches; // Populate the code and parse caches with an unmeasured run first
+};
+
+const Mode kModes[] = {
+  {"interp", "interpreter only", [](JITOptions &O, LoadOptions &) {
+     O.threshold = ULLONG_MAX;
+     O.async_compile = false;
+   }, false},
+  {"jit", "compile blocks on their second execution", [](JITOptions &O, LoadOptions &) {
+     O.threshold = 1;
+     O.async_compile = false;
+   }, false},
+  {"jit-rvv", "jit with RVV loops for self-loops and memory intrinsics", [](JITOptions &O, LoadOptions &) {
+     O.threshold = 1;
+     O.async_compile = false;
+     O.vectorize = true;
+   }, false},
+  {"jit-speculate", "compile after 32 executions, late enough to specialize on stable values", [](JITOptions &O, LoadOptions &) {
+     O.threshold = 32;
+     O.async_compile = false;
+   }, false},
+  {"jit-nosuperblocks", "jit compiling each block on its own", [](JITOptions &O, LoadOptions &) {
+     O.threshold = 1;
+     O.async_compile = false;
+     O.superblocks = false;
+   }, false},
+  {"jit-noloops", "jit with superblocks that return at the back edge", [](JITOptions &O, LoadOptions &) {
+     O.threshold = 1;
+     O.async_compile = false;
+     O.loops = false;
+   }, false},
+  {"jit-noscalars", "jit with every alloca kept in memory", [](JITOptions &O, LoadOptions &) {
+     O.threshold = 1;
+     O.async_compile = false;
+     O.scalars = false;
+   }, false},
+  {"jit-async", "compile hot blocks on a background thread", [](JITOptions &O, LoadOptions &) {
+     O.threshold = 1;
+     O.async_compile = true;
+   }, false},
+  {"aot", "compile every function in parallel up front", [](JITOptions &O, LoadOptions &) {
+     O.threshold = 1;
+     O.async_compile = false;
+     O.aot = true;
+   }, false},
+  {"cached", "jit with warm code and parse caches, lazy loading", [](JITOptions &O, LoadOptions &L) {
+     O.threshold = 1;
+     O.async_compile = false;
+     L.lazy = true;
+   }, true},
+};
+
+/// What a child reports back through its pipe.
+struct Sample {
+  int64_t result;
+  double wall_ms;
+  double load_ms;
+  double compile_ms;
+  long max_rss_kb;
+  int64_t instructions; // -1 if the counter is unavailable
+  char error[256];
+};
+
+struct Outcome {
+  std::string status; // "ok", "error", "timeout" or "signal <n>"
+  std::string error;
+  Sample sample;
+};
+
+/// User-space instructions retired by this process and every thread it
+/// starts from now on, or -1 where perf events are not available (most
+/// qemu-user setups, restrictive perf_event_paranoid).
+int openInstructionCounter() {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/// Body of a measuring child.  Never returns.
+[[noreturn]] void runChild(const std::string &Path, const Mode &M, const std::string &CacheDir, int Out,
+                           unsigned Timeout) {
+  // The runner prints progress to stdout; keep it out of the report.
+  int devnull = open("/dev/null", O_WRONLY);
+  if (devnull >= 0) {
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+  }
+  // A crash is reported by the parent from the exit status; the stack dump
+  // LLVM's handlers would print is just noise.
+  for (int sig : {SIGSEGV, SIGILL, SIGBUS, SIGFPE, SIGABRT}) {
+    signal(sig, SIG_DFL);
+  }
+  alarm(Timeout);
+
+  Sample S;
+  memset(&S, 0, sizeof(S));
+  S.instructions = -1;
+  int status = 0;
+  int counter = openInstructionCounter();
+  if (counter >= 0) {
+    ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+    ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  try {
+    JITOptions Opts;
+    LoadOptions LoadOpts;
+    M.configure(Opts, LoadOpts);
+    if (!CacheDir.empty()) {
+      Opts.cache_dir = CacheDir + "/code";
+      LoadOpts.parse_cache_dir = CacheDir + "/parse";
+    }
+    auto start = std::chrono::steady_clock::now();
+    {
+      NaiveJIT jit(Path, Opts, LoadOpts);
+      S.result = jit.run("main");
+      S.load_ms = jit.loadInfo().load_ms;
+      S.compile_ms = jit.runner().compileMillis();
+    }
+    S.wall_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  } catch (const std::exception &e) {
+    snprintf(S.error, sizeof(S.error), "%s", e.what());
+    status = 1;
+  }
+  if (counter >= 0) {
+    ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+    long long count;
+    if (read(counter, &count, sizeof(count)) == sizeof(count)) {
+      S.instructions = count;
+    }
+  }
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  S.max_rss_kb = usage.ru_maxrss;
+  if (write(Out, &S, sizeof(S)) != sizeof(S)) {
+    status = 2;
+  }
+  _exit(status);
+}
+
+Outcome measure(const std::string &Path, const Mode &M, const std::string &CacheDir, unsigned Timeout) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    throw std::runtime_error("pipe: " + std::string(strerror(errno)));
+  }
+  fflush(nullptr);
+  pid_t pid = fork();
+  if (pid < 0) {
+    throw std::runtime_error("fork: " + std::string(strerror(errno)));
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    runChild(Path, M, CacheDir, fds[1], Timeout);
+  }
+  close(fds[1]);
+
+  Outcome O;
+  memset(&O.sample, 0, sizeof(O.sample));
+  size_t got = 0;
+  ssize_t n;
+  char *buf = reinterpret_cast<char *>(&O.sample);
+  while (got < sizeof(Sample) && (n = read(fds[0], buf + got, sizeof(Sample) - got)) > 0) {
+    got += n;
+  }
+  close(fds[0]);
+  int status;
+  waitpid(pid, &status, 0);
+
+  if (WIFSIGNALED(status)) {
+    O.status = WTERMSIG(status) == SIGALRM ? "timeout" : "signal " + std::to_string(WTERMSIG(status));
+  } else if (got != sizeof(Sample) || WEXITSTATUS(status) != 0) {
+    O.status = "error";
+    O.error = got == sizeof(Sample) ? O.sample.error : "child exited with status " + std::to_string(WEXITSTATUS(status));
+  } else {
+    O.status = "ok";
+  }
+  return O;
+}
+
+/// The value a workload's main() must return, from its "; expect: <n>" line.
+bool expectedResult(const std::string &Path, int64_t &Expected) {
+  auto BufOrErr = llvm::MemoryBuffer::getFile(Path);
+  if (!BufOrErr) {
+    return false;
+  }
+  llvm::StringRef text = (*BufOrErr)->getBuffer();
+  size_t pos = text.find("; expect:");
+  if (pos == llvm::StringRef::npos) {
+    return false;
+  }
+  llvm::StringRef value = text.substr(pos + strlen("; expect:")).ltrim();
+  value = value.take_while([](char C) { return C == '-' || isdigit(C); });
+  return !value.getAsInteger(10, Expected);
+}
+
+std::string makeCacheDir() {
+  llvm::SmallString<128> dir;
+  if (llvm::sys::fs::createUniqueDirectory("naive_ir_bench", dir)) {
+    throw std::runtime_error("Cannot create a cache directory for the benchmark.");
+  }
+  return std::string(dir.str());
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  llvm::InitLLVM X(argc, argv);
+  llvm::cl::list<std::string> Workloads(llvm::cl::Positional, llvm::cl::desc("<workload .ll/.bc>..."), llvm::cl::ZeroOrMore);
+  llvm::cl::list<std::string> Modes("modes", llvm::cl::desc("Modes to run (default: all)"), llvm::cl::CommaSeparated, llvm::cl::value_desc("mode,..."));
+  llvm::cl::opt<unsigned> Repeat("repeat", llvm::cl::desc("Measured runs per workload and mode"), llvm::cl::value_desc("n"), llvm::cl::init(3));
+  llvm::cl::opt<unsigned> Timeout("timeout", llvm::cl::desc("Seconds after which a run is killed"), llvm::cl::value_desc("s"), llvm::cl::init(120));
+  llvm::cl::opt<std::string> Output("o", llvm::cl::desc("Write the JSON report to <file> instead of stdout"), llvm::cl::value_desc("file"), llvm::cl::init("-"));
+  llvm::cl::opt<bool> ListModes("list-modes", llvm::cl::desc("Print the available modes and exit"));
+  llvm::cl::ParseCommandLineOptions(argc, argv, "Naïve IR Runner benchmark driver\n");
+
+  if (ListModes) {
+    for (const Mode &M : kModes) {
+      printf("%-18s %s\n", M.name, M.description);
+    }
+    return 0;
+  }
+  if (Workloads.empty()) {
+    llvm::errs() << "No workloads given.\n";
+    return 1;
+  }
+
+  std::vector<const Mode *> modes;
+  for (const Mode &M : kModes) {
+    if (Modes.empty() || std::find(Modes.begin(), Modes.end(), M.name) != Modes.end()) {
+      modes.push_back(&M);
+    }
+  }
+  for (const std::string &Name : Modes) {
+    if (std::none_of(std::begin(kModes), std::end(kModes), [&](const Mode &M) { return Name == M.name; })) {
+      llvm::errs() << "Unknown mode '" << Name << "'; see --list-modes.\n";
+      return 1;
+    }
+  }
+
+  std::error_code EC;
+  llvm::raw_fd_ostream out(Output, EC);
+  if (EC) {
+    llvm::errs() << "Cannot open " << Output << ": " << EC.message() << "\n";
+    return 1;
+  }
+
+  utsname host;
+  uname(&host);
+  int failures = 0;
+  try {
+    llvm::json::OStream J(out, 2);
+    J.objectBegin();
+    J.attribute("machine", host.machine);
+    J.attribute("repeat", (int64_t)Repeat);
+    J.attributeArray("results", [&] {
+      for (const std::string &Path : Workloads) {
+        std::string name = llvm::sys::path::stem(Path).str();
+        int64_t expected = 0;
+        bool has_expected = expectedResult(Path, expected);
+        for (const Mode *M : modes) {
+          std::string cache_dir = M->warm_caches ? makeCacheDir() : "";
+          if (M->warm_caches) {
+            measure(Path, *M, cache_dir, Timeout);
+          }
+          std::vector<Outcome> runs;
+          for (unsigned r = 0; r < std::max(1u, (unsigned)Repeat); ++r) {
+            runs.push_back(measure(Path, *M, cache_dir, Timeout));
+            if (runs.back().status != "ok") {
+              break;
+            }
+          }
+          if (!cache_dir.empty()) {
+            llvm::sys::fs::remove_directories(cache_dir);
+          }
+          llvm::errs() << name << "/" << M->name << ": " << runs.back().status << "\n";
+
+          // Timings are the median of the runs, counters and RSS the minimum:
+          // both are least disturbed by the rest of the machine.
+          const Outcome &last = runs.back();
+          bool ok = last.status == "ok";
+          bool correct = ok && (!has_expected || last.sample.result == expected);
+          failures += !correct;
+          J.object([&] {
+            J.attribute("workload", name);
+            J.attribute("mode", M->name);
+            J.attribute("status", last.status);
+            if (!last.error.empty()) {
+              J.attribute("error", last.error);
+            }
+            if (!ok) {
+              return;
+            }
+            std::vector<double> wall, load, compile;
+            int64_t instructions = INT64_MAX;
+            long max_rss_kb = LONG_MAX;
+            for (const Outcome &O : runs) {
+              wall.push_back(O.sample.wall_ms);
+              load.push_back(O.sample.load_ms);
+              compile.push_back(O.sample.compile_ms);
+              instructions = std::min(instructions, O.sample.instructions);
+              max_rss_kb = std::min(max_rss_kb, O.sample.max_rss_kb);
+            }
+            auto median = [](std::vector<double> V) {
+              std::sort(V.begin(), V.end());
+              return V[V.size() / 2];
+            };
+            J.attribute("result", last.sample.result);
+            if (has_expected) {
+              J.attribute("expected", expected);
+            }
+            J.attribute("correct", correct);
+            J.attribute("wall_ms", median(wall));
+            J.attribute("load_ms", median(load));
+            J.attribute("compile_ms", median(compile));
+            if (instructions >= 0) {
+              J.attribute("instructions", instructions);
+            } else {
+              J.attribute("instructions", nullptr);
+            }
+            J.attribute("max_rss_kb", (int64_t)max_rss_kb);
+          });
+        }
+      }
+    });
+    J.objectEnd();
+    out << "\n";
+  } catch (const std::exception &e) {
+    llvm::errs() << "Error: " << e.what() << "\n";
+    return 1;
+  }
+  return failures ? 2 : 0;
+}
@@ -0,0 +1,256 @@
+#include "asm/asmcmd.hpp"
+#include "asm/asmstruct.hpp"
+#include "jitrunner/codearena.hpp"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+#include <chrono>
+#include <functional>
+
+// Microbenchmarks of the compile pipeline: instruction selection into an
+// AsmBlock, encoding of single instructions and whole blocks, and placing the
+// code in executable memory.  Blocks are synthetic straight-line IR of a
+// given length, so costs can be reported per IR instruction.
+
+namespace {
+
+/// A block of N instructions cycling through everything the compiler
+/// selects: arithmetic, compares, address computation, loads and stores.
+llvm::BasicBlock *buildBlock(llvm::Module &M, unsigned N) {
+  llvm::LLVMContext &Ctx = M.getContext();
+  llvm::Type *I64 = llvm::Type::getInt64Ty(Ctx);
+  llvm::Type *Ptr = llvm::Type::getInt64PtrTy(Ctx);
+  auto *FTy = llvm::FunctionType::get(llvm::Type::getVoidTy(Ctx), {Ptr, I64, I64}, false);
+  auto *F = llvm::Function::Create(FTy, llvm::Function::ExternalLinkage, "block" + std::to_string(N), M);
+  auto *BB = llvm::BasicBlock::Create(Ctx, "entry", F);
+  llvm::IRBuilder<> B(BB);
+
+  llvm::Value *base = F->getArg(0);
+  llvm::Value *x = F->getArg(1);
+  llvm::Value *y = F->getArg(2);
+  llvm::Value *addr = base;
+  for (unsigned i = 0; i < N; ++i) {
+    switch (i % 8) {
+    case 0: x = B.CreateAdd(x, y); break;
+    case 1: y = B.CreateMul(y, B.getInt64(i + 3)); break;
+    case 2: B.CreateICmpSLT(x, y); break;
+    case 3: addr = B.CreateGEP(I64, base, B.getInt64(i % 64)); break;
+    case 4: y = B.CreateLoad(I64, addr); break;
+    case 5: B.CreateStore(x, addr); break;
+    case 6: x = B.CreateSub(x, B.getInt64(1)); break;
+    case 7: y = B.CreateSDiv(x, B.getInt64(7)); break;
+    }
+  }
+  B.CreateRetVoid();
+  return BB;
+}
+
+/// The selection loop of JITRunner::constructBasicBlockExecutor, for the
+/// instructions buildBlock() emits.
+void select(asmcode::AsmBlock &AB, llvm::BasicBlock *BB, const llvm::DataLayout &DL) {
+  AB.regSave();
+  for (llvm::Instruction &I : *BB) {
+    switch (I.getOpcode()) {
+    case llvm::Instruction::Add:
+    case llvm::Instruction::Sub:
+    case llvm::Instruction::Mul:
+    case llvm::Instruction::SDiv:
+    case llvm::Instruction::ICmp:
+      AB.addBinary(&I);
+      break;
+    case llvm::Instruction::Load:
+      AB.addLoad(&I, DL);
+      break;
+    case llvm::Instruction::Store:
+      AB.addStore(&I, DL);
+      break;
+    case llvm::Instruction::GetElementPtr:
+      AB.addGetElementPtr(&I, DL);
+      break;
+    default:
+      break;
+    }
+  }
+  AB.regLoad();
+  AB.addRet();
+}
+
+/// Nanoseconds per call of Fn: the batch size is doubled until a batch takes
+/// at least MinBatchMs, then the fastest of five such batches counts.
+double nsPerCall(const std::function<void()> &Fn, double MinBatchMs) {
+  using Clock = std::chrono::steady_clock;
+  auto timeBatch = [&](size_t Calls) {
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < Calls; ++i) {
+      Fn();
+    }
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+  };
+  size_t calls = 1;
+  double ns = timeBatch(calls);
+  while (ns < MinBatchMs * 1e6) {
+    calls *= 2;
+    ns = timeBatch(calls);
+  }
+  for (int i = 0; i < 4; ++i) {
+    ns = std::min(ns, timeBatch(calls));
+  }
+  return ns / calls;
+}
+
+struct Result {
+  std::string stage;
+  unsigned block_size; // IR instructions, 0 for single machine instructions
+  double ns_per_inst;
+  double bytes_per_inst;
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  llvm::InitLLVM X(argc, argv);
+  llvm::cl::list<unsigned> Sizes("sizes", llvm::cl::desc("Block sizes in IR instructions (default: 8,32,128,512)"), llvm::cl::CommaSeparated, llvm::cl::value_desc("n,..."));
+  llvm::cl::opt<double> MinBatch("min-batch-ms", llvm::cl::desc("Minimum duration of a timed batch"), llvm::cl::value_desc("ms"), llvm::cl::init(20));
+  llvm::cl::opt<std::string> JSONOut("json", llvm::cl::desc("Also write the results as JSON to <file>"), llvm::cl::value_desc("file"));
+  llvm::cl::ParseCommandLineOptions(argc, argv, "Naïve IR Runner compile pipeline microbenchmarks\n");
+
+  // Built in one go: assigning the defaults over the empty copy of Sizes
+  // trips a -Wfree-nonheap-object false positive in GCC 12.
+  const std::vector<unsigned> sizes = Sizes.empty() ? std::vector<unsigned>{8, 32, 128, 512}
+                                                    : std::vector<unsigned>(Sizes.begin(), Sizes.end());
+
+  llvm::LLVMContext Ctx;
+  llvm::Module M("microbench", Ctx);
+  const llvm::DataLayout &DL = M.getDataLayout();
+  std::vector<Result> results;
+  volatile size_t sink = 0; // Keeps the measured work alive
+
+  // Single machine instructions, per encode() call.
+  {
+    asmcode::li Li(asmcode::Register("s1"), asmcode::Immediate(0x123456789abcLL));
+    results.push_back({"li.encode", 0, nsPerCall([&] {
+      unsigned char *buf = Li.encode();
+      sink += buf[0];
+      delete[] buf;
+    }, MinBatch), (double)Li.size()});
+    asmcode::binary Add(asmcode::binary::ADD, asmcode::Register("s0"), asmcode::Register("s1"), asmcode::Register("s2"));
+    results.push_back({"binary.encode", 0, nsPerCall([&] {
+      unsigned char *buf = Add.encode();
+      sink += buf[0];
+      delete[] buf;
+    }, MinBatch), (double)Add.size()});
+  }
+
+  for (unsigned N : sizes) {
+    llvm::BasicBlock *BB = buildBlock(M, N);
+    std::vector<llvm::Value *> slots;
+
+    results.push_back({"select", N, nsPerCall([&] {
+      slots.clear();
+      asmcode::AsmBlock AB(slots);
+      select(AB, BB, DL);
+      sink += AB.size();
+    }, MinBatch) / N, 0});
+
+    slots.clear();
+    asmcode::AsmBlock AB(slots);
+    select(AB, BB, DL);
+    unsigned char *code;
+    size_t code_size, count;
+    AB.encode(&code, &code_size, &count);
+    double bytes = (double)code_size / N;
+
+    results.push_back({"encode", N, nsPerCall([&] {
+      unsigned char *buf;
+      size_t size, n;
+      AB.encode(&buf, &size, &n);
+      sink += size;
+      free(buf);
+    }, MinBatch) / N, bytes});
+
+    // The same block with compressed instructions where they fit.
+    {
+      unsigned char *buf;
+      size_t size, n;
+      AB.setCompressed(true);
+      AB.encode(&buf, &size, &n);
+      free(buf);
+      results.push_back({"encode.rvc", N, nsPerCall([&] {
+        unsigned char *buf;
+        size_t size, n;
+        AB.encode(&buf, &size, &n);
+        sink += size;
+        free(buf);
+      }, MinBatch) / N, (double)size / N});
+      AB.setCompressed(false);
+    }
+
+    // A fresh arena every so often keeps the benchmark from mapping
+    // unbounded amounts of executable memory.
+    auto arena = std::make_unique<CodeArena>();
+    results.push_back({"emit.arena", N, nsPerCall([&] {
+      if (arena->mappedBytes() > (size_t(64) << 20)) {
+        arena = std::make_unique<CodeArena>();
+      }
+      sink += (size_t)arena->emit(code, code_size);
+    }, MinBatch) / N, bytes});
+
+    // What emitting cost before arenas: a mapping per block.
+    results.push_back({"emit.mmap", N, nsPerCall([&] {
+      void *mem = mmap(nullptr, code_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_ANON | MAP_PRIVATE, -1, 0);
+      memcpy(mem, code, code_size);
+      __builtin___clear_cache((char *)mem, (char *)mem + code_size);
+      munmap(mem, code_size);
+    }, MinBatch) / N, bytes});
+
+    arena = std::make_unique<CodeArena>();
+    results.push_back({"pipeline", N, nsPerCall([&] {
+      if (arena->mappedBytes() > (size_t(64) << 20)) {
+        arena = std::make_unique<CodeArena>();
+      }
+      slots.clear();
+      asmcode::AsmBlock Block(slots);
+      select(Block, BB, DL);
+      unsigned char *buf;
+      size_t size, n;
+      Block.encode(&buf, &size, &n);
+      sink += (size_t)arena->emit(buf, size);
+      free(buf);
+    }, MinBatch) / N, bytes});
+    free(code);
+  }
+
+  printf("%-14s %8s %14s %14s\n", "stage", "IR insts", "ns/IR inst", "bytes/IR inst");
+  for (const Result &R : results) {
+    if (R.block_size) {
+      printf("%-14s %8u %14.1f %14.1f\n", R.stage.c_str(), R.block_size, R.ns_per_inst, R.bytes_per_inst);
+    } else {
+      printf("%-14s %8s %14.1f %14.1f  (per machine instruction)\n", R.stage.c_str(), "-", R.ns_per_inst,
+             R.bytes_per_inst);
+    }
+  }
+
+  if (!JSONOut.empty()) {
+    std::error_code EC;
+    llvm::raw_fd_ostream out(JSONOut, EC);
+    if (EC) {
+      llvm::errs() << "Cannot open " << JSONOut << ": " << EC.message() << "\n";
+      return 1;
+    }
+    llvm::json::OStream J(out, 2);
+    J.array([&] {
+      for (const Result &R : results) {
+        J.object([&] {
+          J.attribute("stage", R.stage);
+          J.attribute("block_size", (int64_t)R.block_size);
+          J.attribute("ns_per_inst", R.ns_per_inst);
+          J.attribute("bytes_per_inst", R.bytes_per_inst);
+        });
+      }
+    });
+    out << "\n";
+  }
+  return 0;
+}
@@ -0,0 +1,44 @@
+; A loop making three calls per iteration to small leaf and non-leaf
+; functions, for 5000 iterations.  Measures call and return overhead.
+; expect: 12502500
+
+define i64 @square(i64 %x) {
+entry:
+  %r = mul i64 %x, %x
+  ret i64 %r
+}
+
+define i64 @clamp(i64 %x, i64 %hi) {
+entry:
+  %over = icmp sgt i64 %x, %hi
+  br i1 %over, label %high, label %ok
+high:
+  ret i64 %hi
+ok:
+  ret i64 %x
+}
+
+define i64 @mix(i64 %acc, i64 %i) {
+entry:
+  %sq = call i64 @square(i64 %i)
+  %m = srem i64 %sq, 7
+  %c = call i64 @clamp(i64 %m, i64 3)
+  %d = sub i64 %i, %c
+  %a = add i64 %acc, %d
+  %r = add i64 %a, %c
+  ret i64 %r
+}
+
+define i64 @main() {
+entry:
+  br label %loop
+loop:
+  %i = phi i64 [ 1, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %acc.next = call i64 @mix(i64 %acc, i64 %i)
+  %i.next = add i64 %i, 1
+  %done = icmp sgt i64 %i.next, 5000
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i64 %acc.next
+}
@@ -0,0 +1,24 @@
+; Naive recursive Fibonacci.  Almost all time goes into calls and returns of
+; one small function.
+; expect: 6765
+
+define i64 @fib(i64 %n) {
+entry:
+  %small = icmp slt i64 %n, 2
+  br i1 %small, label %base, label %recurse
+base:
+  ret i64 %n
+recurse:
+  %n1 = sub i64 %n, 1
+  %a = call i64 @fib(i64 %n1)
+  %n2 = sub i64 %n, 2
+  %b = call i64 @fib(i64 %n2)
+  %sum = add i64 %a, %b
+  ret i64 %sum
+}
+
+define i64 @main() {
+entry:
+  %r = call i64 @fib(i64 20)
+  ret i64 %r
+}
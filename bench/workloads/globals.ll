@@ -0,0 +1,79 @@
+; Table-driven code over initialized globals: a read-only table of bit
+; counts, a histogram in a writable global array, and a configuration
+; struct holding pointers to other globals.  A generator whose state lives
+; in a global fills the histogram, which is then weighted through the
+; pointers.  Exercises the data segment and typed loads and stores.
+; expect: 500505
+
+@bits = constant [16 x i8] c"\00\01\01\02\01\02\02\03\01\02\02\03\02\03\03\04"
+@weights = constant [3 x i64] [i64 3, i64 5, i64 7]
+@hist = global [9 x i32] zeroinitializer
+@state = global i64 12345
+@config = global { i32, i64*, i64* } { i32 20000, i64* @state, i64* getelementptr inbounds ([3 x i64], [3 x i64]* @weights, i64 0, i64 1) }
+
+; Bits set in x, 0 <= x < 256.
+define i64 @popcount8(i64 %x) {
+entry:
+  %lo = srem i64 %x, 16
+  %hi = sdiv i64 %x, 16
+  %plo = getelementptr [16 x i8], [16 x i8]* @bits, i64 0, i64 %lo
+  %phi = getelementptr [16 x i8], [16 x i8]* @bits, i64 0, i64 %hi
+  %blo = load i8, i8* %plo
+  %bhi = load i8, i8* %phi
+  %nlo = sext i8 %blo to i64
+  %nhi = sext i8 %bhi to i64
+  %n = add i64 %nlo, %nhi
+  ret i64 %n
+}
+
+define i64 @main() {
+entry:
+  %pcount = getelementptr { i32, i64*, i64* }, { i32, i64*, i64* }* @config, i64 0, i32 0
+  %count32 = load i32, i32* %pcount
+  %count = sext i32 %count32 to i64
+  %pstate = getelementptr { i32, i64*, i64* }, { i32, i64*, i64* }* @config, i64 0, i32 1
+  %statep = load i64*, i64** %pstate
+  %pweight = getelementptr { i32, i64*, i64* }, { i32, i64*, i64* }* @config, i64 0, i32 2
+  %weightp = load i64*, i64** %pweight
+  %weight = load i64, i64* %weightp
+  br label %fill
+
+fill:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %fill ]
+  %s = load i64, i64* %statep
+  %s.mul = mul i64 %s, 1103515245
+  %s.add = add i64 %s.mul, 12345
+  %s.next = srem i64 %s.add, 2147483648
+  store i64 %s.next, i64* %statep
+  %byte = srem i64 %s.next, 256
+  %bits = call i64 @popcount8(i64 %byte)
+  %slot = getelementptr [9 x i32], [9 x i32]* @hist, i64 0, i64 %bits
+  %h = load i32, i32* %slot
+  %h.next = add i32 %h, 1
+  store i32 %h.next, i32* %slot
+  %i.next = add i64 %i, 1
+  %more = icmp slt i64 %i.next, %count
+  br i1 %more, label %fill, label %sum
+
+sum:
+  %k = phi i64 [ 0, %fill ], [ %k.next, %sum ]
+  %acc = phi i64 [ 0, %fill ], [ %acc.next, %sum ]
+  %pk = getelementptr [9 x i32], [9 x i32]* @hist, i64 0, i64 %k
+  %hk = load i32, i32* %pk
+  %hk64 = sext i32 %hk to i64
+  %k1 = add i64 %k, 1
+  %term = mul i64 %hk64, %k1
+  %acc.next = add i64 %acc, %term
+  %k.next = add i64 %k, 1
+  %again = icmp slt i64 %k.next, 9
+  br i1 %again, label %sum, label %done
+
+done:
+  %last = load i64, i64* getelementptr inbounds ([3 x i64], [3 x i64]* @weights, i64 0, i64 2)
+  %final = load i64, i64* @state
+  %tail = srem i64 %final, 1000
+  %scaled = mul i64 %acc.next, %weight
+  %r1 = add i64 %scaled, %last
+  %r = add i64 %r1, %tail
+  ret i64 %r
+}
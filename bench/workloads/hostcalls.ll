@@ -0,0 +1,74 @@
+; Calls into the C library from hot loops: a heap buffer from malloc is
+; filled and checked with memcmp against a second one, then freed, and the
+; loop mixes in labs, strlen and atol of constant strings.  Returns a
+; checksum.
+; expect: 444913745
+
+@digits = constant [6 x i8] c"40213\00"
+@word = constant [12 x i8] c"hello world\00"
+
+declare i8* @malloc(i64)
+declare void @free(i8*)
+declare i64 @labs(i64)
+declare i64 @strlen(i8*)
+declare i32 @memcmp(i8*, i8*, i64)
+declare i64 @atol(i8*)
+
+define i64 @round(i64 %k) {
+entry:
+  %a = call i8* @malloc(i64 64)
+  %b = call i8* @malloc(i64 64)
+  %wa = bitcast i8* %a to i64*
+  %wb = bitcast i8* %b to i64*
+  br label %fill
+
+fill:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %fill ]
+  %pa = getelementptr i64, i64* %wa, i64 %i
+  %pb = getelementptr i64, i64* %wb, i64 %i
+  %v = mul i64 %i, %k
+  store i64 %v, i64* %pa
+  store i64 %v, i64* %pb
+  %i.next = add i64 %i, 1
+  %more = icmp slt i64 %i.next, 8
+  br i1 %more, label %fill, label %check
+
+check:
+  %half = srem i64 %k, 3
+  %last = getelementptr i64, i64* %wb, i64 7
+  store i64 %half, i64* %last
+  %cmp = call i32 @memcmp(i8* %a, i8* %b, i64 64)
+  %differ = icmp ne i32 %cmp, 0
+  %cmp64 = select i1 %differ, i64 1000, i64 0
+  call void @free(i8* %a)
+  call void @free(i8* %b)
+  ret i64 %cmp64
+}
+
+define i64 @main() {
+entry:
+  %s = getelementptr [6 x i8], [6 x i8]* @digits, i64 0, i64 0
+  %w = getelementptr [12 x i8], [12 x i8]* @word, i64 0, i64 0
+  br label %loop
+
+loop:
+  %k = phi i64 [ 0, %entry ], [ %k.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.mod, %loop ]
+  %d = sub i64 50, %k
+  %m64 = call i64 @labs(i64 %d)
+  %len = call i64 @strlen(i8* %w)
+  %num64 = call i64 @atol(i8* %s)
+  %r = call i64 @round(i64 %k)
+  %t1 = mul i64 %acc, 31
+  %t2 = add i64 %t1, %m64
+  %t3 = add i64 %t2, %len
+  %t4 = add i64 %t3, %num64
+  %t5 = add i64 %t4, %r
+  %acc.mod = srem i64 %t5, 1000000007
+  %k.next = add i64 %k, 1
+  %again = icmp slt i64 %k.next, 200
+  br i1 %again, label %loop, label %done
+
+done:
+  ret i64 %acc.mod
+}
@@ -0,0 +1,94 @@
+; Loops written the way a front end emits them before mem2reg: counters,
+; accumulators and a two-field struct live in allocas and every use is a
+; load or a store.  One 32-bit accumulator wraps, and one local has its
+; address passed to a function, so it stays in memory.  Returns a checksum.
+; expect: -1174871411
+
+%pair = type { i64, i64 }
+
+define void @bump(i64* %p, i64 %by) {
+entry:
+  %v = load i64, i64* %p
+  %v.next = add i64 %v, %by
+  store i64 %v.next, i64* %p
+  ret void
+}
+
+define i64 @sum(i64 %n) {
+entry:
+  %i = alloca i64
+  %acc = alloca i64
+  %acc32 = alloca i32
+  %pr = alloca %pair
+  %lo = getelementptr %pair, %pair* %pr, i64 0, i32 0
+  %hi = getelementptr %pair, %pair* %pr, i64 0, i32 1
+  store i64 0, i64* %i
+  store i64 0, i64* %acc
+  store i32 2147483000, i32* %acc32
+  store i64 1, i64* %lo
+  store i64 0, i64* %hi
+  br label %cond
+
+cond:
+  %iv = load i64, i64* %i
+  %more = icmp slt i64 %iv, %n
+  br i1 %more, label %body, label %exit
+
+body:
+  %a = load i64, i64* %acc
+  %sq = mul i64 %iv, %iv
+  %a.next = add i64 %a, %sq
+  store i64 %a.next, i64* %acc
+  %w = load i32, i32* %acc32
+  %w.next = add i32 %w, 7
+  store i32 %w.next, i32* %acc32
+  %l = load i64, i64* %lo
+  %h = load i64, i64* %hi
+  %lh = add i64 %l, %h
+  store i64 %h, i64* %lo
+  %lh.mod = srem i64 %lh, 1000003
+  store i64 %lh.mod, i64* %hi
+  br label %inc
+
+inc:
+  %iv2 = load i64, i64* %i
+  %iv.next = add i64 %iv2, 1
+  store i64 %iv.next, i64* %i
+  br label %cond
+
+exit:
+  %ra = load i64, i64* %acc
+  %rw = load i32, i32* %acc32
+  %rw64 = sext i32 %rw to i64
+  %rh = load i64, i64* %hi
+  %r1 = add i64 %ra, %rw64
+  %r2 = mul i64 %r1, 31
+  %r = add i64 %r2, %rh
+  ret i64 %r
+}
+
+define i64 @main() {
+entry:
+  %k = alloca i64
+  %total = alloca i64
+  store i64 0, i64* %k
+  store i64 0, i64* %total
+  br label %loop
+
+loop:
+  %kv = load i64, i64* %k
+  %n = add i64 %kv, 100
+  %s = call i64 @sum(i64 %n)
+  call void @bump(i64* %total, i64 %s)
+  %t = load i64, i64* %total
+  %t.mod = srem i64 %t, 2147483647
+  store i64 %t.mod, i64* %total
+  %kv.next = add i64 %kv, 1
+  store i64 %kv.next, i64* %k
+  %again = icmp slt i64 %kv.next, 300
+  br i1 %again, label %loop, label %done
+
+done:
+  %res = load i64, i64* %total
+  ret i64 %res
+}
@@ -0,0 +1,82 @@
+; C = A * B for 24x24 i32 matrices held in nested arrays, with
+; A[i][j] = i + j and B[i][j] = i - j.  Returns the sum of C.  Dominated by
+; nested-array address arithmetic in the innermost loop.
+; expect: 662400
+
+define i64 @main() {
+entry:
+  %a = alloca [24 x [24 x i32]]
+  %b = alloca [24 x [24 x i32]]
+  %c = alloca [24 x [24 x i32]]
+  br label %init.row
+
+init.row:
+  %ii = phi i32 [ 0, %entry ], [ %ii.next, %init.row.end ]
+  br label %init.col
+init.col:
+  %ij = phi i32 [ 0, %init.row ], [ %ij.next, %init.col ]
+  %pa = getelementptr [24 x [24 x i32]], [24 x [24 x i32]]* %a, i64 0, i32 %ii, i32 %ij
+  %va = add i32 %ii, %ij
+  store i32 %va, i32* %pa
+  %pb = getelementptr [24 x [24 x i32]], [24 x [24 x i32]]* %b, i64 0, i32 %ii, i32 %ij
+  %vb = sub i32 %ii, %ij
+  store i32 %vb, i32* %pb
+  %ij.next = add i32 %ij, 1
+  %ij.done = icmp slt i32 %ij.next, 24
+  br i1 %ij.done, label %init.col, label %init.row.end
+init.row.end:
+  %ii.next = add i32 %ii, 1
+  %ii.done = icmp slt i32 %ii.next, 24
+  br i1 %ii.done, label %init.row, label %mul.row
+
+mul.row:
+  %i = phi i32 [ 0, %init.row.end ], [ %i.next, %mul.row.end ]
+  br label %mul.col
+mul.col:
+  %j = phi i32 [ 0, %mul.row ], [ %j.next, %mul.col.end ]
+  br label %mul.dot
+mul.dot:
+  %k = phi i32 [ 0, %mul.col ], [ %k.next, %mul.dot ]
+  %acc = phi i32 [ 0, %mul.col ], [ %acc.next, %mul.dot ]
+  %pak = getelementptr [24 x [24 x i32]], [24 x [24 x i32]]* %a, i64 0, i32 %i, i32 %k
+  %ak = load i32, i32* %pak
+  %pbk = getelementptr [24 x [24 x i32]], [24 x [24 x i32]]* %b, i64 0, i32 %k, i32 %j
+  %bk = load i32, i32* %pbk
+  %prod = mul i32 %ak, %bk
+  %acc.next = add i32 %acc, %prod
+  %k.next = add i32 %k, 1
+  %k.done = icmp slt i32 %k.next, 24
+  br i1 %k.done, label %mul.dot, label %mul.col.end
+mul.col.end:
+  %pc = getelementptr [24 x [24 x i32]], [24 x [24 x i32]]* %c, i64 0, i32 %i, i32 %j
+  store i32 %acc.next, i32* %pc
+  %j.next = add i32 %j, 1
+  %j.done = icmp slt i32 %j.next, 24
+  br i1 %j.done, label %mul.col, label %mul.row.end
+mul.row.end:
+  %i.next = add i32 %i, 1
+  %i.done = icmp slt i32 %i.next, 24
+  br i1 %i.done, label %mul.row, label %sum.row
+
+sum.row:
+  %si = phi i32 [ 0, %mul.row.end ], [ %si.next, %sum.row.end ]
+  %total.row = phi i64 [ 0, %mul.row.end ], [ %total.next, %sum.row.end ]
+  br label %sum.col
+sum.col:
+  %sj = phi i32 [ 0, %sum.row ], [ %sj.next, %sum.col ]
+  %total = phi i64 [ %total.row, %sum.row ], [ %total.next, %sum.col ]
+  %psc = getelementptr [24 x [24 x i32]], [24 x [24 x i32]]* %c, i64 0, i32 %si, i32 %sj
+  %vc = load i32, i32* %psc
+  %vc64 = sext i32 %vc to i64
+  %total.next = add i64 %total, %vc64
+  %sj.next = add i32 %sj, 1
+  %sj.done = icmp slt i32 %sj.next, 24
+  br i1 %sj.done, label %sum.col, label %sum.row.end
+sum.row.end:
+  %si.next = add i32 %si, 1
+  %si.done = icmp slt i32 %si.next, 24
+  br i1 %si.done, label %sum.row, label %exit
+
+exit:
+  ret i64 %total.next
+}
@@ -0,0 +1,49 @@
+; Sieve of Eratosthenes over the integers below 20000; returns the number of
+; primes found.  A flag array swept by loops with data-dependent strides.
+; expect: 2262
+
+define i64 @main() {
+entry:
+  %flags = alloca [20000 x i64]
+  br label %init
+init:
+  %n = phi i64 [ 0, %entry ], [ %n.next, %init ]
+  %pn = getelementptr [20000 x i64], [20000 x i64]* %flags, i64 0, i64 %n
+  store i64 1, i64* %pn
+  %n.next = add i64 %n, 1
+  %n.done = icmp slt i64 %n.next, 20000
+  br i1 %n.done, label %init, label %outer
+
+outer:
+  %i = phi i64 [ 2, %init ], [ %i.next, %outer.next ]
+  %sq = mul i64 %i, %i
+  %in.range = icmp slt i64 %sq, 20000
+  br i1 %in.range, label %test, label %count
+test:
+  %pi = getelementptr [20000 x i64], [20000 x i64]* %flags, i64 0, i64 %i
+  %prime = load i64, i64* %pi
+  %is.prime = icmp ne i64 %prime, 0
+  br i1 %is.prime, label %strike, label %outer.next
+strike:
+  %j = phi i64 [ %sq, %test ], [ %j.next, %strike ]
+  %pj = getelementptr [20000 x i64], [20000 x i64]* %flags, i64 0, i64 %j
+  store i64 0, i64* %pj
+  %j.next = add i64 %j, %i
+  %j.done = icmp slt i64 %j.next, 20000
+  br i1 %j.done, label %strike, label %outer.next
+outer.next:
+  %i.next = add i64 %i, 1
+  br label %outer
+
+count:
+  %k = phi i64 [ 2, %outer ], [ %k.next, %count ]
+  %primes = phi i64 [ 0, %outer ], [ %primes.next, %count ]
+  %pk = getelementptr [20000 x i64], [20000 x i64]* %flags, i64 0, i64 %k
+  %fk = load i64, i64* %pk
+  %primes.next = add i64 %primes, %fk
+  %k.next = add i64 %k, 1
+  %k.done = icmp slt i64 %k.next, 20000
+  br i1 %k.done, label %count, label %exit
+exit:
+  ret i64 %primes.next
+}
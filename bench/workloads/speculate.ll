@@ -0,0 +1,102 @@
+; Division by a divisor fixed at run time and by constants, an array read at
+; an index that never changes, and small loops with a fixed trip count, one
+; of them bounded by an argument.  Returns a checksum.  Exercises guarded
+; specialization (run with --jit-threshold above 16 so that values are seen
+; before blocks compile): the divisor and the window length change part way
+; through, so their guards fail and the code goes back to the interpreter.
+; expect: 244458172
+
+@table = global [8 x i64] [i64 3, i64 1, i64 4, i64 1, i64 5, i64 9, i64 2, i64 6]
+
+define i64 @divsum(i64 %n, i64 %d) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %x = sub i64 %i, 100
+  %q = sdiv i64 %x, %d
+  %r = srem i64 %x, %d
+  %c = sdiv i64 %x, 10
+  %m = srem i64 %x, -7
+  %qr = add i64 %q, %r
+  %cm = add i64 %c, %m
+  %cm3 = mul i64 %cm, 3
+  %sum = add i64 %qr, %cm3
+  %acc.next = add i64 %acc, %sum
+  %i.next = add i64 %i, 1
+  %more = icmp slt i64 %i.next, %n
+  br i1 %more, label %loop, label %exit
+
+exit:
+  ret i64 %acc.next
+}
+
+define i64 @dot8(i64 %k) {
+entry:
+  br label %loop
+
+loop:
+  %j = phi i64 [ 0, %entry ], [ %j.next, %loop ]
+  %s = phi i64 [ 0, %entry ], [ %s.next, %loop ]
+  %p = getelementptr [8 x i64], [8 x i64]* @table, i64 0, i64 %j
+  %v = load i64, i64* %p
+  %w = mul i64 %v, %k
+  %s.next = add i64 %s, %w
+  %j.next = add i64 %j, 1
+  %more = icmp slt i64 %j.next, 8
+  br i1 %more, label %loop, label %exit
+
+exit:
+  ret i64 %s.next
+}
+
+define i64 @window(i64 %col, i64 %len) {
+entry:
+  br label %loop
+
+loop:
+  %j = phi i64 [ 0, %entry ], [ %j.next, %loop ]
+  %s = phi i64 [ 0, %entry ], [ %s.next, %loop ]
+  %fixed = getelementptr [8 x i64], [8 x i64]* @table, i64 0, i64 %col
+  %f = load i64, i64* %fixed
+  %at = add i64 %j, %col
+  %p = getelementptr [8 x i64], [8 x i64]* @table, i64 0, i64 %at
+  %v = load i64, i64* %p
+  %fv = mul i64 %f, %v
+  %s.next = add i64 %s, %fv
+  %j.next = add i64 %j, 1
+  %more = icmp slt i64 %j.next, %len
+  br i1 %more, label %loop, label %exit
+
+exit:
+  ret i64 %s.next
+}
+
+define i64 @main() {
+entry:
+  br label %loop
+
+loop:
+  %k = phi i64 [ 0, %entry ], [ %k.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %early = icmp slt i64 %k, 200
+  %d = select i1 %early, i64 7, i64 -3
+  %a = call i64 @divsum(i64 200, i64 %d)
+  %b = call i64 @dot8(i64 %k)
+  %short = icmp slt i64 %k, 250
+  %len = select i1 %short, i64 5, i64 6
+  %c = call i64 @window(i64 2, i64 %len)
+  %ab = add i64 %a, %b
+  %abc = add i64 %ab, %c
+  %mixed = mul i64 %acc, 31
+  %sum = add i64 %mixed, %abc
+  %acc.next = srem i64 %sum, 1000000007
+  %k.next = add i64 %k, 1
+  %more = icmp slt i64 %k.next, 300
+  br i1 %more, label %loop, label %exit
+
+exit:
+  ret i64 %acc.next
+}
@@ -0,0 +1,74 @@
+; Particles advanced for 50 steps through struct copies: each particle is
+; copied into a cleared temporary, moved by its velocity and copied back.
+; Finally the array is shifted up by one element.  Returns the sum of all
+; positions.  Exercises llvm.memset, llvm.memcpy and llvm.memmove.
+; expect: 100850
+
+%struct.Particle = type { i64, i64, i32, i32 }
+
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8* noalias nocapture writeonly, i8* noalias nocapture readonly, i64, i1 immarg)
+declare void @llvm.memmove.p0i8.p0i8.i64(i8* nocapture writeonly, i8* nocapture readonly, i64, i1 immarg)
+declare void @llvm.memset.p0i8.i64(i8* nocapture writeonly, i8, i64, i1 immarg)
+
+define i64 @main() {
+entry:
+  %ps = alloca [64 x %struct.Particle], align 8
+  %tmp = alloca %struct.Particle, align 8
+  %ps8 = bitcast [64 x %struct.Particle]* %ps to i8*
+  %tmp8 = bitcast %struct.Particle* %tmp to i8*
+  call void @llvm.memset.p0i8.i64(i8* align 8 %ps8, i8 0, i64 1536, i1 false)
+  br label %init
+
+init:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %init ]
+  %vel = getelementptr [64 x %struct.Particle], [64 x %struct.Particle]* %ps, i64 0, i64 %i, i32 1
+  %i.next = add i64 %i, 1
+  store i64 %i.next, i64* %vel
+  %init.more = icmp slt i64 %i.next, 64
+  br i1 %init.more, label %init, label %step
+
+step:
+  %s = phi i64 [ 0, %init ], [ %s.next, %latch ]
+  br label %body
+
+body:
+  %j = phi i64 [ 0, %step ], [ %j.next, %body ]
+  %p = getelementptr [64 x %struct.Particle], [64 x %struct.Particle]* %ps, i64 0, i64 %j
+  %p8 = bitcast %struct.Particle* %p to i8*
+  call void @llvm.memset.p0i8.i64(i8* align 8 %tmp8, i8 0, i64 24, i1 false)
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %tmp8, i8* align 8 %p8, i64 24, i1 false)
+  %tpos = getelementptr %struct.Particle, %struct.Particle* %tmp, i64 0, i32 0
+  %tvel = getelementptr %struct.Particle, %struct.Particle* %tmp, i64 0, i32 1
+  %pos = load i64, i64* %tpos
+  %v = load i64, i64* %tvel
+  %pos.next = add i64 %pos, %v
+  store i64 %pos.next, i64* %tpos
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* align 8 %p8, i8* align 8 %tmp8, i64 24, i1 false)
+  %j.next = add i64 %j, 1
+  %body.more = icmp slt i64 %j.next, 64
+  br i1 %body.more, label %body, label %latch
+
+latch:
+  %s.next = add i64 %s, 1
+  %step.more = icmp slt i64 %s.next, 50
+  br i1 %step.more, label %step, label %shift
+
+shift:
+  %second = getelementptr [64 x %struct.Particle], [64 x %struct.Particle]* %ps, i64 0, i64 1
+  %second8 = bitcast %struct.Particle* %second to i8*
+  call void @llvm.memmove.p0i8.p0i8.i64(i8* align 8 %second8, i8* align 8 %ps8, i64 1512, i1 false)
+  br label %sum
+
+sum:
+  %k = phi i64 [ 0, %shift ], [ %k.next, %sum ]
+  %acc = phi i64 [ 0, %shift ], [ %acc.next, %sum ]
+  %kpos = getelementptr [64 x %struct.Particle], [64 x %struct.Particle]* %ps, i64 0, i64 %k, i32 0
+  %x = load i64, i64* %kpos
+  %acc.next = add i64 %acc, %x
+  %k.next = add i64 %k, 1
+  %sum.more = icmp slt i64 %k.next, 64
+  br i1 %sum.more, label %sum, label %exit
+
+exit:
+  ret i64 %acc.next
+}
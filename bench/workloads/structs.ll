@@ -0,0 +1,83 @@
+; Particles as an array of structs, advanced for 50 steps by adding each
+; particle's velocity to its position.  Returns the sum of all positions.
+; Exercises struct field GEPs nested inside array GEPs.
+; expect: 34900
+
+%vec = type { i64, i64 }
+%particle = type { %vec, %vec, i64 }
+
+define void @step(%particle* %p) {
+entry:
+  %px = getelementptr %particle, %particle* %p, i64 0, i32 0, i32 0
+  %py = getelementptr %particle, %particle* %p, i64 0, i32 0, i32 1
+  %vx = getelementptr %particle, %particle* %p, i64 0, i32 1, i32 0
+  %vy = getelementptr %particle, %particle* %p, i64 0, i32 1, i32 1
+  %age = getelementptr %particle, %particle* %p, i64 0, i32 2
+  %x = load i64, i64* %px
+  %y = load i64, i64* %py
+  %dx = load i64, i64* %vx
+  %dy = load i64, i64* %vy
+  %a = load i64, i64* %age
+  %x2 = add i64 %x, %dx
+  %y2 = add i64 %y, %dy
+  %a2 = add i64 %a, 1
+  store i64 %x2, i64* %px
+  store i64 %y2, i64* %py
+  store i64 %a2, i64* %age
+  ret void
+}
+
+define i64 @main() {
+entry:
+  %ps = alloca [200 x %particle]
+  br label %init
+init:
+  %n = phi i64 [ 0, %entry ], [ %n.next, %init ]
+  %ipx = getelementptr [200 x %particle], [200 x %particle]* %ps, i64 0, i64 %n, i32 0, i32 0
+  %ipy = getelementptr [200 x %particle], [200 x %particle]* %ps, i64 0, i64 %n, i32 0, i32 1
+  %ivx = getelementptr [200 x %particle], [200 x %particle]* %ps, i64 0, i64 %n, i32 1, i32 0
+  %ivy = getelementptr [200 x %particle], [200 x %particle]* %ps, i64 0, i64 %n, i32 1, i32 1
+  %iage = getelementptr [200 x %particle], [200 x %particle]* %ps, i64 0, i64 %n, i32 2
+  store i64 %n, i64* %ipx
+  store i64 0, i64* %ipy
+  store i64 1, i64* %ivx
+  %vy = sub i64 %n, 100
+  store i64 %vy, i64* %ivy
+  store i64 0, i64* %iage
+  %n.next = add i64 %n, 1
+  %n.done = icmp slt i64 %n.next, 200
+  br i1 %n.done, label %init, label %steps
+
+steps:
+  %t = phi i64 [ 0, %init ], [ %t.next, %steps.end ]
+  br label %move
+move:
+  %m = phi i64 [ 0, %steps ], [ %m.next, %move ]
+  %p = getelementptr [200 x %particle], [200 x %particle]* %ps, i64 0, i64 %m
+  call void @step(%particle* %p)
+  %m.next = add i64 %m, 1
+  %m.done = icmp slt i64 %m.next, 200
+  br i1 %m.done, label %move, label %steps.end
+steps.end:
+  %t.next = add i64 %t, 1
+  %t.done = icmp slt i64 %t.next, 50
+  br i1 %t.done, label %steps, label %sum
+
+sum:
+  %s = phi i64 [ 0, %steps.end ], [ %s.next, %sum ]
+  %total = phi i64 [ 0, %steps.end ], [ %total.next, %sum ]
+  %spx = getelementptr [200 x %particle], [200 x %particle]* %ps, i64 0, i64 %s, i32 0, i32 0
+  %spy = getelementptr [200 x %particle], [200 x %particle]* %ps, i64 0, i64 %s, i32 0, i32 1
+  %sage = getelementptr [200 x %particle], [200 x %particle]* %ps, i64 0, i64 %s, i32 2
+  %sx = load i64, i64* %spx
+  %sy = load i64, i64* %spy
+  %sa = load i64, i64* %sage
+  %xy = add i64 %sx, %sy
+  %xya = add i64 %xy, %sa
+  %total.next = add i64 %total, %xya
+  %s.next = add i64 %s, 1
+  %s.done = icmp slt i64 %s.next, 200
+  br i1 %s.done, label %sum, label %exit
+exit:
+  ret i64 %total.next
+}
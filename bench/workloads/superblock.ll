@@ -0,0 +1,43 @@
+; A loop whose body is a chain of blocks behind a rarely taken branch: one
+; iteration in 97 takes the cold path, the rest run the hot chain into a
+; shared latch.  Returns the accumulator.  Exercises superblocks with side
+; exits and phis on the edges inside them.
+; expect: 527032
+
+define i64 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %latch ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %latch ]
+  %r = srem i64 %i, 97
+  %rare = icmp eq i64 %r, 0
+  br i1 %rare, label %cold, label %hot
+
+hot:
+  %scaled = mul i64 %i, 3
+  %sum = add i64 %acc, %scaled
+  br label %hot.reduce
+
+hot.reduce:
+  %reduced = srem i64 %sum, 1000003
+  %big = icmp sgt i64 %reduced, 500000
+  %folded = sub i64 %reduced, 7
+  %picked = select i1 %big, i64 %folded, i64 %reduced
+  br label %latch
+
+cold:
+  %dropped = sub i64 %acc, %i
+  %halved = sdiv i64 %dropped, 2
+  br label %latch
+
+latch:
+  %acc.next = phi i64 [ %picked, %hot.reduce ], [ %halved, %cold ]
+  %i.next = add i64 %i, 1
+  %more = icmp slt i64 %i.next, 300000
+  br i1 %more, label %loop, label %exit
+
+exit:
+  ret i64 %acc.next
+}
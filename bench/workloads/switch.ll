@@ -0,0 +1,92 @@
+; A dispatch loop: each iteration picks an operation through a dense switch
+; on i mod 8 and an adjustment through a sparse switch on i mod 1000.
+; Returns the accumulator.  Exercises jump-table and compare-tree switches.
+; expect: 573444
+
+define i64 @main() {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %adjusted ]
+  %acc = phi i64 [ 0, %entry ], [ %y, %adjusted ]
+  %op = srem i64 %i, 8
+  switch i64 %op, label %op.default [
+    i64 0, label %op.add
+    i64 1, label %op.sub
+    i64 2, label %op.seven
+    i64 3, label %op.half
+    i64 5, label %op.hundred
+    i64 6, label %op.mod
+  ]
+
+op.add:
+  %x0 = add i64 %acc, %i
+  br label %merged
+
+op.sub:
+  %x1 = sub i64 %acc, 3
+  br label %merged
+
+op.seven:
+  %x2 = add i64 %acc, 7
+  br label %merged
+
+op.half:
+  %h = sdiv i64 %i, 2
+  %x3 = sub i64 %acc, %h
+  br label %merged
+
+op.hundred:
+  %x5 = add i64 %acc, 100
+  br label %merged
+
+op.mod:
+  %x6 = srem i64 %acc, 1000003
+  br label %merged
+
+op.default:
+  %xd = add i64 %acc, 1
+  br label %merged
+
+merged:
+  %x = phi i64 [ %x0, %op.add ], [ %x1, %op.sub ], [ %x2, %op.seven ], [ %x3, %op.half ], [ %x5, %op.hundred ], [ %x6, %op.mod ], [ %xd, %op.default ]
+  %k = srem i64 %i, 1000
+  switch i64 %k, label %adjusted [
+    i64 7, label %adj.a
+    i64 100, label %adj.b
+    i64 250, label %adj.c
+    i64 500, label %adj.d
+    i64 999, label %adj.e
+    i64 -5, label %adj.e
+  ]
+
+adj.a:
+  %ya = add i64 %x, 11
+  br label %adjusted
+
+adj.b:
+  %yb = sub i64 %x, 13
+  br label %adjusted
+
+adj.c:
+  %yc = add i64 %x, 17
+  br label %adjusted
+
+adj.d:
+  %yd = add i64 %x, 19
+  br label %adjusted
+
+adj.e:
+  %ye = sub i64 %x, 23
+  br label %adjusted
+
+adjusted:
+  %y = phi i64 [ %x, %merged ], [ %ya, %adj.a ], [ %yb, %adj.b ], [ %yc, %adj.c ], [ %yd, %adj.d ], [ %ye, %adj.e ]
+  %i.next = add i64 %i, 1
+  %more = icmp slt i64 %i.next, 200000
+  br i1 %more, label %loop, label %exit
+
+exit:
+  ret i64 %y
+}
@@ -0,0 +1,61 @@
+; Element-wise array arithmetic over globals: a[i] = b[i] + c[i] + r,
+; repeated with a different r each round, then a checksum of a.  Every
+; loop is a unit-stride self-loop that --jit-rvv runs as vector code.
+; expect: 22622208
+
+@a = global [4096 x i64] zeroinitializer
+@b = global [4096 x i64] zeroinitializer
+@c = global [4096 x i64] zeroinitializer
+
+define i64 @main() {
+entry:
+  br label %fill
+
+fill:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %fill ]
+  %pb = getelementptr [4096 x i64], [4096 x i64]* @b, i64 0, i64 %i
+  %pc = getelementptr [4096 x i64], [4096 x i64]* @c, i64 0, i64 %i
+  %bv = mul i64 %i, 3
+  %cv = sub i64 1365, %i
+  store i64 %bv, i64* %pb
+  store i64 %cv, i64* %pc
+  %i.next = add i64 %i, 1
+  %fill.more = icmp slt i64 %i.next, 4096
+  br i1 %fill.more, label %fill, label %round
+
+round:
+  %r = phi i64 [ 0, %fill ], [ %r.next, %round.end ]
+  br label %add
+
+add:
+  %j = phi i64 [ 0, %round ], [ %j.next, %add ]
+  %qa = getelementptr [4096 x i64], [4096 x i64]* @a, i64 0, i64 %j
+  %qb = getelementptr [4096 x i64], [4096 x i64]* @b, i64 0, i64 %j
+  %qc = getelementptr [4096 x i64], [4096 x i64]* @c, i64 0, i64 %j
+  %x = load i64, i64* %qb
+  %y = load i64, i64* %qc
+  %xy = add i64 %x, %y
+  %s = add i64 %xy, %r
+  store i64 %s, i64* %qa
+  %j.next = add i64 %j, 1
+  %add.more = icmp slt i64 %j.next, 4096
+  br i1 %add.more, label %add, label %round.end
+
+round.end:
+  %r.next = add i64 %r, 1
+  %round.more = icmp slt i64 %r.next, 64
+  br i1 %round.more, label %round, label %check
+
+check:
+  %k = phi i64 [ 0, %round.end ], [ %k.next, %check ]
+  %acc = phi i64 [ 0, %round.end ], [ %acc.next, %check ]
+  %qk = getelementptr [4096 x i64], [4096 x i64]* @a, i64 0, i64 %k
+  %v = load i64, i64* %qk
+  %acc.next = add i64 %acc, %v
+  %k.next = add i64 %k, 1
+  %check.more = icmp slt i64 %k.next, 4096
+  br i1 %check.more, label %check, label %done
+
+done:
+  ret i64 %acc.next
+}
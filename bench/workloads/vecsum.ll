@@ -0,0 +1,81 @@
+; Add reductions over an array reached through a pointer argument: a
+; generator fills the array, then one self-loop sums it and another sums
+; its elements scaled by a weight that changes every round.  Both summing
+; loops are reductions that --jit-rvv runs as vector code.
+; expect: 3387759232
+
+@data = global [8192 x i64] zeroinitializer
+
+; Sum of p[0..n), n > 0.
+define i64 @sum(i64* %p, i64 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %q = getelementptr i64, i64* %p, i64 %i
+  %v = load i64, i64* %q
+  %acc.next = add i64 %acc, %v
+  %i.next = add i64 %i, 1
+  %more = icmp slt i64 %i.next, %n
+  br i1 %more, label %loop, label %done
+
+done:
+  ret i64 %acc.next
+}
+
+; Sum of p[i] * w + i over p[0..n), n > 0.
+define i64 @weighted(i64* %p, i64 %n, i64 %w) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ 0, %entry ], [ %acc.next, %loop ]
+  %q = getelementptr i64, i64* %p, i64 %i
+  %v = load i64, i64* %q
+  %vw = mul i64 %v, %w
+  %t = add i64 %vw, %i
+  %acc.next = add i64 %acc, %t
+  %i.next = add i64 %i, 1
+  %more = icmp slt i64 %i.next, %n
+  br i1 %more, label %loop, label %done
+
+done:
+  ret i64 %acc.next
+}
+
+define i64 @main() {
+entry:
+  %base = getelementptr [8192 x i64], [8192 x i64]* @data, i64 0, i64 0
+  br label %fill
+
+fill:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %fill ]
+  %s = phi i64 [ 12345, %entry ], [ %s.next, %fill ]
+  %s.mul = mul i64 %s, 1103515245
+  %s.add = add i64 %s.mul, 12345
+  %s.next = srem i64 %s.add, 2147483648
+  %v = srem i64 %s.next, 1000
+  %q = getelementptr i64, i64* %base, i64 %i
+  store i64 %v, i64* %q
+  %i.next = add i64 %i, 1
+  %fill.more = icmp slt i64 %i.next, 8192
+  br i1 %fill.more, label %fill, label %round
+
+round:
+  %r = phi i64 [ 0, %fill ], [ %r.next, %round ]
+  %total = phi i64 [ 0, %fill ], [ %total.next, %round ]
+  %plain = call i64 @sum(i64* %base, i64 8192)
+  %w = add i64 %r, 1
+  %weighted = call i64 @weighted(i64* %base, i64 8192, i64 %w)
+  %both = add i64 %plain, %weighted
+  %total.next = add i64 %total, %both
+  %r.next = add i64 %r, 1
+  %round.more = icmp slt i64 %r.next, 32
+  br i1 %round.more, label %round, label %done
+
+done:
+  ret i64 %total.next
+}
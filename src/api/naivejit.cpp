@@ -0,0 +1,71 @@
+#include "naivejit.hpp"
+#include <atomic>
+#include <exception>
+#include <thread>
+
+NaiveJIT::NaiveJIT(const std::string &Filename, const JITOptions &Opts, const LoadOptions &LoadOpts)
+  : ctx(std::make_unique<llvm::LLVMContext>()) {
+  mod = loadModuleFromFile(Filename, *ctx, LoadOpts, &load_info);
+  jit = std::make_unique<JITRunner>(*mod, Opts);
+}
+
+NaiveJIT::~NaiveJIT() {
+  try {
+    jit->flush();
+  } catch (const std::exception &e) {
+    std::cerr << "naive_jit: " << e.what() << "\n";
+  }
+}
+
+JITStats NaiveJIT::stats() {
+  JITStats S = jit->stats();
+  S.has_load_info = true;
+  S.load = load_info;
+  return S;
+}
+
+int64_t NaiveJIT::run(const std::string &Entry, const std::vector<int64_t> &Args) {
+  llvm::Function *F = mod->getFunction(Entry);
+  if (!F) {
+    throw std::runtime_error("No function called '" + Entry + "'.");
+  }
+  return jit->run(F, Args);
+}
+
+std::vector<int64_t> NaiveJIT::runMany(const std::string &Entry, const std::vector<std::vector<int64_t>> &ArgSets,
+                                       unsigned Threads) {
+  llvm::Function *F = mod->getFunction(Entry);
+  if (!F) {
+    throw std::runtime_error("No function called '" + Entry + "'.");
+  }
+  unsigned num_threads = Threads ? Threads : std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min<size_t>(num_threads, ArgSets.size());
+
+  std::vector<int64_t> results(ArgSets.size());
+  std::atomic<size_t> next{0};
+  std::mutex error_mutex;
+  std::exception_ptr error;
+  auto worker = [&] {
+    for (size_t i = next++; i < ArgSets.size(); i = next++) {
+      try {
+        results[i] = jit->run(F, ArgSets[i]);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+      }
+    }
+  };
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < num_threads; ++t) {
+    threads.emplace_back(worker);
+  }
+  for (std::thread &T : threads) {
+    T.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+  return results;
+}
@@ -0,0 +1,59 @@
+#ifndef NAIVEJIT_HPP
+#define NAIVEJIT_HPP
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "../parser/parser.hpp"
+#include "../jitrunner/jitrunner.hpp"
+
+/// Embedding entry point of libnaive_jit.  Loads a module once and runs its
+/// functions any number of times.  Compiled code, slot layouts and execution
+/// profiles are kept between runs; each run starts from fresh globals and
+/// allocas.  run() may be called from several threads at once.
+///
+///   NaiveJIT jit("prog.ll");
+///   for (int64_t n : inputs)
+///     results.push_back(jit.run("solve", {n}));
+class NaiveJIT {
+public:
+  /// Load Filename and set up a runner for it.  Throws std::runtime_error if
+  /// the module cannot be loaded.
+  explicit NaiveJIT(const std::string &Filename, const JITOptions &Opts = JITOptions(),
+                    const LoadOptions &LoadOpts = LoadOptions());
+
+  /// Persists the code cache and profile, if enabled.
+  ~NaiveJIT();
+
+  NaiveJIT(const NaiveJIT &) = delete;
+
+  NaiveJIT &operator=(const NaiveJIT &) = delete;
+
+  /// Run the function named Entry.  Throws std::runtime_error if it does not
+  /// exist, is only declared, gets the wrong number of arguments, or fails.
+  int64_t run(const std::string &Entry, const std::vector<int64_t> &Args = {});
+
+  /// Run Entry once per element of ArgSets on Threads threads (0 for one per
+  /// core) and return the results in order.  Rethrows the first failure
+  /// after every thread has finished.
+  std::vector<int64_t> runMany(const std::string &Entry, const std::vector<std::vector<int64_t>> &ArgSets,
+                               unsigned Threads = 0);
+
+  llvm::Module &module() { return *mod; }
+
+  JITRunner &runner() { return *jit; }
+
+  const LoadInfo &loadInfo() const { return load_info; }
+
+  /// Runner statistics plus how the module was loaded.  Execution counts need
+  /// JITOptions::collect_stats.  Must not race with run().
+  JITStats stats();
+
+private:
+  std::unique_ptr<llvm::LLVMContext> ctx;
+  std::unique_ptr<llvm::Module> mod;
+  std::unique_ptr<JITRunner> jit;
+  LoadInfo load_info;
+};
+
+#endif // NAIVEJIT_HPP
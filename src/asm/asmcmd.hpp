@@ -13,6 +13,28 @@ inline void write_uint32(unsigned char* buf, uint32_t val) {
   buf[3] = (val >> 24) & 0xff;
 }
 
+inline unsigned char* encodeWord(uint32_t inst) {
+  unsigned char* buf = new unsigned char[4];
+  write_uint32(buf, inst);
+  return buf;
+}
+
+inline unsigned char* encodeHalf(uint16_t val) {
+  unsigned char* buf = new unsigned char[2];
+  buf[0] = val & 0xff;
+  buf[1] = (val >> 8) & 0xff;
+  return buf;
+}
+
+/// Registers x8-x15, the only ones most compressed instructions can name.
+inline bool isCompressedReg(int64_t id) {
+  return id >= 8 && id <= 15;
+}
+
+inline bool fitsSigned(int64_t value, int bits) {
+  return value >= -(int64_t(1) << (bits - 1)) && value < (int64_t(1) << (bits - 1));
+}
+
 class Instruction {
 public:
   Instruction() = default;
@@ -23,7 +45,18 @@ public:
 
   virtual unsigned char* encode() const = 0;
 
+  /// Bytes encode() produces: 2 for a compressed instruction, 4 for a full
+  /// one, more for sequences.
   virtual int64_t size() const = 0;
+
+  /// Allow the 16-bit forms of the C extension where operands fit.  Set by
+  /// AsmBlock::encode() before sizes are taken.
+  void setCompressed(bool Enable) const {
+    compressed = Enable;
+  }
+
+protected:
+  mutable bool compressed = false;
 };
 
 class binary : public Instruction {
@@ -32,6 +65,7 @@ public:
     ADD,
     SUB,
     MUL,
+    MULH,
     DIV,
     MOD,
     AND,
@@ -40,13 +74,14 @@ public:
     SHL,
     SHR,
     ASHR,
-
-    EQ,
-    NE,
     SLT,
-    SLE,
-    SGT,
-    SGE
+    SLTU,
+    MIN,       // Zbb
+    MAX,
+    MINU,
+    MAXU,
+    CZERO_EQZ, // Zicond: target = rhs == 0 ? 0 : lhs
+    CZERO_NEZ  // Zicond: target = rhs != 0 ? 0 : lhs
   };
 
   binary(const Opcode op, const asmcode::Register &target, const asmcode::Register &lhs, const asmcode::Register &rhs) : target(target), lhs(lhs), rhs(rhs) {
@@ -60,6 +95,9 @@ public:
       case MUL:
         this->op = "mul";
         break;
+      case MULH:
+        this->op = "mulh";
+        break;
       case MOD:
         this->op = "mod";
         break;
@@ -84,23 +122,29 @@ public:
       case DIV:
         this->op = "div";
         break;
-      case EQ:
-        this->op = "eq";
-        break;
-      case NE:
-        this->op = "ne";
-        break;
       case SLT:
         this->op = "slt";
         break;
-      case SLE:
-        this->op = "sle";
+      case SLTU:
+        this->op = "sltu";
+        break;
+      case MIN:
+        this->op = "min";
+        break;
+      case MAX:
+        this->op = "max";
+        break;
+      case MINU:
+        this->op = "minu";
         break;
-      case SGT:
-        this->op = "sgt";
+      case MAXU:
+        this->op = "maxu";
         break;
-      case SGE:
-        this->op = "sge";
+      case CZERO_EQZ:
+        this->op = "czero.eqz";
+        break;
+      case CZERO_NEZ:
+        this->op = "czero.nez";
         break;
 
       default:
@@ -113,12 +157,16 @@ public:
   }
 
   unsigned char* encode() const override {
+    if (compressedForm()) {
+      return encodeCompressed();
+    }
     uint32_t opcode = 0x33;  // OP opcode
     uint32_t funct3, funct7;
 
     if (op == "add") { funct3 = 0x0; funct7 = 0x00; }
     else if (op == "sub") { funct3 = 0x0; funct7 = 0x20; }
     else if (op == "mul") { funct3 = 0x0; funct7 = 0x01; }
+    else if (op == "mulh") { funct3 = 0x1; funct7 = 0x01; }
     else if (op == "div") { funct3 = 0x4; funct7 = 0x01; }
     else if (op == "mod") { funct3 = 0x6; funct7 = 0x01; } // rem
     else if (op == "and") { funct3 = 0x7; funct7 = 0x00; }
@@ -128,10 +176,13 @@ public:
     else if (op == "shr") { funct3 = 0x5; funct7 = 0x00; } // srl
     else if (op == "ashr") { funct3 = 0x5; funct7 = 0x20; } // sra
     else if (op == "slt") { funct3 = 0x2; funct7 = 0x00; }
-    else if (op == "sge") { funct3 = 0x2; funct7 = 0x01; } // pseudo
-    else if (op == "sgt") { funct3 = 0x3; funct7 = 0x01; } // pseudo
-    else if (op == "eq") { funct3 = 0x0; funct7 = 0x01; } // pseudo
-    else if (op == "ne") { funct3 = 0x1; funct7 = 0x01; } // pseudo
+    else if (op == "sltu") { funct3 = 0x3; funct7 = 0x00; }
+    else if (op == "min") { funct3 = 0x4; funct7 = 0x05; }
+    else if (op == "minu") { funct3 = 0x5; funct7 = 0x05; }
+    else if (op == "max") { funct3 = 0x6; funct7 = 0x05; }
+    else if (op == "maxu") { funct3 = 0x7; funct7 = 0x05; }
+    else if (op == "czero.eqz") { funct3 = 0x5; funct7 = 0x07; }
+    else if (op == "czero.nez") { funct3 = 0x7; funct7 = 0x07; }
     else {
       throw std::runtime_error("Unsupported op: " + op);
     }
@@ -145,26 +196,66 @@ public:
   }
 
   int64_t size() const override {
-    return 4; // Each instruction is 4 bytes
+    return compressedForm() ? 2 : 4;
   }
 
 private:
+  /// c.add rd, rs2 (rd = rd + rs2, either operand order), c.mv rd, rs2
+  /// (rd = zero + rs2), and c.sub/c.and/c.or/c.xor on x8-x15 with rd = lhs.
+  bool compressedForm() const {
+    if (!compressed || target.id() == 0) {
+      return false;
+    }
+    if (op == "add") {
+      int64_t other = target.id() == lhs.id() ? rhs.id() : target.id() == rhs.id() ? lhs.id() : -1;
+      return other > 0 || (lhs.id() == 0 && rhs.id() != 0);
+    }
+    if (op == "sub" || op == "and" || op == "or" || op == "xor") {
+      return target.id() == lhs.id() && isCompressedReg(target.id()) && isCompressedReg(rhs.id());
+    }
+    return false;
+  }
+
+  unsigned char* encodeCompressed() const {
+    uint32_t rd = target.id();
+    if (op == "add") {
+      uint32_t rs2 = lhs.id() == 0 ? rhs.id() : target.id() == lhs.id() ? rhs.id() : lhs.id();
+      uint32_t funct4 = lhs.id() == 0 ? 0x8 : 0x9; // c.mv / c.add
+      return encodeHalf((funct4 << 12) | (rd << 7) | (rs2 << 2) | 0x2);
+    }
+    uint32_t funct2 = op == "sub" ? 0x0 : op == "xor" ? 0x1 : op == "or" ? 0x2 : 0x3;
+    return encodeHalf((0x23 << 10) | ((rd - 8) << 7) | (funct2 << 5) | ((rhs.id() - 8) << 2) | 0x1);
+  }
+
   asmcode::Register target;
   asmcode::Register lhs;
   asmcode::Register rhs;
   std::string op;
 };
 
+/// Load of `width` bytes (1, 2, 4 or 8), sign-extended to 64 bits.
 class ld : public Instruction {
 public:
-  ld(const asmcode::Register &reg, const asmcode::Register &address, const asmcode::Immediate &offset = asmcode::Immediate(0)) : reg(reg), address(address), offset(offset) {
+  ld(const asmcode::Register &reg, const asmcode::Register &address, const asmcode::Immediate &offset = asmcode::Immediate(0), unsigned width = 8) : reg(reg), address(address), offset(offset), width(width) {
   }
 
   std::string toString() const override {
-    return "ld " + reg.toString() + ", " + offset.toString() + "(" + address.toString() + ")";
+    return std::string(widthSuffix("l", width)) + " " + reg.toString() + ", " + offset.toString() + "(" + address.toString() + ")";
   }
 
   unsigned char* encode() const override {
+    uint32_t off = offset.getValue();
+    if (width != 8) {
+      return encodeWord((off << 20) | (address.id() << 15) | (widthFunct3(width) << 12) | (reg.id() << 7) | 0x03);
+    }
+    if (compressed && spForm(address, reg, offset, false)) {
+      // c.ldsp: uimm[5] at 12, uimm[4:3] at 6:5, uimm[8:6] at 4:2.
+      return encodeHalf((0x3 << 13) | (((off >> 5) & 0x1) << 12) | (reg.id() << 7) | (((off >> 3) & 0x3) << 5) |
+                        (((off >> 6) & 0x7) << 2) | 0x2);
+    }
+    if (compressed && regForm(address, reg, offset)) {
+      return encodeHalf(encodeCompressedMem(0x3, address.id(), reg.id(), off));
+    }
     uint32_t opcode = 0x03; // LOAD
     uint32_t funct3 = 0x3;  // LD (64-bit)
     uint32_t imm = offset.getValue();       // offset 0
@@ -178,25 +269,67 @@ public:
   }
 
   int64_t size() const override {
-    return 4; // Each instruction is 4 bytes
+    return compressed && width == 8 && (spForm(address, reg, offset, false) || regForm(address, reg, offset)) ? 2 : 4;
+  }
+
+  /// funct3 of a load or store of `width` bytes: log2 of the width.
+  static uint32_t widthFunct3(unsigned width) {
+    return width == 1 ? 0x0 : width == 2 ? 0x1 : width == 4 ? 0x2 : 0x3;
+  }
+
+  /// The mnemonic of a load ("l") or store ("s") of `width` bytes.
+  static std::string widthSuffix(const char* kind, unsigned width) {
+    return std::string(kind) + (width == 1 ? "b" : width == 2 ? "h" : width == 4 ? "w" : "d");
+  }
+
+  /// c.ldsp / c.sdsp: doubleword offsets 0-504 from sp.  c.ldsp cannot load x0.
+  static bool spForm(const asmcode::Register &address, const asmcode::Register &reg, const asmcode::Immediate &offset, bool store) {
+    int64_t off = offset.getValue();
+    return address.id() == 2 && (store || reg.id() != 0) && off >= 0 && off < 512 && off % 8 == 0;
+  }
+
+  /// c.ld / c.sd: doubleword offsets 0-248 with both registers in x8-x15.
+  static bool regForm(const asmcode::Register &address, const asmcode::Register &reg, const asmcode::Immediate &offset) {
+    int64_t off = offset.getValue();
+    return isCompressedReg(address.id()) && isCompressedReg(reg.id()) && off >= 0 && off < 256 && off % 8 == 0;
+  }
+
+  /// c.ld (funct3 011) and c.sd (111): uimm[5:3] at 12:10, uimm[7:6] at 6:5.
+  static uint16_t encodeCompressedMem(uint32_t funct3, uint32_t base, uint32_t reg, uint32_t off) {
+    return (funct3 << 13) | (((off >> 3) & 0x7) << 10) | ((base - 8) << 7) | (((off >> 6) & 0x3) << 5) |
+      ((reg - 8) << 2);
   }
 
 private:
   asmcode::Register reg;
   asmcode::Register address;
   asmcode::Immediate offset;
+  unsigned width;
 };
 
+/// Store of the low `width` bytes (1, 2, 4 or 8) of a register.
 class st : public Instruction {
 public:
-  st(const asmcode::Register& reg, const asmcode::Register& address, const asmcode::Immediate& offset = asmcode::Immediate(0)) : reg(reg), address(address), offset(offset) {
+  st(const asmcode::Register& reg, const asmcode::Register& address, const asmcode::Immediate& offset = asmcode::Immediate(0), unsigned width = 8) : reg(reg), address(address), offset(offset), width(width) {
   }
 
   std::string toString() const override {
-    return "sd " + reg.toString() + ", " + offset.toString() + "(" + address.toString() + ")";
+    return ld::widthSuffix("s", width) + " " + reg.toString() + ", " + offset.toString() + "(" + address.toString() + ")";
   }
 
   unsigned char* encode() const override {
+    uint32_t off = offset.getValue();
+    if (width != 8) {
+      return encodeWord((((off >> 5) & 0x7F) << 25) | (reg.id() << 20) | (address.id() << 15) |
+                        (ld::widthFunct3(width) << 12) | ((off & 0x1F) << 7) | 0x23);
+    }
+    if (compressed && ld::spForm(address, reg, offset, true)) {
+      // c.sdsp: uimm[5:3] at 12:10, uimm[8:6] at 9:7.
+      return encodeHalf((0x7 << 13) | (((off >> 3) & 0x7) << 10) | (((off >> 6) & 0x7) << 7) | (reg.id() << 2) | 0x2);
+    }
+    if (compressed && ld::regForm(address, reg, offset)) {
+      return encodeHalf(ld::encodeCompressedMem(0x7, address.id(), reg.id(), off));
+    }
     uint32_t opcode = 0x23; // STORE
     uint32_t funct3 = 0x3;  // SD (64-bit)
     uint32_t imm = offset.getValue();       // offset 0
@@ -212,15 +345,349 @@ public:
   }
 
   int64_t size() const override {
-    return 4; // Each instruction is 4 bytes
+    return compressed && width == 8 && (ld::spForm(address, reg, offset, true) || ld::regForm(address, reg, offset)) ? 2 : 4;
   }
 
 private:
   asmcode::Register reg;
   asmcode::Register address;
   asmcode::Immediate offset;
+  unsigned width;
+};
+
+class binaryi : public Instruction {
+public:
+  enum Opcode {
+    ADDI,
+    XORI,
+    SLTIU,
+    SLLI,
+    ANDI,
+    SRAI,
+    SRLI
+  };
+
+  binaryi(const Opcode op, const asmcode::Register &target, const asmcode::Register &source, const asmcode::Immediate &imm) : op(op), target(target), source(source), imm(imm) {
+  }
+
+  std::string toString() const override {
+    static const char* names[] = {"addi", "xori", "sltiu", "slli", "andi", "srai", "srli"};
+    return std::string(names[op]) + " " + target.toString() + ", " + source.toString() + ", " + imm.toString();
+  }
+
+  unsigned char* encode() const override {
+    int64_t value = imm.getValue();
+    uint32_t rd = target.id();
+    switch (compressedForm()) {
+      case C_ADDI:
+        return encodeHalf((((value >> 5) & 0x1) << 12) | (rd << 7) | ((value & 0x1F) << 2) | 0x1);
+      case C_LI:
+        return encodeHalf((0x2 << 13) | (((value >> 5) & 0x1) << 12) | (rd << 7) | ((value & 0x1F) << 2) | 0x1);
+      case C_ADDI16SP:
+        // nzimm[9] at 12, nzimm[4|6|8:7|5] at 6:2.
+        return encodeHalf((0x3 << 13) | (((value >> 9) & 0x1) << 12) | (2 << 7) | (((value >> 4) & 0x1) << 6) |
+                          (((value >> 6) & 0x1) << 5) | (((value >> 7) & 0x3) << 3) | (((value >> 5) & 0x1) << 2) | 0x1);
+      case C_SLLI:
+        return encodeHalf((((value >> 5) & 0x1) << 12) | (rd << 7) | ((value & 0x1F) << 2) | 0x2);
+      case NONE:
+        break;
+    }
+    uint32_t opcode = 0x13; // OP-IMM
+    uint32_t funct3;
+    switch (op) {
+      case ADDI: funct3 = 0x0; break;
+      case XORI: funct3 = 0x4; break;
+      case SLTIU: funct3 = 0x3; break;
+      case SLLI: funct3 = 0x1; break;
+      case ANDI: funct3 = 0x7; break;
+      case SRAI: funct3 = 0x5; break;
+      case SRLI: funct3 = 0x5; break;
+    }
+    uint32_t field = op == SLLI || op == SRLI ? (imm.getValue() & 0x3F) : op == SRAI ? (0x400 | (imm.getValue() & 0x3F)) : (imm.getValue() & 0xFFF);
+    uint32_t inst = (field << 20) | (source.id() << 15) | (funct3 << 12) | (target.id() << 7) | opcode;
+
+    unsigned char* buf = new unsigned char[4];
+    write_uint32(buf, inst);
+    return buf;
+  }
+
+  int64_t size() const override {
+    return compressedForm() == NONE ? 4 : 2;
+  }
+
+private:
+  enum Form {
+    NONE,
+    C_ADDI,     // addi rd, rd, nzimm6
+    C_LI,       // addi rd, zero, imm6
+    C_ADDI16SP, // addi sp, sp, nzimm (multiple of 16)
+    C_SLLI      // slli rd, rd, nzshamt
+  };
+
+  Form compressedForm() const {
+    int64_t value = imm.getValue();
+    if (!compressed || target.id() == 0) {
+      return NONE;
+    }
+    if (op == ADDI && source.id() == 0 && fitsSigned(value, 6)) {
+      return C_LI;
+    }
+    if (source.id() != target.id() || value == 0) {
+      return NONE;
+    }
+    if (op == ADDI && target.id() == 2 && value % 16 == 0 && fitsSigned(value, 10)) {
+      return C_ADDI16SP;
+    }
+    if (op == ADDI && fitsSigned(value, 6)) {
+      return C_ADDI;
+    }
+    if (op == SLLI) {
+      return C_SLLI;
+    }
+    return NONE;
+  }
+
+  Opcode op;
+  asmcode::Register target;
+  asmcode::Register source;
+  asmcode::Immediate imm;
+};
+
+/// A position in the instruction stream that branches refer to.  Emits no
+/// code; AsmBlock::encode() resolves branch offsets against it.
+class label : public Instruction {
+public:
+  explicit label(unsigned id) : id(id) {
+  }
+
+  std::string toString() const override {
+    return ".L" + std::to_string(id) + ":";
+  }
+
+  unsigned char* encode() const override {
+    return new unsigned char[1];
+  }
+
+  int64_t size() const override {
+    return 0;
+  }
+
+  unsigned getId() const {
+    return id;
+  }
+
+private:
+  unsigned id;
+};
+
+/// An instruction reaching a label of the same block by a pc-relative
+/// offset.  AsmBlock::encode() sets the offset once label positions are
+/// known and relaxes each reference to the smallest form that reaches.
+class labelref : public Instruction {
+public:
+  enum Form {
+    SHORT = 2,  // Compressed
+    NORMAL = 4,
+    LONG = 8    // Beyond the range of the 4-byte form
+  };
+
+  explicit labelref(unsigned target) : target(target) {
+  }
+
+  int64_t size() const override {
+    return form;
+  }
+
+  unsigned getTarget() const {
+    return target;
+  }
+
+  /// Bytes from the start of this instruction to its label.
+  void setOffset(int64_t value) const {
+    offset = value;
+  }
+
+  Form getForm() const {
+    return form;
+  }
+
+  void setForm(Form f) const {
+    form = f;
+  }
+
+  /// Smallest form that reaches the current offset.
+  virtual Form fit() const = 0;
+
+  /// jal rd, offset.
+  static uint32_t encodeJ(uint32_t rd, int64_t offset) {
+    uint32_t imm = (uint32_t)offset;
+    return (((imm >> 20) & 0x1) << 31) | (((imm >> 1) & 0x3FF) << 21) | (((imm >> 11) & 0x1) << 20) |
+      (((imm >> 12) & 0xFF) << 12) | (rd << 7) | 0x6F;
+  }
+
+protected:
+  unsigned target;
+  mutable int64_t offset = 0;
+  mutable Form form = NORMAL;
 };
 
+/// Conditional branch: c.beqz/c.bnez when the register and offset allow,
+/// the B-type otherwise, and an inverted branch over a `jal` beyond +-4 KiB.
+class branch : public labelref {
+public:
+  enum Opcode {
+    BEQ,
+    BNE,
+    BLT,
+    BGE,
+    BLTU,
+    BGEU
+  };
+
+  branch(const Opcode op, const asmcode::Register &lhs, const asmcode::Register &rhs, unsigned target) : labelref(target), op(op), lhs(lhs), rhs(rhs) {
+  }
+
+  std::string toString() const override {
+    static const char* names[] = {"beq", "bne", "blt", "bge", "bltu", "bgeu"};
+    return std::string(names[op]) + " " + lhs.toString() + ", " + rhs.toString() + ", .L" + std::to_string(target);
+  }
+
+  unsigned char* encode() const override {
+    static const uint32_t funct3[] = {0x0, 0x1, 0x4, 0x5, 0x6, 0x7};
+    if (form == SHORT) {
+      // offset[8|4:3] at 12:10, offset[7:6|2:1|5] at 6:2.
+      uint32_t imm = (uint32_t)offset;
+      return encodeHalf(((op == BEQ ? 0x6 : 0x7) << 13) | (((imm >> 8) & 0x1) << 12) | (((imm >> 3) & 0x3) << 10) |
+                        ((lhs.id() - 8) << 7) | (((imm >> 6) & 0x3) << 5) | (((imm >> 1) & 0x3) << 3) |
+                        (((imm >> 5) & 0x1) << 2) | 0x1);
+    }
+    if (form == LONG) {
+      // Skip the jal when the condition does not hold.
+      unsigned char* buf = new unsigned char[8];
+      write_uint32(buf, encodeB(funct3[op] ^ 0x1, 8));
+      write_uint32(buf + 4, encodeJ(0, offset - 4));
+      return buf;
+    }
+    if (!fitsSigned(offset, 13)) {
+      throw std::runtime_error("Branch target out of range.");
+    }
+    unsigned char* buf = new unsigned char[4];
+    write_uint32(buf, encodeB(funct3[op], offset));
+    return buf;
+  }
+
+  Form fit() const override {
+    if (compressed && (op == BEQ || op == BNE) && rhs.id() == 0 && isCompressedReg(lhs.id()) && fitsSigned(offset, 9)) {
+      return SHORT;
+    }
+    return fitsSigned(offset, 13) ? NORMAL : LONG;
+  }
+
+private:
+  uint32_t encodeB(uint32_t f3, int64_t off) const {
+    uint32_t imm = (uint32_t)off;
+    return (((imm >> 12) & 0x1) << 31) | (((imm >> 5) & 0x3F) << 25) | (rhs.id() << 20) | (lhs.id() << 15) |
+      (f3 << 12) | (((imm >> 1) & 0xF) << 8) | (((imm >> 11) & 0x1) << 7) | 0x63;
+  }
+
+  Opcode op;
+  asmcode::Register lhs;
+  asmcode::Register rhs;
+};
+
+/// Unconditional jump: c.j within +-2 KiB, `jal zero` otherwise.
+class jump : public labelref {
+public:
+  explicit jump(unsigned target) : labelref(target) {
+  }
+
+  std::string toString() const override {
+    return "j .L" + std::to_string(target);
+  }
+
+  unsigned char* encode() const override {
+    if (form == SHORT) {
+      // offset[11|4|9:8|10|6|7|3:1|5] at 12:2.
+      uint32_t imm = (uint32_t)offset;
+      return encodeHalf((0x5 << 13) | (((imm >> 11) & 0x1) << 12) | (((imm >> 4) & 0x1) << 11) |
+                        (((imm >> 8) & 0x3) << 9) | (((imm >> 10) & 0x1) << 8) | (((imm >> 6) & 0x1) << 7) |
+                        (((imm >> 7) & 0x1) << 6) | (((imm >> 1) & 0x7) << 3) | (((imm >> 5) & 0x1) << 2) | 0x1);
+    }
+    unsigned char* buf = new unsigned char[4];
+    write_uint32(buf, encodeJ(0, offset));
+    return buf;
+  }
+
+  Form fit() const override {
+    return compressed && fitsSigned(offset, 12) ? SHORT : NORMAL;
+  }
+};
+
+/// Address of a label: auipc + addi, within +-2 GiB of the code.
+class la : public labelref {
+public:
+  la(const asmcode::Register &reg, unsigned target) : labelref(target), reg(reg) {
+  }
+
+  std::string toString() const override {
+    return "la " + reg.toString() + ", .L" + std::to_string(target);
+  }
+
+  unsigned char* encode() const override {
+    int64_t hi = (offset + 0x800) >> 12;
+    int64_t lo = offset - (hi << 12);
+    unsigned char* buf = new unsigned char[8];
+    write_uint32(buf, ((uint32_t)hi << 12) | (reg.id() << 7) | 0x17);
+    write_uint32(buf + 4, (((uint32_t)lo & 0xFFF) << 20) | (reg.id() << 15) | (reg.id() << 7) | 0x13);
+    return buf;
+  }
+
+  int64_t size() const override {
+    return 8;
+  }
+
+  Form fit() const override {
+    return NORMAL;
+  }
+
+private:
+  asmcode::Register reg;
+};
+
+/// Constant 16-bit data placed in the code, such as a switch table.  Keeps
+/// the 2-byte alignment every instruction has.
+class halfwords : public Instruction {
+public:
+  explicit halfwords(std::vector<uint16_t> values) : values(std::move(values)) {
+  }
+
+  std::string toString() const override {
+    std::string result = ".half";
+    for (size_t i = 0; i < values.size(); ++i) {
+      result += (i ? ", " : " ") + std::to_string(values[i]);
+    }
+    return result;
+  }
+
+  unsigned char* encode() const override {
+    unsigned char* buf = new unsigned char[values.empty() ? 1 : 2 * values.size()];
+    for (size_t i = 0; i < values.size(); ++i) {
+      buf[2 * i] = values[i] & 0xff;
+      buf[2 * i + 1] = values[i] >> 8;
+    }
+    return buf;
+  }
+
+  int64_t size() const override {
+    return 2 * values.size();
+  }
+
+private:
+  std::vector<uint16_t> values;
+};
+
+/// Load a 64-bit constant.  Emits the shortest sequence for the value
+/// (c.li, addi, lui+addiw, or six instructions for the full 64 bits).
 class li : public Instruction {
 public:
   li(const asmcode::Register &reg, const asmcode::Immediate &imm) : reg(reg), imm(imm) {
@@ -245,22 +712,54 @@ public:
 
   unsigned char* encode() const override {
     int64_t value = imm.getValue();
+    uint32_t rd = reg.id();
+    if (fitsSigned(value, 6) && compressed && rd != 0) {
+      return encodeHalf((0x2 << 13) | (((value >> 5) & 0x1) << 12) | (rd << 7) | ((value & 0x1F) << 2) | 0x1);
+    }
+    if (fitsSigned(value, 12)) {
+      unsigned char* buf = new unsigned char[4];
+      write_uint32(buf, ((uint32_t)(value & 0xFFF) << 20) | (rd << 7) | 0x13); // addi rd, zero, value
+      return buf;
+    }
+    if (fitsSigned(value, 32)) {
+      // lui takes the upper 20 bits rounded so that the sign-extended low
+      // 12 bits of addiw land exactly on the value.
+      int64_t upper = ((value + 0x800) >> 12) & 0xFFFFF;
+      int64_t lower = value & 0xFFF;
+      unsigned char* buf = new unsigned char[8];
+      write_uint32(buf, ((uint32_t)upper << 12) | (rd << 7) | 0x37);
+      write_uint32(buf + 4, ((uint32_t)lower << 20) | (rd << 15) | (rd << 7) | 0x1B); // addiw
+      return buf;
+    }
+    unsigned char* buf = new unsigned char[6 * 4];
+    encodeInto(buf, rd, value);
+    return buf;
+  }
 
+  /// Write the fixed six-instruction sequence loading `value` into register
+  /// `reg_id` at `buf`.
+  static void encodeInto(unsigned char* buf, uint32_t reg_id, int64_t value) {
     // printf("value = 0x%llx\n", value);
 
-    int32_t hi32 = static_cast<int32_t>(value >> 32);
-    int32_t lo32 = static_cast<int32_t>(value & 0xFFFFFFFF);
-
     uint32_t instrs[6];
-    uint32_t reg_id = reg.id();
     uint32_t temp_id = 19;
-    int32_t hi_upper = hi32 >> 12;
-    int32_t hi_lower = hi32 & 0xFFF;
 
-    if (lo32 & 0x80000000) {
-      hi_lower += 1;
+    int32_t lo32 = static_cast<int32_t>(value & 0xFFFFFFFF);
+    int32_t lo_upper = lo32 >> 12;
+    int32_t lo_lower = lo32 & 0xFFF;
+
+    if (lo_lower & 0x800) {
+      lo_upper += 1;
     }
 
+    // The low pair yields a sign-extended value, possibly off by 2^32 where
+    // rounding lo_upper up wraps; the high word makes up the difference.
+    int64_t low = static_cast<int64_t>(static_cast<int32_t>(static_cast<uint32_t>(lo_upper & 0xFFFFF) << 12)) +
+                  ((lo_lower ^ 0x800) - 0x800);
+    int32_t hi32 = static_cast<int32_t>((static_cast<uint64_t>(value) - static_cast<uint64_t>(low)) >> 32);
+    int32_t hi_upper = hi32 >> 12;
+    int32_t hi_lower = hi32 & 0xFFF;
+
     if (hi_lower & 0x800) {
       hi_upper += 1;
     }
@@ -268,30 +767,23 @@ public:
     instrs[0] = ((hi_upper & 0xFFFFF) << 12) | (reg_id << 7) | 0x37;
     instrs[1] = ((hi_lower & 0xFFF) << 20) | (reg_id << 15) | (0x0 << 12) | (reg_id << 7) | 0x13;
     instrs[2] = (32 << 20) | (reg_id << 15) | (0x1 << 12) | (reg_id << 7) | 0x13;
-
-    int32_t lo_upper = lo32 >> 12;
-    int32_t lo_lower = lo32 & 0xFFF;
-
-    if (lo_lower & 0x800) {
-      lo_upper += 1;
-    }
-
     instrs[3] = ((lo_upper & 0xFFFFF) << 12) | (temp_id << 7) | 0x37;
     instrs[4] = ((lo_lower & 0xFFF) << 20) | (temp_id << 15) | (0x0 << 12) | (temp_id << 7) | 0x13;
     instrs[5] = (temp_id << 20) | (reg_id << 15) | (0x0 << 12) | (reg_id << 7) | 0x33;
 
 
     // 转为字节序列
-    unsigned char* buf = new unsigned char[6 * 4];
     for (int i = 0; i < 6; ++i) {
       write_uint32(buf + i * 4, instrs[i]);
     }
-
-    return buf;
   }
 
   int64_t size() const override {
-    return 6 * 4; // Each instruction is 4 bytes, total 6 instructions
+    int64_t value = imm.getValue();
+    if (fitsSigned(value, 6) && compressed && reg.id() != 0) {
+      return 2;
+    }
+    return fitsSigned(value, 12) ? 4 : fitsSigned(value, 32) ? 8 : 6 * 4;
   }
 
 private:
@@ -299,6 +791,38 @@ private:
   asmcode::Immediate imm;
 };
 
+/// jalr rd, imm(rs1): an indirect call (rd = ra) or jump (rd = zero).
+class jalr : public Instruction {
+public:
+  jalr(const asmcode::Register &rd, const asmcode::Register &rs1, const asmcode::Immediate &imm = asmcode::Immediate(0)) : rd(rd), rs1(rs1), imm(imm) {
+  }
+
+  std::string toString() const override {
+    return "jalr " + rd.toString() + ", " + imm.toString() + "(" + rs1.toString() + ")";
+  }
+
+  unsigned char* encode() const override {
+    if (compressedForm()) {
+      // c.jalr (rd = ra) or c.jr (rd = zero).
+      return encodeHalf((rd.id() == 1 ? 0x9002 : 0x8002) | (rs1.id() << 7));
+    }
+    return encodeWord(((imm.getValue() & 0xFFF) << 20) | (rs1.id() << 15) | (rd.id() << 7) | 0x67);
+  }
+
+  int64_t size() const override {
+    return compressedForm() ? 2 : 4;
+  }
+
+private:
+  bool compressedForm() const {
+    return compressed && imm.getValue() == 0 && rs1.id() != 0 && (rd.id() == 1 || rd.id() == 0);
+  }
+
+  asmcode::Register rd;
+  asmcode::Register rs1;
+  asmcode::Immediate imm;
+};
+
 class ret : public Instruction {
 public:
   ret() = default;
@@ -308,6 +832,9 @@ public:
   }
 
   unsigned char* encode() const override {
+    if (compressed) {
+      return encodeHalf(0x8082); // c.jr ra
+    }
     unsigned char* buf = new unsigned char[4];
     uint32_t inst = 0x00008067;
     write_uint32(buf, inst);
@@ -315,7 +842,7 @@ public:
   }
 
   int64_t size() const override {
-    return 4; // Each instruction is 4 bytes
+    return compressed ? 2 : 4;
   }
 };
 
@@ -4,6 +4,7 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <unordered_map>
 
 namespace asmcode {
 class Value {
@@ -17,7 +18,7 @@ public:
 
 class Register : public Value {
 public:
-  Register(const std::string &name) : name(name) {};
+  Register(const std::string &name) : name(name), index(lookup(name)) {};
 
   ~Register() override = default;
 
@@ -26,44 +27,68 @@ public:
   }
 
   int64_t id() const {
-    return reg_map.at(name);
+    return index;
   }
 private:
+  static int64_t lookup(const std::string &name) {
+    static const std::unordered_map<std::string, int64_t> reg_map = {
+      {"zero", 0},
+      {"ra", 1},
+      {"sp", 2},
+      {"gp", 3},
+      {"tp", 4},
+      {"t0", 5},
+      {"t1", 6},
+      {"t2", 7},
+      {"s0", 8},
+      {"s1", 9},
+      {"a0", 10},
+      {"a1", 11},
+      {"a2", 12},
+      {"a3", 13},
+      {"a4", 14},
+      {"a5", 15},
+      {"a6", 16},
+      {"a7", 17},
+      {"s2", 18},
+      {"s3", 19},
+      {"s4", 20},
+      {"s5", 21},
+      {"s6", 22},
+      {"s7", 23},
+      {"s8", 24},
+      {"s9", 25},
+      {"s10", 26},
+      {"s11", 27},
+      {"t3", 28},
+      {"t4", 29},
+      {"t5", 30},
+      {"t6", 31}
+    };
+    return reg_map.at(name);
+  }
+
   std::string name;
-  std::unordered_map<std::string, int64_t> reg_map = {
-    {"zero", 0},
-    {"ra", 1},
-    {"sp", 2},
-    {"gp", 3},
-    {"tp", 4},
-    {"t0", 5},
-    {"t1", 6},
-    {"t2", 7},
-    {"s0", 8},
-    {"s1", 9},
-    {"a0", 10},
-    {"a1", 11},
-    {"a2", 12},
-    {"a3", 13},
-    {"a4", 14},
-    {"a5", 15},
-    {"a6", 16},
-    {"a7", 17},
-    {"s2", 18},
-    {"s3", 19},
-    {"s4", 20},
-    {"s5", 21},
-    {"s6", 22},
-    {"s7", 23},
-    {"s8", 24},
-    {"s9", 25},
-    {"s10", 26},
-    {"s11", 27},
-    {"t3", 28},
-    {"t4", 29},
-    {"t5", 30},
-    {"t6", 31}
-  };
+  int64_t index;
+};
+
+/// One of the 32 registers of the vector extension, v0-v31.
+class VRegister : public Value {
+public:
+  explicit VRegister(unsigned index) : index(index) {};
+
+  ~VRegister() override = default;
+
+  std::string toString() const override {
+    return "v" + std::to_string(index);
+  }
+
+  int64_t id() const {
+    return index;
+  }
+
+private:
+  unsigned index;
 };
 
 class Immediate : public Value {
@@ -3,17 +3,43 @@
 
 #include "../util/util.hpp"
 #include "asmcmd.hpp"
+#include "asmvector.hpp"
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/DivisionByConstantInfo.h>
 
 namespace asmcode {
 
+/// Version of the code generator.  Bump whenever the emitted machine code
+/// changes so that persisted code caches are invalidated.
+constexpr uint32_t kCodegenVersion = 11;
+
+/// Machine code for a run of IR instructions.  The generated function takes
+/// a pointer to a frame of 64-bit slots in a0; every IR value the code reads
+/// or writes lives in one slot, so the code itself is position independent
+/// and can run concurrently on different frames.
 class AsmBlock {
 public:
-  AsmBlock(std::unordered_map<llvm::Value*, int64_t*> &localval_map) : val_map(localval_map) {
+  AsmBlock(std::vector<llvm::Value*> &slots) : slots(slots) {
+    for (size_t i = 0; i < slots.size(); ++i) {
+      slot_index[slots[i]] = i;
+    }
   };
 
-  ~AsmBlock() = default;
+  ~AsmBlock() {
+    clear();
+  }
+
+  AsmBlock(const AsmBlock &) = delete;
+
+  AsmBlock &operator=(const AsmBlock &) = delete;
 
   void addBinary(llvm::Instruction* I) {
+    int64_t divisor;
+    if ((I->getOpcode() == llvm::Instruction::SDiv || I->getOpcode() == llvm::Instruction::SRem) &&
+        constantOf(I->getOperand(1), divisor) && divisor != 0 && divisor != INT64_MIN) {
+      divideByConstant(I, divisor);
+      return;
+    }
     ldData(asmcode::Register("s1"), I->getOperand(0));
     ldData(asmcode::Register("s2"), I->getOperand(1));
     asmcode::binary::Opcode op;
@@ -48,32 +74,10 @@ public:
       case llvm::Instruction::SRem:
         op = asmcode::binary::MOD;
         break;
-      case llvm::Instruction::ICmp: {
-        auto* CI = llvm::cast<llvm::ICmpInst>(I);
-        switch (CI->getPredicate()) {
-          case llvm::ICmpInst::ICMP_EQ:
-            op = asmcode::binary::EQ;
-            break;
-          case llvm::ICmpInst::ICMP_NE:
-            op = asmcode::binary::NE;
-            break;
-          case llvm::ICmpInst::ICMP_SLT:
-            op = asmcode::binary::SLT;
-            break;
-          case llvm::ICmpInst::ICMP_SLE:
-            op = asmcode::binary::SLE;
-            break;
-          case llvm::ICmpInst::ICMP_SGT:
-            op = asmcode::binary::SGT;
-            break;
-          case llvm::ICmpInst::ICMP_SGE:
-            op = asmcode::binary::SGE;
-            break;
-          default:
-            throw std::runtime_error("Unsupported ICmp predicate in compile mode.");
-        }
-        break;
-      }
+      case llvm::Instruction::ICmp:
+        addCompare(llvm::cast<llvm::ICmpInst>(I)->getPredicate());
+        stData(asmcode::Register("s0"), I);
+        return;
       default:
         throw std::runtime_error("Unsupported instruction in threshold mode.");
     }
@@ -81,91 +85,453 @@ public:
     stData(asmcode::Register("s0"), I);
   }
 
-  void addLoad(llvm::Instruction* I) {
+  /// sdiv or srem by a known divisor D, neither 0 nor INT64_MIN: the
+  /// quotient is the high half of a multiply by D's magic number, rounded
+  /// toward zero (Hacker's Delight, ch. 10).
+  void divideByConstant(llvm::Instruction* I, int64_t D) {
+    Register s0("s0"), s1("s1"), s2("s2");
+    ldData(s1, I->getOperand(0));
+    if (D == 1) {
+      instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, s0, s1, Immediate(0)));
+    } else if (D == -1) {
+      instructions.push_back(new asmcode::binary(asmcode::binary::SUB, s0, Register("zero"), s1));
+    } else {
+      auto magic = llvm::SignedDivisionByConstantInfo::get(llvm::APInt(64, D, true));
+      int64_t M = magic.Magic.getSExtValue();
+      instructions.push_back(new asmcode::li(s2, Immediate(M)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::MULH, s0, s1, s2));
+      if (D > 0 && M < 0) {
+        instructions.push_back(new asmcode::binary(asmcode::binary::ADD, s0, s0, s1));
+      } else if (D < 0 && M > 0) {
+        instructions.push_back(new asmcode::binary(asmcode::binary::SUB, s0, s0, s1));
+      }
+      if (magic.ShiftAmount) {
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::SRAI, s0, s0, Immediate(magic.ShiftAmount)));
+      }
+      instructions.push_back(new asmcode::binaryi(asmcode::binaryi::SRLI, s2, s0, Immediate(63)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::ADD, s0, s0, s2));
+    }
+    if (I->getOpcode() == llvm::Instruction::SRem) {
+      instructions.push_back(new asmcode::li(s2, Immediate(D)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::MUL, s0, s0, s2));
+      instructions.push_back(new asmcode::binary(asmcode::binary::SUB, s0, s1, s0));
+    }
+    stData(s0, I);
+  }
+
+  /// s0 = (s1 pred s2) as 0 or 1.  RISC-V only has slt/sltu; the other
+  /// predicates swap operands or invert the result.
+  void addCompare(llvm::CmpInst::Predicate Pred) {
+    Register s0("s0"), s1("s1"), s2("s2");
+    switch (Pred) {
+      case llvm::ICmpInst::ICMP_EQ:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SUB, s0, s1, s2));
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::SLTIU, s0, s0, Immediate(1)));
+        break;
+      case llvm::ICmpInst::ICMP_NE:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SUB, s0, s1, s2));
+        instructions.push_back(new asmcode::binary(asmcode::binary::SLTU, s0, Register("zero"), s0));
+        break;
+      case llvm::ICmpInst::ICMP_SLT:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SLT, s0, s1, s2));
+        break;
+      case llvm::ICmpInst::ICMP_SGT:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SLT, s0, s2, s1));
+        break;
+      case llvm::ICmpInst::ICMP_SLE:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SLT, s0, s2, s1));
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::XORI, s0, s0, Immediate(1)));
+        break;
+      case llvm::ICmpInst::ICMP_SGE:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SLT, s0, s1, s2));
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::XORI, s0, s0, Immediate(1)));
+        break;
+      case llvm::ICmpInst::ICMP_ULT:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SLTU, s0, s1, s2));
+        break;
+      case llvm::ICmpInst::ICMP_UGT:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SLTU, s0, s2, s1));
+        break;
+      case llvm::ICmpInst::ICMP_ULE:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SLTU, s0, s2, s1));
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::XORI, s0, s0, Immediate(1)));
+        break;
+      case llvm::ICmpInst::ICMP_UGE:
+        instructions.push_back(new asmcode::binary(asmcode::binary::SLTU, s0, s1, s2));
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::XORI, s0, s0, Immediate(1)));
+        break;
+      default:
+        throw std::runtime_error("Unsupported ICmp predicate in compile mode.");
+    }
+  }
+
+  /// Selects compile without branches.  Min/max idioms use Zbb when it is
+  /// enabled and abs idioms always have a short form; any other select is
+  /// a blend of both operands.
+  void addSelect(llvm::Instruction* I) {
+    auto* SI = llvm::cast<llvm::SelectInst>(I);
+    Register s0("s0"), s1("s1"), s2("s2");
+    llvm::Value *A, *B;
+    asmcode::binary::Opcode op;
+    if (auto* C = llvm::dyn_cast<llvm::ConstantInt>(SI->getCondition())) {
+      ldData(s0, C->isZero() ? SI->getFalseValue() : SI->getTrueValue());
+    } else if (zbb && matchMinMax(SI, A, B, op)) {
+      ldData(s1, A);
+      ldData(s2, B);
+      instructions.push_back(new asmcode::binary(op, s0, s1, s2));
+    } else if (matchAbs(SI, A)) {
+      addAbs(A);
+    } else {
+      ldData(s0, SI->getCondition());
+      if (!llvm::isa<llvm::ICmpInst>(SI->getCondition())) {
+        // Other i1 values may hold -1 for true.
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ANDI, s0, s0, Immediate(1)));
+      }
+      ldData(s1, SI->getTrueValue());
+      ldData(s2, SI->getFalseValue());
+      blend();
+    }
+    stData(s0, I);
+  }
+
+  /// The llvm.smin/smax/umin/umax and llvm.abs intrinsics.
+  static bool isMinMax(const llvm::Instruction* I) {
+    auto* II = llvm::dyn_cast<llvm::IntrinsicInst>(I);
+    if (!II) {
+      return false;
+    }
+    switch (II->getIntrinsicID()) {
+      case llvm::Intrinsic::smin:
+      case llvm::Intrinsic::smax:
+      case llvm::Intrinsic::umin:
+      case llvm::Intrinsic::umax:
+      case llvm::Intrinsic::abs:
+        return true;
+      default:
+        return false;
+    }
+  }
+
+  /// An intrinsic isMinMax() accepts: a Zbb instruction, or a compare and
+  /// a blend.
+  void addMinMax(llvm::Instruction* I) {
+    auto* II = llvm::cast<llvm::IntrinsicInst>(I);
+    Register s0("s0"), s1("s1"), s2("s2");
+    if (II->getIntrinsicID() == llvm::Intrinsic::abs) {
+      addAbs(II->getArgOperand(0));
+      stData(s0, I);
+      return;
+    }
+    asmcode::binary::Opcode op;
+    llvm::CmpInst::Predicate pred;
+    switch (II->getIntrinsicID()) {
+      case llvm::Intrinsic::smin: op = asmcode::binary::MIN; pred = llvm::CmpInst::ICMP_SLT; break;
+      case llvm::Intrinsic::smax: op = asmcode::binary::MAX; pred = llvm::CmpInst::ICMP_SGT; break;
+      case llvm::Intrinsic::umin: op = asmcode::binary::MINU; pred = llvm::CmpInst::ICMP_ULT; break;
+      default: op = asmcode::binary::MAXU; pred = llvm::CmpInst::ICMP_UGT; break;
+    }
+    ldData(s1, II->getArgOperand(0));
+    ldData(s2, II->getArgOperand(1));
+    if (zbb) {
+      instructions.push_back(new asmcode::binary(op, s0, s1, s2));
+    } else {
+      addCompare(pred);
+      blend();
+    }
+    stData(s0, I);
+  }
+
+  /// Memory is accessed at the value's store size; loads sign-extend it.
+  void addLoad(llvm::Instruction* I, const llvm::DataLayout &data_layout) {
     llvm::Value* V = llvm::cast<llvm::LoadInst>(I)->getPointerOperand();
+    unsigned width = accessWidth(I->getType(), data_layout);
+    if (const Cell* cell = cellOf(V)) {
+      stData(cell->reg, I);
+      return;
+    }
     ldData(asmcode::Register("s0"), V);
-    instructions.push_back(new asmcode::ld(asmcode::Register("s0"), asmcode::Register("s0")));
+    instructions.push_back(new asmcode::ld(asmcode::Register("s0"), asmcode::Register("s0"), Immediate(0), width));
     stData(asmcode::Register("s0"), I);
   }
 
-  void addStore(llvm::Instruction* I) {
+  void addStore(llvm::Instruction* I, const llvm::DataLayout &data_layout) {
     llvm::Value* V = llvm::cast<llvm::StoreInst>(I)->getValueOperand();
     llvm::Value* Ptr = llvm::cast<llvm::StoreInst>(I)->getPointerOperand();
+    unsigned width = accessWidth(V->getType(), data_layout);
+    if (const Cell* cell = cellOf(Ptr)) {
+      // Kept as a load of the memory would return it.
+      ldData(cell->reg, V);
+      if (width < 8) {
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::SLLI, cell->reg, cell->reg, Immediate(64 - 8 * width)));
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::SRAI, cell->reg, cell->reg, Immediate(64 - 8 * width)));
+      }
+      return;
+    }
     ldData(asmcode::Register("s0"), V);
     ldData(asmcode::Register("s1"), Ptr);
-    instructions.push_back(new asmcode::st(asmcode::Register("s0"), asmcode::Register("s1")));
+    instructions.push_back(new asmcode::st(asmcode::Register("s0"), asmcode::Register("s1"), Immediate(0), width));
+  }
+
+  /// Pointer casts keep the address: the value moves to the cast's slot.
+  void addBitCast(llvm::Instruction* I) {
+    ldData(asmcode::Register("s0"), I->getOperand(0));
+    stData(asmcode::Register("s0"), I);
   }
 
+  /// Constant indices, and indices a guard has pinned, fold into a single
+  /// offset added last.
   void addGetElementPtr(llvm::Instruction* I, const llvm::DataLayout &data_layout) {
     auto* GEP = llvm::cast<llvm::GetElementPtrInst>(I);
-    llvm::Value* Ptr = GEP->getPointerOperand();
-    ldData(asmcode::Register("s0"), Ptr);
+    Register s0("s0"), s1("s1"), s2("s2");
+    ldData(s0, GEP->getPointerOperand());
     llvm::Type* curTy = GEP->getSourceElementType();
     int64_t offset = 0;
+    auto addIndex = [&](llvm::Value* Idx, int64_t Size) {
+      int64_t value;
+      if (constantOf(Idx, value)) {
+        offset += value * Size;
+        return;
+      }
+      ldData(s1, Idx);
+      instructions.push_back(new asmcode::li(s2, Immediate(Size)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::MUL, s1, s1, s2));
+      instructions.push_back(new asmcode::binary(asmcode::binary::ADD, s0, s0, s1));
+    };
     auto idxIt = GEP->idx_begin();
-    int64_t idxVal = llvm::cast<llvm::ConstantInt>(*idxIt)->getValue().getSExtValue();
-    if (idxVal != 0) {
-      ldData(asmcode::Register("s1"), *idxIt);
-      instructions.push_back(new asmcode::li(asmcode::Register("s2"), Immediate(data_layout.getTypeAllocSize(curTy))));
-      instructions.push_back(new asmcode::binary(asmcode::binary::MUL, asmcode::Register("s1"), asmcode::Register("s1"), asmcode::Register("s2")));
-      instructions.push_back(new asmcode::binary(asmcode::binary::ADD, asmcode::Register("s0"), asmcode::Register("s0"), asmcode::Register("s1")));
-    }
+    addIndex(*idxIt, data_layout.getTypeAllocSize(curTy));
     for (++idxIt; idxIt != GEP->idx_end(); ++idxIt) {
       if (curTy->isStructTy()) {
         if (!llvm::isa<llvm::Constant>(*idxIt)) {
           throw std::runtime_error("GEP with non-constant index is not supported in compile mode.");
         }
-        idxVal = llvm::cast<llvm::ConstantInt>(*idxIt)->getValue().getSExtValue();
-
+        unsigned fieldNo = static_cast<unsigned>(llvm::cast<llvm::ConstantInt>(*idxIt)->getZExtValue());
         auto* STy = llvm::cast<llvm::StructType>(curTy);
-        const auto* SL = data_layout.getStructLayout(STy);
-        unsigned fieldNo = static_cast<unsigned>(idxVal);
-        
+        offset += data_layout.getStructLayout(STy)->getElementOffset(fieldNo);
         curTy = STy->getElementType(fieldNo);
-
-        instructions.push_back(new asmcode::li(asmcode::Register("s1"), Immediate(SL->getElementOffset(fieldNo))));
-        instructions.push_back(new asmcode::binary(asmcode::binary::ADD, asmcode::Register("s0"), asmcode::Register("s0"), asmcode::Register("s1")));
       } else if (curTy->isArrayTy()) {
-        ldData(asmcode::Register("s1"), *idxIt);
-
-        const auto* ATy = llvm::cast<llvm::ArrayType>(curTy);
-        llvm::Type* EltT = ATy->getElementType();
-        uint64_t eltSize = data_layout.getTypeAllocSize(EltT);
-        
+        llvm::Type* EltT = llvm::cast<llvm::ArrayType>(curTy)->getElementType();
         curTy = EltT;
-        instructions.push_back(new asmcode::li(asmcode::Register("s2"), Immediate(eltSize)));
-        instructions.push_back(new asmcode::binary(asmcode::binary::MUL, asmcode::Register("s1"), asmcode::Register("s1"), asmcode::Register("s2")));
-        instructions.push_back(new asmcode::binary(asmcode::binary::ADD, asmcode::Register("s0"), asmcode::Register("s0"), asmcode::Register("s1")));
+        addIndex(*idxIt, data_layout.getTypeAllocSize(EltT));
       }
     }
-    stData(asmcode::Register("s0"), I);
+    if (offset >= -2048 && offset < 2048) {
+      if (offset) {
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, s0, s0, Immediate(offset)));
+      }
+    } else {
+      instructions.push_back(new asmcode::li(s1, Immediate(offset)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::ADD, s0, s0, s1));
+    }
+    stData(s0, I);
+  }
+
+  /// A call to a C library function HostFunctions allows, whose address is
+  /// in the slot of the callee, made as callMemRoutine() makes its call.
+  /// Arguments go in a0-a7; the result comes back in a0.
+  void addHostCall(llvm::CallInst* CI) {
+    static const char* const kArgRegisters[] = {"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7"};
+    if (CI->arg_size() > 8) {
+      throw std::runtime_error("Too many arguments to a host function.");
+    }
+    Register sp("sp"), ra("ra"), a0("a0"), s0("s0");
+    instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, sp, sp, Immediate(-16)));
+    instructions.push_back(new asmcode::st(ra, sp, Immediate(8)));
+    instructions.push_back(new asmcode::st(a0, sp, Immediate(0)));
+    ldData(Register("t0"), CI->getCalledOperand());
+    for (unsigned i = CI->arg_size(); i-- > 1;) {
+      ldData(Register(kArgRegisters[i]), CI->getArgOperand(i));
+    }
+    if (CI->arg_size() > 0) {
+      ldData(a0, CI->getArgOperand(0)); // Last: the loads above address the frame through a0
+    }
+    instructions.push_back(new asmcode::jalr(ra, Register("t0")));
+    instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, s0, a0, Immediate(0)));
+    instructions.push_back(new asmcode::ld(a0, sp, Immediate(0)));
+    instructions.push_back(new asmcode::ld(ra, sp, Immediate(8)));
+    instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, sp, sp, Immediate(16)));
+    llvm::Type* T = CI->getType();
+    if (T->isVoidTy()) {
+      return;
+    }
+    // The ABI extends 32-bit results to 64 bits but leaves the upper bits of
+    // narrower ones to the callee.
+    if (T->isIntegerTy(1)) {
+      instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ANDI, s0, s0, Immediate(1)));
+    } else if (T->isIntegerTy() && T->getIntegerBitWidth() < 32) {
+      unsigned shift = 64 - T->getIntegerBitWidth();
+      instructions.push_back(new asmcode::binaryi(asmcode::binaryi::SLLI, s0, s0, Immediate(shift)));
+      instructions.push_back(new asmcode::binaryi(asmcode::binaryi::SRAI, s0, s0, Immediate(shift)));
+    }
+    stData(s0, CI);
+  }
+
+  /// llvm.memcpy, llvm.memmove and llvm.memset.  A constant size that takes
+  /// at most kInlineMemAccesses loads or stores is expanded inline; any other
+  /// size runs a strip-mined vector loop when vectors are enabled (memmove
+  /// excepted), or calls the C library routine held in the callee's slot.
+  void addMemIntrinsic(llvm::Instruction* I) {
+    auto* MI = llvm::cast<llvm::MemIntrinsic>(I);
+    auto* MT = llvm::dyn_cast<llvm::MemTransferInst>(MI);
+    if (auto* Len = llvm::dyn_cast<llvm::ConstantInt>(MI->getLength())) {
+      uint64_t align = MI->getDestAlign() ? MI->getDestAlign()->value() : 1;
+      if (MT) {
+        align = std::min<uint64_t>(align, MT->getSourceAlign() ? MT->getSourceAlign()->value() : 1);
+      }
+      std::vector<std::pair<int64_t, unsigned>> chunks;
+      if (memChunks(Len->getZExtValue(), align, chunks)) {
+        if (MT) {
+          inlineCopy(MT, chunks);
+        } else {
+          inlineSet(llvm::cast<llvm::MemSetInst>(MI), chunks);
+        }
+        return;
+      }
+    }
+    if (vector && !llvm::isa<llvm::MemMoveInst>(MI)) {
+      vectorMemLoop(MI);
+    } else {
+      callMemRoutine(MI);
+    }
   }
 
   void addPhi(llvm::Instruction* I) {
   }
 
-  void addCall(llvm::Instruction* I) {
-    int64_t* val;
-    llvm::Value* V = I;
-    if (val_map.find(V) == val_map.end()) {
-      val = new int64_t;
-      val_map[V] = val;
+  /// Phis of a block may take their values along one edge inside the code.
+  static constexpr unsigned kMaxEdgeCopies = 14;
+
+  /// Superblocks: control goes on from BI's block into Next, the k-th
+  /// edge added.  A conditional branch that goes the other way leaves with
+  /// -(k + 1) in the exit word; see exitWord().  Next's phis are then set
+  /// from the edge, all incoming values read before any is written.
+  void addTraceEdge(llvm::BranchInst* BI, llvm::BasicBlock* Next) {
+    int64_t edge = trace_edges++;
+    if (BI->isConditional()) {
+      ldData(Register("s0"), BI->getCondition());
+      auto op = BI->getSuccessor(0) == Next ? asmcode::branch::BEQ : asmcode::branch::BNE;
+      instructions.push_back(new asmcode::branch(op, Register("s0"), Register("zero"), exitStub(-(edge + 1))));
     }
-    for (llvm::Use& U : I->operands()) {
-      llvm::Value* Op = U.get();
-      if (val_map.find(Op) == val_map.end()) {
-        val = new int64_t;
-        val_map[Op] = val;
-      }
+    copyPhis(BI->getParent(), Next);
+  }
+
+  /// Next's phis = their incoming values from From, all read before any is
+  /// written.
+  void copyPhis(llvm::BasicBlock* From, llvm::BasicBlock* Next) {
+    static const char* const temps[kMaxEdgeCopies] = {"t0", "t1", "t2", "t3", "t4", "t5", "t6",
+                                                     "a1", "a2", "a3", "a4", "a5", "a6", "a7"};
+    std::vector<llvm::PHINode*> phis;
+    for (llvm::PHINode &PN : Next->phis()) {
+      phis.push_back(&PN);
+    }
+    if (phis.size() > kMaxEdgeCopies) {
+      throw std::runtime_error("Too many phis on a superblock edge.");
+    }
+    for (size_t i = 0; i < phis.size(); ++i) {
+      ldData(Register(temps[i]), phis[i]->getIncomingValueForBlock(From));
+    }
+    for (size_t i = 0; i < phis.size(); ++i) {
+      stData(Register(temps[i]), phis[i]);
     }
   }
 
+  /// The return, followed by the data the code reads (switch tables).
   void addRet() {
     instructions.push_back(new asmcode::ret());
+    instructions.insert(instructions.end(), trailer.begin(), trailer.end());
+    trailer.clear();
+  }
+
+  /// A switch leaves the index of the successor taken in its slot: 0 for
+  /// the default destination, i + 1 for case i.  Dense cases are a bounds
+  /// check and a load from a table of indices placed after the code.
+  void addSwitchTable(llvm::SwitchInst* SI, int64_t Low, const std::vector<unsigned> &Table) {
+    Register value("s1"), scratch("s2"), index("s0");
+    std::vector<uint16_t> entries;
+    for (unsigned successor : Table) {
+      if (successor > INT16_MAX) {
+        throw std::runtime_error("Switch with too many successors in compile mode.");
+      }
+      entries.push_back(successor);
+    }
+    unsigned done = newLabel(), table = newLabel();
+    ldData(value, SI->getCondition());
+    if (Low != 0) {
+      instructions.push_back(new asmcode::li(scratch, Immediate(Low)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::SUB, value, value, scratch));
+    }
+    instructions.push_back(new asmcode::li(scratch, Immediate(Table.size())));
+    instructions.push_back(new asmcode::li(index, Immediate(0)));
+    instructions.push_back(new asmcode::branch(asmcode::branch::BGEU, value, scratch, done));
+    instructions.push_back(new asmcode::la(scratch, table));
+    instructions.push_back(new asmcode::binary(asmcode::binary::ADD, value, value, value));
+    instructions.push_back(new asmcode::binary(asmcode::binary::ADD, scratch, scratch, value));
+    instructions.push_back(new asmcode::ld(index, scratch, Immediate(0), 2));
+    instructions.push_back(new asmcode::label(done));
+    stData(index, SI);
+    trailer.push_back(new asmcode::label(table));
+    trailer.push_back(new asmcode::halfwords(std::move(entries)));
+  }
+
+  /// Sparse cases, sorted by value, are a balanced tree of compares.
+  void addSwitchTree(llvm::SwitchInst* SI, const std::vector<std::pair<int64_t, unsigned>> &Cases) {
+    unsigned fallback = newLabel(), done = newLabel();
+    ldData(Register("s1"), SI->getCondition());
+    compareTree(Cases, 0, Cases.size(), fallback, done, true);
+    instructions.push_back(new asmcode::label(fallback));
+    instructions.push_back(new asmcode::li(Register("s0"), Immediate(0)));
+    instructions.push_back(new asmcode::label(done));
+    stData(Register("s0"), SI);
+  }
+
+  /// Use the Zbb min/max instructions.
+  void setZbb(bool Enable) {
+    zbb = Enable;
+  }
+
+  /// Use the Zicond conditional zeroing instructions.
+  void setZicond(bool Enable) {
+    zicond = Enable;
+  }
+
+  /// Use the vector extension for bulk memory operations.
+  void setVector(bool Enable) {
+    vector = Enable;
+  }
+
+  /// Use the compressed instructions of the C extension where they fit.
+  void setCompressed(bool Enable) {
+    compress = Enable;
+  }
+
+  /// Append a machine instruction; the block takes ownership.
+  void append(const Instruction* Inst) {
+    instructions.push_back(Inst);
+  }
+
+  /// A label id not used elsewhere in this block.
+  unsigned newLabel() {
+    return next_label++;
+  }
+
+  /// A label that leaves the code with Code in the exit word.
+  unsigned exitStub(int64_t Code) {
+    exit_stubs.emplace_back(newLabel(), Code);
+    return exit_stubs.back().first;
+  }
+
+  /// R = the value of V, from its frame slot or as a constant.
+  void loadSlot(Register R, llvm::Value* V) {
+    ldData(R, V);
+  }
+
+  /// The frame slot of V = R.
+  void storeSlot(Register R, llvm::Value* V) {
+    stData(R, V);
   }
 
   void removeInstruction(size_t index) {
     if (index < instructions.size()) {
+      delete instructions[index];
       instructions.erase(instructions.begin() + index);
     }
   }
@@ -179,7 +545,14 @@ public:
   }
 
   void clear() {
+    for (const Instruction* inst : instructions) {
+      delete inst;
+    }
     instructions.clear();
+    for (const Instruction* inst : trailer) {
+      delete inst;
+    }
+    trailer.clear();
   }
 
   const std::vector<const Instruction*>& getInstructions() const {
@@ -191,6 +564,7 @@ public:
   }
 
   void encode(unsigned char** encode, size_t* size, size_t* count) const {
+    layout();
     size_t total_size = 0;
     *count = instructions.size();
     for (const auto& inst : instructions) {
@@ -202,61 +576,569 @@ public:
       int size = instructions[i]->size();
       unsigned char* encoded_inst = instructions[i]->encode();
       std::memcpy(*encode + offset, encoded_inst, size);
+      delete[] encoded_inst;
       offset += size;
     }
     *size = total_size;
   }
 
-  void regSave() {
-    instructions.push_back(new asmcode::st(asmcode::Register("s0"), asmcode::Register("sp"), Immediate(-8)));
-    instructions.push_back(new asmcode::st(asmcode::Register("s1"), asmcode::Register("sp"), Immediate(-16)));
-    instructions.push_back(new asmcode::st(asmcode::Register("s2"), asmcode::Register("sp"), Immediate(-24)));
-    instructions.push_back(new asmcode::st(asmcode::Register("s3"), asmcode::Register("sp"), Immediate(-32)));
-    instructions.push_back(new asmcode::st(asmcode::Register("s4"), asmcode::Register("sp"), Immediate(-40)));
+  /// Spill the callee-saved registers the block uses: s0-s4, and the first
+  /// Extra of extraRegister() on top.  The spill area is allocated by moving
+  /// sp first: signal handlers (the sampler's SIGPROF included) push their
+  /// frames right below sp.
+  void regSave(unsigned Extra = 0) {
+    if (Extra > kExtraRegisters) {
+      throw std::runtime_error("Too many registers to spill.");
+    }
+    extra_saved = Extra;
+    spill_bytes = ((5 + Extra) * 8 + 15) & ~15;
+    instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, asmcode::Register("sp"), asmcode::Register("sp"), Immediate(-spill_bytes)));
+    instructions.push_back(new asmcode::st(asmcode::Register("s0"), asmcode::Register("sp"), Immediate(32)));
+    instructions.push_back(new asmcode::st(asmcode::Register("s1"), asmcode::Register("sp"), Immediate(24)));
+    instructions.push_back(new asmcode::st(asmcode::Register("s2"), asmcode::Register("sp"), Immediate(16)));
+    instructions.push_back(new asmcode::st(asmcode::Register("s3"), asmcode::Register("sp"), Immediate(8)));
+    instructions.push_back(new asmcode::st(asmcode::Register("s4"), asmcode::Register("sp"), Immediate(0)));
+    for (unsigned i = 0; i < Extra; ++i) {
+      instructions.push_back(new asmcode::st(extraRegister(i), asmcode::Register("sp"), Immediate(40 + 8 * i)));
+    }
+  }
+
+  /// s5-s11, which code only uses once regSave() was told to spill them.
+  static constexpr unsigned kExtraRegisters = 7;
+
+  static Register extraRegister(unsigned i) {
+    static const char* const names[kExtraRegisters] = {"s5", "s6", "s7", "s8", "s9", "s10", "s11"};
+    return Register(names[i]);
+  }
+
+  /// V lives in R from here on instead of its slot, which the epilogue
+  /// brings up to date.  R takes V's current value from the slot if Load.
+  void assignRegister(llvm::Value* V, Register R, bool Load) {
+    if (Load) {
+      ldData(R, V);
+    } else {
+      slotOf(V);
+    }
+    homes.emplace_back(V, R);
+  }
+
+  /// Scalar replacement: the Width bytes at Offset from Base, memory that
+  /// only loads and stores through Pointers reach, live in R while the code
+  /// runs.  R is loaded here and, if the code Stores to it, written back
+  /// whenever the code leaves.
+  void assignCell(llvm::Value* Base, int64_t Offset, unsigned Width, const std::vector<llvm::Value*> &Pointers, Register R,
+                  bool Stores) {
+    ldData(Register("s0"), Base);
+    instructions.push_back(new asmcode::ld(R, Register("s0"), Immediate(Offset), Width));
+    cells.push_back({Base, Offset, Width, Pointers, R, Stores});
+  }
+
+  /// Native loops: the code from addLoopHead() on runs again each time
+  /// addLoopEdge() finds the branch going back, counting the laps in s5,
+  /// which must be spilled.  The count ends up in the word after the exit
+  /// word.  beginLoop() comes before any guard.
+  void beginLoop() {
+    looping = true;
+    instructions.push_back(new asmcode::li(extraRegister(0), Immediate(0)));
+  }
+
+  void addLoopHead() {
+    loop_head = newLabel();
+    instructions.push_back(new asmcode::label(loop_head));
+  }
+
+  /// BI's block ends the loop: it goes back to Head after Head's phis are
+  /// set from the edge and each (value, delta) in Steps is advanced, or
+  /// else falls through to the rest of the code.
+  void addLoopEdge(llvm::BranchInst* BI, llvm::BasicBlock* Head, const std::vector<std::pair<llvm::Value*, int64_t>> &Steps) {
+    unsigned done = 0;
+    if (BI->isConditional()) {
+      done = newLabel();
+      ldData(Register("s0"), BI->getCondition());
+      auto op = BI->getSuccessor(0) == Head ? asmcode::branch::BEQ : asmcode::branch::BNE;
+      instructions.push_back(new asmcode::branch(op, Register("s0"), Register("zero"), done));
+    }
+    copyPhis(BI->getParent(), Head);
+    for (auto &step : Steps) {
+      addToValue(step.first, step.second);
+    }
+    instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, extraRegister(0), extraRegister(0), Immediate(1)));
+    instructions.push_back(new asmcode::jump(loop_head));
+    if (BI->isConditional()) {
+      instructions.push_back(new asmcode::label(done));
+    }
+  }
+
+  /// V is taken to hold Value from here on.  The code checks that it does
+  /// first, and otherwise leaves with k + 1 in the exit word, for the k-th
+  /// guard added.
+  void addGuard(llvm::Value* V, int64_t Value) {
+    ldData(Register("s0"), V);
+    instructions.push_back(new asmcode::li(Register("s1"), Immediate(Value)));
+    instructions.push_back(new asmcode::branch(asmcode::branch::BNE, Register("s0"), Register("s1"), exitStub(++guards)));
+    known[V] = Value;
   }
 
+  /// Whether V is a constant, or pinned by a guard since it was last set.
+  bool constantOf(llvm::Value* V, int64_t &Out) const {
+    if (auto* CI = llvm::dyn_cast<llvm::ConstantInt>(V)) {
+      Out = CI->getValue().getSExtValue();
+      return true;
+    }
+    auto it = known.find(V);
+    if (it == known.end()) {
+      return false;
+    }
+    Out = it->second;
+    return true;
+  }
+
+  /// Frame word after the slots, where code that leaves early says why:
+  /// -(k + 1) for the side exit of trace edge k, k + 1 for guard k failing.
+  /// It is left alone when the code runs to the end, so the caller zeroes
+  /// it first.  Only valid once every slot is allocated.
+  size_t exitWord() const {
+    return slots.size();
+  }
+
+  /// Restore them; side exits of a superblock and failed guards land here,
+  /// after setting the exit word.
   void regLoad() {
-    instructions.push_back(new asmcode::ld(asmcode::Register("s4"), asmcode::Register("sp"), Immediate(-40)));
-    instructions.push_back(new asmcode::ld(asmcode::Register("s3"), asmcode::Register("sp"), Immediate(-32)));
-    instructions.push_back(new asmcode::ld(asmcode::Register("s2"), asmcode::Register("sp"), Immediate(-24)));
-    instructions.push_back(new asmcode::ld(asmcode::Register("s1"), asmcode::Register("sp"), Immediate(-16)));
-    instructions.push_back(new asmcode::ld(asmcode::Register("s0"), asmcode::Register("sp"), Immediate(-8)));
+    if (!exit_stubs.empty()) {
+      unsigned epilogue = newLabel();
+      instructions.push_back(new asmcode::jump(epilogue));
+      for (size_t i = 0; i < exit_stubs.size(); ++i) {
+        instructions.push_back(new asmcode::label(exit_stubs[i].first));
+        instructions.push_back(new asmcode::li(Register("s0"), Immediate(exit_stubs[i].second)));
+        stFrame(Register("s0"), exitWord() * 8);
+        if (i + 1 < exit_stubs.size()) {
+          instructions.push_back(new asmcode::jump(epilogue));
+        }
+      }
+      instructions.push_back(new asmcode::label(epilogue));
+    }
+    for (auto &home : homes) {
+      stFrame(home.second, slotOf(home.first) * 8);
+    }
+    for (auto &cell : cells) {
+      if (cell.stores) {
+        ldData(Register("s0"), cell.base);
+        instructions.push_back(new asmcode::st(cell.reg, Register("s0"), Immediate(cell.offset), cell.width));
+      }
+    }
+    if (looping) {
+      stFrame(extraRegister(0), (exitWord() + 1) * 8);
+    }
+    for (unsigned i = 0; i < extra_saved; ++i) {
+      instructions.push_back(new asmcode::ld(extraRegister(i), asmcode::Register("sp"), Immediate(40 + 8 * i)));
+    }
+    instructions.push_back(new asmcode::ld(asmcode::Register("s4"), asmcode::Register("sp"), Immediate(0)));
+    instructions.push_back(new asmcode::ld(asmcode::Register("s3"), asmcode::Register("sp"), Immediate(8)));
+    instructions.push_back(new asmcode::ld(asmcode::Register("s2"), asmcode::Register("sp"), Immediate(16)));
+    instructions.push_back(new asmcode::ld(asmcode::Register("s1"), asmcode::Register("sp"), Immediate(24)));
+    instructions.push_back(new asmcode::ld(asmcode::Register("s0"), asmcode::Register("sp"), Immediate(32)));
+    instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, asmcode::Register("sp"), asmcode::Register("sp"), Immediate(spill_bytes)));
+  }
+
+  /// Frame slot of V, allocated on first use.
+  size_t slotOf(llvm::Value* V) {
+    auto it = slot_index.find(V);
+    if (it != slot_index.end()) {
+      return it->second;
+    }
+    slot_index[V] = slots.size();
+    slots.push_back(V);
+    return slots.size() - 1;
   }
-  
-public:
-  std::unordered_map<llvm::Value*, int64_t*> &val_map;
 
 private:
+  /// Fix the size of every instruction and the offset of every label
+  /// reference.  References start in their 4-byte form; those out of range
+  /// grow until nothing changes, then those that now fit are compressed.
+  /// Compressing only brings labels closer, so no reference ever needs to
+  /// grow again.
+  void layout() const {
+    std::vector<const labelref*> refs;
+    for (const Instruction* inst : instructions) {
+      inst->setCompressed(compress);
+      if (auto* R = dynamic_cast<const labelref*>(inst)) {
+        R->setForm(labelref::NORMAL);
+        refs.push_back(R);
+      }
+    }
+    if (refs.empty()) {
+      return;
+    }
+    auto place = [&] {
+      std::unordered_map<unsigned, int64_t> labels;
+      std::unordered_map<const Instruction*, int64_t> positions;
+      int64_t offset = 0;
+      for (const Instruction* inst : instructions) {
+        if (auto* L = dynamic_cast<const asmcode::label*>(inst)) {
+          labels[L->getId()] = offset;
+        }
+        positions[inst] = offset;
+        offset += inst->size();
+      }
+      for (const labelref* R : refs) {
+        R->setOffset(labels.at(R->getTarget()) - positions[R]);
+      }
+    };
+    for (bool changed = true; changed;) {
+      place();
+      changed = false;
+      for (const labelref* R : refs) {
+        if (R->fit() == labelref::LONG && R->getForm() != labelref::LONG) {
+          R->setForm(labelref::LONG);
+          changed = true;
+        }
+      }
+    }
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (const labelref* R : refs) {
+        if (R->getForm() == labelref::NORMAL && R->fit() == labelref::SHORT) {
+          R->setForm(labelref::SHORT);
+          changed = true;
+        }
+      }
+      place();
+    }
+  }
+
+  static constexpr size_t kInlineMemAccesses = 8;
+  static constexpr size_t kLinearCases = 3;
+
+  /// s0 = s0 ? s1 : s2 for s0 of 0 or 1, without branching: a czero pair
+  /// with Zicond, else s2 ^ ((s1 ^ s2) & -s0).  Clobbers s1 and s2.
+  void blend() {
+    Register s0("s0"), s1("s1"), s2("s2");
+    if (zicond) {
+      instructions.push_back(new asmcode::binary(asmcode::binary::CZERO_EQZ, s1, s1, s0));
+      instructions.push_back(new asmcode::binary(asmcode::binary::CZERO_NEZ, s2, s2, s0));
+      instructions.push_back(new asmcode::binary(asmcode::binary::OR, s0, s1, s2));
+    } else {
+      instructions.push_back(new asmcode::binary(asmcode::binary::SUB, s0, Register("zero"), s0));
+      instructions.push_back(new asmcode::binary(asmcode::binary::XOR, s1, s1, s2));
+      instructions.push_back(new asmcode::binary(asmcode::binary::AND, s1, s1, s0));
+      instructions.push_back(new asmcode::binary(asmcode::binary::XOR, s0, s2, s1));
+    }
+  }
+
+  /// s0 = |X|: max(x, -x) with Zbb, else (x ^ m) - m for the sign mask m.
+  void addAbs(llvm::Value* X) {
+    Register s0("s0"), s1("s1"), s2("s2");
+    ldData(s1, X);
+    if (zbb) {
+      instructions.push_back(new asmcode::binary(asmcode::binary::SUB, s2, Register("zero"), s1));
+      instructions.push_back(new asmcode::binary(asmcode::binary::MAX, s0, s1, s2));
+    } else {
+      instructions.push_back(new asmcode::binaryi(asmcode::binaryi::SRAI, s2, s1, Immediate(63)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::XOR, s1, s1, s2));
+      instructions.push_back(new asmcode::binary(asmcode::binary::SUB, s0, s1, s2));
+    }
+  }
+
+  /// select (a pred b), a, b with an ordering predicate, either way round.
+  static bool matchMinMax(llvm::SelectInst* SI, llvm::Value* &A, llvm::Value* &B, asmcode::binary::Opcode &Op) {
+    auto* Cmp = llvm::dyn_cast<llvm::ICmpInst>(SI->getCondition());
+    if (!Cmp) {
+      return false;
+    }
+    A = Cmp->getOperand(0);
+    B = Cmp->getOperand(1);
+    llvm::CmpInst::Predicate pred = Cmp->getPredicate();
+    if (SI->getTrueValue() == B && SI->getFalseValue() == A) {
+      std::swap(A, B);
+      pred = llvm::CmpInst::getSwappedPredicate(pred);
+    }
+    if (SI->getTrueValue() != A || SI->getFalseValue() != B) {
+      return false;
+    }
+    switch (pred) {
+      case llvm::CmpInst::ICMP_SLT: case llvm::CmpInst::ICMP_SLE: Op = asmcode::binary::MIN; return true;
+      case llvm::CmpInst::ICMP_SGT: case llvm::CmpInst::ICMP_SGE: Op = asmcode::binary::MAX; return true;
+      case llvm::CmpInst::ICMP_ULT: case llvm::CmpInst::ICMP_ULE: Op = asmcode::binary::MINU; return true;
+      case llvm::CmpInst::ICMP_UGT: case llvm::CmpInst::ICMP_UGE: Op = asmcode::binary::MAXU; return true;
+      default: return false;
+    }
+  }
+
+  /// select (x < 0), 0 - x, x and select (x > -1), x, 0 - x, also with
+  /// x <= -1 and x >= 0 as the conditions.
+  static bool matchAbs(llvm::SelectInst* SI, llvm::Value* &X) {
+    auto* Cmp = llvm::dyn_cast<llvm::ICmpInst>(SI->getCondition());
+    auto* C = Cmp ? llvm::dyn_cast<llvm::ConstantInt>(Cmp->getOperand(1)) : nullptr;
+    if (!C) {
+      return false;
+    }
+    X = Cmp->getOperand(0);
+    bool negative;
+    llvm::CmpInst::Predicate pred = Cmp->getPredicate();
+    if ((pred == llvm::CmpInst::ICMP_SLT && C->isZero()) || (pred == llvm::CmpInst::ICMP_SLE && C->isMinusOne())) {
+      negative = true;
+    } else if ((pred == llvm::CmpInst::ICMP_SGT && C->isMinusOne()) || (pred == llvm::CmpInst::ICMP_SGE && C->isZero())) {
+      negative = false;
+    } else {
+      return false;
+    }
+    llvm::Value* Neg = negative ? SI->getTrueValue() : SI->getFalseValue();
+    llvm::Value* Pos = negative ? SI->getFalseValue() : SI->getTrueValue();
+    auto* Sub = llvm::dyn_cast<llvm::BinaryOperator>(Neg);
+    return Pos == X && Sub && Sub->getOpcode() == llvm::Instruction::Sub && Sub->getOperand(1) == X &&
+      llvm::isa<llvm::ConstantInt>(Sub->getOperand(0)) && llvm::cast<llvm::ConstantInt>(Sub->getOperand(0))->isZero();
+  }
+
+  /// Find s1 among Cases[Lo, Hi): s0 = its successor index and jump to
+  /// Done, or go to Default.  The last subtree emitted falls through to it.
+  void compareTree(const std::vector<std::pair<int64_t, unsigned>> &Cases, size_t Lo, size_t Hi, unsigned Default, unsigned Done, bool Last) {
+    Register value("s1"), scratch("s2"), index("s0");
+    if (Hi - Lo <= kLinearCases) {
+      for (size_t i = Lo; i < Hi; ++i) {
+        unsigned next = newLabel();
+        instructions.push_back(new asmcode::li(scratch, Immediate(Cases[i].first)));
+        instructions.push_back(new asmcode::branch(asmcode::branch::BNE, value, scratch, next));
+        instructions.push_back(new asmcode::li(index, Immediate(Cases[i].second)));
+        instructions.push_back(new asmcode::jump(Done));
+        instructions.push_back(new asmcode::label(next));
+      }
+      if (!Last) {
+        instructions.push_back(new asmcode::jump(Default));
+      }
+      return;
+    }
+    size_t mid = Lo + (Hi - Lo) / 2;
+    unsigned left = newLabel();
+    instructions.push_back(new asmcode::li(scratch, Immediate(Cases[mid].first)));
+    instructions.push_back(new asmcode::branch(asmcode::branch::BLT, value, scratch, left));
+    compareTree(Cases, mid, Hi, Default, Done, false);
+    instructions.push_back(new asmcode::label(left));
+    compareTree(Cases, Lo, mid, Default, Done, Last);
+  }
+
+  /// Split Size bytes into (offset, width) accesses no wider than Align
+  /// allows, widest first.  False if that takes more than kInlineMemAccesses.
+  static bool memChunks(uint64_t Size, uint64_t Align, std::vector<std::pair<int64_t, unsigned>> &Chunks) {
+    unsigned width = Align >= 8 ? 8 : Align >= 4 ? 4 : Align >= 2 ? 2 : 1;
+    for (uint64_t offset = 0; offset < Size; offset += width) {
+      while (width > Size - offset) {
+        width /= 2;
+      }
+      if (Chunks.size() == kInlineMemAccesses) {
+        return false;
+      }
+      Chunks.emplace_back(offset, width);
+    }
+    return true;
+  }
+
+  /// Every chunk is loaded before any is stored, which makes overlapping
+  /// memmoves safe too.
+  void inlineCopy(llvm::MemTransferInst* MT, const std::vector<std::pair<int64_t, unsigned>> &Chunks) {
+    static const char* temps[] = {"t0", "t1", "t2", "t3", "t4", "t5", "t6", "a1"};
+    static_assert(sizeof(temps) / sizeof(temps[0]) == kInlineMemAccesses, "one register per access");
+    ldData(Register("s0"), MT->getRawDest());
+    ldData(Register("s1"), MT->getRawSource());
+    for (size_t i = 0; i < Chunks.size(); ++i) {
+      instructions.push_back(new asmcode::ld(Register(temps[i]), Register("s1"), Immediate(Chunks[i].first), Chunks[i].second));
+    }
+    for (size_t i = 0; i < Chunks.size(); ++i) {
+      instructions.push_back(new asmcode::st(Register(temps[i]), Register("s0"), Immediate(Chunks[i].first), Chunks[i].second));
+    }
+  }
+
+  /// The byte is replicated into every byte of s2; a store of any width
+  /// then writes its low bytes.
+  void inlineSet(llvm::MemSetInst* MS, const std::vector<std::pair<int64_t, unsigned>> &Chunks) {
+    const uint64_t kBytes = 0x0101010101010101ULL;
+    Register value("s2");
+    ldData(Register("s0"), MS->getRawDest());
+    if (auto* C = llvm::dyn_cast<llvm::ConstantInt>(MS->getValue())) {
+      uint64_t pattern = (C->getZExtValue() & 0xFF) * kBytes;
+      if (pattern == 0) {
+        value = Register("zero");
+      } else {
+        instructions.push_back(new asmcode::li(value, Immediate(pattern)));
+      }
+    } else {
+      ldData(value, MS->getValue());
+      instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ANDI, value, value, Immediate(0xFF)));
+      instructions.push_back(new asmcode::li(Register("s1"), Immediate(kBytes)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::MUL, value, value, Register("s1")));
+    }
+    for (const auto &chunk : Chunks) {
+      instructions.push_back(new asmcode::st(value, Register("s0"), Immediate(chunk.first), chunk.second));
+    }
+  }
+
+  /// s0 = dest, s1 = source, s2 = bytes left; each pass moves vl bytes
+  /// through the register group v8-v15.  Copying forward is only wrong for
+  /// memmove, which never gets here.
+  void vectorMemLoop(llvm::MemIntrinsic* MI) {
+    Register dest("s0"), source("s1"), left("s2"), vl("t0");
+    VRegister data(8);
+    auto* MT = llvm::dyn_cast<llvm::MemTransferInst>(MI);
+    ldData(dest, MI->getRawDest());
+    ldData(left, MI->getLength());
+    if (MT) {
+      ldData(source, MT->getRawSource());
+    } else {
+      ldData(source, llvm::cast<llvm::MemSetInst>(MI)->getValue());
+      instructions.push_back(new asmcode::vsetvli(vl, Register("zero"), 8, true, 8));
+      instructions.push_back(new asmcode::vmove(asmcode::vmove::V_X, data, source));
+    }
+    unsigned loop = newLabel();
+    instructions.push_back(new asmcode::label(loop));
+    instructions.push_back(new asmcode::vsetvli(vl, left, 8, true, 8));
+    if (MT) {
+      instructions.push_back(new asmcode::vmem(false, data, source, 8));
+      instructions.push_back(new asmcode::binary(asmcode::binary::ADD, source, source, vl));
+    }
+    instructions.push_back(new asmcode::vmem(true, data, dest, 8));
+    instructions.push_back(new asmcode::binary(asmcode::binary::ADD, dest, dest, vl));
+    instructions.push_back(new asmcode::binary(asmcode::binary::SUB, left, left, vl));
+    instructions.push_back(new asmcode::branch(asmcode::branch::BNE, left, Register("zero"), loop));
+  }
+
+  /// A standard calling convention call to the routine whose address is in
+  /// the slot of the callee.  The frame pointer (a0) and return address are
+  /// kept on the stack across it; s0-s4 are callee-saved.
+  void callMemRoutine(llvm::MemIntrinsic* MI) {
+    Register sp("sp"), ra("ra"), a0("a0");
+    instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, sp, sp, Immediate(-16)));
+    instructions.push_back(new asmcode::st(ra, sp, Immediate(8)));
+    instructions.push_back(new asmcode::st(a0, sp, Immediate(0)));
+    ldData(Register("t0"), MI->getCalledOperand());
+    ldData(Register("a2"), MI->getLength());
+    if (auto* MT = llvm::dyn_cast<llvm::MemTransferInst>(MI)) {
+      ldData(Register("a1"), MT->getRawSource());
+    } else {
+      ldData(Register("a1"), llvm::cast<llvm::MemSetInst>(MI)->getValue());
+    }
+    ldData(a0, MI->getRawDest()); // Last: the loads above address the frame through a0
+    instructions.push_back(new asmcode::jalr(ra, Register("t0")));
+    instructions.push_back(new asmcode::ld(a0, sp, Immediate(0)));
+    instructions.push_back(new asmcode::ld(ra, sp, Immediate(8)));
+    instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, sp, sp, Immediate(16)));
+  }
+
+  static unsigned accessWidth(llvm::Type* T, const llvm::DataLayout &data_layout) {
+    uint64_t width = data_layout.getTypeStoreSize(T);
+    if (width != 1 && width != 2 && width != 4 && width != 8) {
+      throw std::runtime_error("Unsupported memory access width");
+    }
+    return width;
+  }
+
+  /// Memory assignCell() keeps in a register.
+  struct Cell {
+    llvm::Value* base;
+    int64_t offset;
+    unsigned width;
+    std::vector<llvm::Value*> pointers;
+    Register reg;
+    bool stores;
+  };
+
+  /// The promoted memory a load or store through Ptr accesses, or null.
+  const Cell* cellOf(llvm::Value* Ptr) const {
+    for (auto &cell : cells) {
+      if (llvm::is_contained(cell.pointers, Ptr)) {
+        return &cell;
+      }
+    }
+    return nullptr;
+  }
+
+  /// The register V lives in, or null.
+  const Register* homeOf(llvm::Value* V) const {
+    for (auto &home : homes) {
+      if (home.first == V) {
+        return &home.second;
+      }
+    }
+    return nullptr;
+  }
+
   void ldData(Register R, llvm::Value* V) {
-    if (auto* CI = llvm::dyn_cast<llvm::ConstantInt>(V)) {
-      instructions.push_back(new asmcode::li(R, Immediate(CI->getValue().getSExtValue())));
+    int64_t value;
+    if (constantOf(V, value)) {
+      instructions.push_back(new asmcode::li(R, Immediate(value)));
+    } else if (const Register* home = homeOf(V)) {
+      if (home->id() != R.id()) {
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, R, *home, Immediate(0)));
+      }
     } else {
-      int64_t *val = nullptr;
-      if (val_map.find(V) != val_map.end()) {
-        val = val_map[V];
+      int64_t offset = slotOf(V) * 8;
+      if (offset < 2048) {
+        instructions.push_back(new asmcode::ld(R, Register("a0"), Immediate(offset)));
       } else {
-        val = new int64_t;
-        val_map[V] = val;
+        instructions.push_back(new asmcode::li(Register("s4"), Immediate(offset)));
+        instructions.push_back(new asmcode::binary(asmcode::binary::ADD, Register("s4"), Register("s4"), Register("a0")));
+        instructions.push_back(new asmcode::ld(R, Register("s4")));
       }
-      instructions.push_back(new asmcode::li(R, Immediate((int64_t)val)));
-      instructions.push_back(new asmcode::ld(R, R));
     }
   }
 
   void stData(Register R, llvm::Value* V) {
-    int64_t *val = nullptr;
-    if (val_map.find(V) != val_map.end()) {
-      val = val_map[V];
+    known.erase(V); // A block repeated in a superblock sets its values anew
+    if (const Register* home = homeOf(V)) {
+      if (home->id() != R.id()) {
+        instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, *home, R, Immediate(0)));
+      }
+      return;
+    }
+    stFrame(R, slotOf(V) * 8);
+  }
+
+  /// V += Delta, in its register or slot.
+  void addToValue(llvm::Value* V, int64_t Delta) {
+    const Register* home = homeOf(V);
+    Register R = home ? *home : Register("s0");
+    if (!home) {
+      ldData(R, V);
+    }
+    if (Delta >= -2048 && Delta < 2048) {
+      instructions.push_back(new asmcode::binaryi(asmcode::binaryi::ADDI, R, R, Immediate(Delta)));
+    } else {
+      instructions.push_back(new asmcode::li(Register("s1"), Immediate(Delta)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::ADD, R, R, Register("s1")));
+    }
+    if (!home) {
+      stData(R, V);
+    }
+  }
+
+  void stFrame(Register R, int64_t offset) {
+    if (offset < 2048) {
+      instructions.push_back(new asmcode::st(R, Register("a0"), Immediate(offset)));
     } else {
-      val = new int64_t;
-      val_map[V] = val;
+      instructions.push_back(new asmcode::li(Register("s4"), Immediate(offset)));
+      instructions.push_back(new asmcode::binary(asmcode::binary::ADD, Register("s4"), Register("s4"), Register("a0")));
+      instructions.push_back(new asmcode::st(R, Register("s4")));
     }
-    instructions.push_back(new asmcode::li(Register("s4"), Immediate((int64_t)val)));
-    instructions.push_back(new asmcode::st(R, Register("s4")));
   }
 
 private:
   std::vector<const Instruction*> instructions;
+  std::vector<const Instruction*> trailer; // Emitted after the return
+  std::vector<llvm::Value*> &slots;
+  std::unordered_map<llvm::Value*, size_t> slot_index;
+  unsigned next_label = 0;
+  std::vector<std::pair<unsigned, int64_t>> exit_stubs; // (label, exit word) of each way out before the end
+  std::unordered_map<llvm::Value*, int64_t> known;      // Values guards have pinned
+  int64_t trace_edges = 0;
+  int64_t guards = 0;
+  std::vector<std::pair<llvm::Value*, Register>> homes; // Values kept in extra registers
+  std::vector<Cell> cells; // Alloca memory kept in extra registers
+  unsigned extra_saved = 0;
+  int64_t spill_bytes = 48;
+  bool looping = false;
+  unsigned loop_head = 0;
+  bool compress = false;
+  bool vector = false;
+  bool zbb = false;
+  bool zicond = false;
 };
 
 }
@@ -0,0 +1,182 @@
+#ifndef ASMVECTOR_HPP
+#define ASMVECTOR_HPP
+
+#include "asmcmd.hpp"
+
+// Instructions of the RISC-V vector extension (RVV 1.0).  Only unmasked
+// forms are generated; register groups (LMUL > 1) only for bulk memory.
+
+namespace asmcode {
+
+/// OP-V encoding shared by the arithmetic, move and reduction instructions.
+inline uint32_t encodeOPV(uint32_t funct6, uint32_t vs2, uint32_t rs1, uint32_t funct3, uint32_t vd) {
+  return (funct6 << 26) | (1u << 25) | (vs2 << 20) | (rs1 << 15) | (funct3 << 12) | (vd << 7) | 0x57;
+}
+
+/// vsetvli rd, rs1, e<sew>, m<lmul>, {ta,ma | tu,mu}.  With rs1 = zero,
+/// sets vl to VLMAX.
+class vsetvli : public Instruction {
+public:
+  vsetvli(const Register &rd, const Register &rs1, unsigned sew, bool agnostic, unsigned lmul = 1) : rd(rd), rs1(rs1), sew(sew), agnostic(agnostic), lmul(lmul) {
+  }
+
+  std::string toString() const override {
+    return "vsetvli " + rd.toString() + ", " + rs1.toString() + ", e" + std::to_string(sew) + ", m" + std::to_string(lmul) + ", " +
+      (agnostic ? "ta, ma" : "tu, mu");
+  }
+
+  unsigned char* encode() const override {
+    uint32_t vsew = sew == 8 ? 0 : sew == 16 ? 1 : sew == 32 ? 2 : 3;
+    uint32_t vlmul = lmul == 1 ? 0 : lmul == 2 ? 1 : lmul == 4 ? 2 : 3;
+    uint32_t vtype = (vsew << 3) | vlmul | (agnostic ? (3u << 6) : 0);
+    return encodeWord((vtype << 20) | (rs1.id() << 15) | (0x7 << 12) | (rd.id() << 7) | 0x57);
+  }
+
+  int64_t size() const override {
+    return 4;
+  }
+
+private:
+  Register rd;
+  Register rs1;
+  unsigned sew;
+  bool agnostic;
+  unsigned lmul;
+};
+
+/// Unit-stride vle<sew>.v / vse<sew>.v.
+class vmem : public Instruction {
+public:
+  vmem(bool store, const VRegister &v, const Register &base, unsigned sew) : store(store), v(v), base(base), sew(sew) {
+  }
+
+  std::string toString() const override {
+    return std::string(store ? "vse" : "vle") + std::to_string(sew) + ".v " + v.toString() + ", (" + base.toString() + ")";
+  }
+
+  unsigned char* encode() const override {
+    uint32_t width = sew == 8 ? 0x0 : sew == 16 ? 0x5 : sew == 32 ? 0x6 : 0x7;
+    uint32_t opcode = store ? 0x27 : 0x07; // STORE-FP / LOAD-FP
+    return encodeWord((1u << 25) | (base.id() << 15) | (width << 12) | (v.id() << 7) | opcode);
+  }
+
+  int64_t size() const override {
+    return 4;
+  }
+
+private:
+  bool store;
+  VRegister v;
+  Register base;
+  unsigned sew;
+};
+
+/// Element-wise integer arithmetic and reductions, vector-vector
+/// (vd = vs2 op vs1) or vector-scalar (vd = vs2 op rs1).
+class varith : public Instruction {
+public:
+  enum Opcode {
+    ADD,
+    SUB,
+    RSUB, // rs1 - vs2, vector-scalar only
+    MUL,
+    AND,
+    OR,
+    XOR,
+    REDSUM, // vd[0] = vs1[0] + sum(vs2), vector-vector only
+    REDAND,
+    REDOR,
+    REDXOR
+  };
+
+  varith(const Opcode op, const VRegister &vd, const VRegister &vs2, const VRegister &vs1) : op(op), vd(vd), vs2(vs2), vs1(vs1), rs1(Register("zero")), scalar(false) {
+  }
+
+  varith(const Opcode op, const VRegister &vd, const VRegister &vs2, const Register &rs1) : op(op), vd(vd), vs2(vs2), vs1(0), rs1(rs1), scalar(true) {
+  }
+
+  std::string toString() const override {
+    static const char* names[] = {"vadd", "vsub", "vrsub", "vmul", "vand", "vor", "vxor", "vredsum", "vredand", "vredor", "vredxor"};
+    std::string suffix = op >= REDSUM ? ".vs " : scalar ? ".vx " : ".vv ";
+    return names[op] + suffix + vd.toString() + ", " + vs2.toString() + ", " + (scalar ? rs1.toString() : vs1.toString());
+  }
+
+  unsigned char* encode() const override {
+    // funct6, and whether the instruction is in the OPM (multiply/reduce) space.
+    static const uint32_t funct6[] = {0x00, 0x02, 0x03, 0x25, 0x09, 0x0A, 0x0B, 0x00, 0x01, 0x02, 0x03};
+    bool opm = op == MUL || op >= REDSUM;
+    uint32_t funct3 = opm ? (scalar ? 0x6 : 0x2) : (scalar ? 0x4 : 0x0);
+    if ((op == RSUB && !scalar) || (op >= REDSUM && scalar)) {
+      throw std::runtime_error("Invalid operand form for " + toString());
+    }
+    return encodeWord(encodeOPV(funct6[op], vs2.id(), scalar ? rs1.id() : vs1.id(), funct3, vd.id()));
+  }
+
+  int64_t size() const override {
+    return 4;
+  }
+
+private:
+  Opcode op;
+  VRegister vd;
+  VRegister vs2;
+  VRegister vs1;
+  Register rs1;
+  bool scalar;
+};
+
+/// The vector moves: vmv.v.x (splat a register), vmv.v.i (splat a 5-bit
+/// immediate), vmv.s.x (element 0 from a register), vmv.x.s (element 0 to a
+/// register) and vid.v (element indices).
+class vmove : public Instruction {
+public:
+  enum Opcode {
+    V_X,
+    V_I,
+    S_X,
+    X_S,
+    ID
+  };
+
+  vmove(const Opcode op, const VRegister &v, const Register &r) : op(op), v(v), r(r), imm(0) {
+  }
+
+  vmove(const Opcode op, const VRegister &v, int64_t imm) : op(op), v(v), r(Register("zero")), imm(imm) {
+  }
+
+  std::string toString() const override {
+    switch (op) {
+      case V_X: return "vmv.v.x " + v.toString() + ", " + r.toString();
+      case V_I: return "vmv.v.i " + v.toString() + ", " + std::to_string(imm);
+      case S_X: return "vmv.s.x " + v.toString() + ", " + r.toString();
+      case X_S: return "vmv.x.s " + r.toString() + ", " + v.toString();
+      case ID: return "vid.v " + v.toString();
+    }
+    return "";
+  }
+
+  unsigned char* encode() const override {
+    switch (op) {
+      case V_X: return encodeWord(encodeOPV(0x17, 0, r.id(), 0x4, v.id()));
+      case V_I: return encodeWord(encodeOPV(0x17, 0, imm & 0x1F, 0x3, v.id()));
+      case S_X: return encodeWord(encodeOPV(0x10, 0, r.id(), 0x6, v.id()));
+      case X_S: return encodeWord(encodeOPV(0x10, v.id(), 0, 0x2, r.id()));
+      case ID: return encodeWord(encodeOPV(0x14, 0, 0x11, 0x2, v.id()));
+    }
+    return nullptr;
+  }
+
+  int64_t size() const override {
+    return 4;
+  }
+
+private:
+  Opcode op;
+  VRegister v;
+  Register r;
+  int64_t imm;
+};
+
+}
+
+#endif // ASMVECTOR_HPP
@@ -0,0 +1,295 @@
+#include "codecache.hpp"
+#include "../asm/asmstruct.hpp"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <fstream>
+#include <unistd.h>
+
+// -------- File format ---------
+//   "NJCC" u32 format u32 codegen u64 hash u32 #executors
+//   per executor:
+//     u32 block u32 start u32 terminator i32 next
+//     u32 #trace    { u32 block } u8 loops
+//     u32 #deopts   { u32 instruction }
+//     u32 #slots    { u8 kind u8 owned (u32 index | u32 len + name) }
+//     u32 #bytes    code
+// All integers are little-endian.
+
+static const char kMagic[4] = {'N', 'J', 'C', 'C'};
+static const uint32_t kFormatVersion = 5;
+
+enum SlotKind : uint8_t { ArgumentSlot = 0, InstructionSlot = 1, GlobalSlot = 2 };
+
+namespace {
+
+class Writer {
+public:
+  void u8(uint8_t V) { buf.push_back(static_cast<char>(V)); }
+  void u32(uint32_t V) {
+    for (int i = 0; i < 4; ++i) u8((V >> (8 * i)) & 0xff);
+  }
+  void u64(uint64_t V) {
+    for (int i = 0; i < 8; ++i) u8((V >> (8 * i)) & 0xff);
+  }
+  void bytes(const void *P, size_t N) { buf.append(static_cast<const char *>(P), N); }
+
+  std::string buf;
+};
+
+class Reader {
+public:
+  Reader(llvm::StringRef Data) : data(Data) {}
+
+  bool u8(uint8_t &V) {
+    if (pos + 1 > data.size()) return false;
+    V = static_cast<uint8_t>(data[pos++]);
+    return true;
+  }
+  bool u32(uint32_t &V) {
+    V = 0;
+    for (int i = 0; i < 4; ++i) {
+      uint8_t B;
+      if (!u8(B)) return false;
+      V |= static_cast<uint32_t>(B) << (8 * i);
+    }
+    return true;
+  }
+  bool u64(uint64_t &V) {
+    V = 0;
+    for (int i = 0; i < 8; ++i) {
+      uint8_t B;
+      if (!u8(B)) return false;
+      V |= static_cast<uint64_t>(B) << (8 * i);
+    }
+    return true;
+  }
+  bool bytes(size_t N, llvm::StringRef &Out) {
+    if (pos + N > data.size()) return false;
+    Out = data.substr(pos, N);
+    pos += N;
+    return true;
+  }
+
+private:
+  llvm::StringRef data;
+  size_t pos = 0;
+};
+
+} // namespace
+
+CodeCache::CodeCache(const std::string &Dir, const llvm::Module &M, const std::string &Target) : dir(Dir) {
+  module_salt = M.getDataLayoutStr() + "|" + M.getTargetTriple() + "|" + std::to_string(kFormatVersion) + "|" +
+                std::to_string(asmcode::kCodegenVersion) + "|" + Target;
+  if (std::error_code EC = llvm::sys::fs::create_directories(dir)) {
+    throw std::runtime_error("Cannot create code cache directory " + dir + ": " + EC.message());
+  }
+}
+
+uint64_t CodeCache::hashFunction(llvm::Function &F) const {
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  F.print(os);
+  os << module_salt;
+  return llvm::xxHash64(os.str());
+}
+
+std::string CodeCache::pathFor(uint64_t Hash) const {
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.ncc", static_cast<unsigned long long>(Hash));
+  llvm::SmallString<128> path(dir);
+  llvm::sys::path::append(path, name);
+  return std::string(path.str());
+}
+
+bool CodeCache::load(llvm::Function &F, std::vector<CachedExecutor> &Execs) const {
+  uint64_t hash = hashFunction(F);
+  auto BufOrErr = llvm::MemoryBuffer::getFile(pathFor(hash), /*IsText=*/false,
+                                              /*RequiresNullTerminator=*/false);
+  if (!BufOrErr) {
+    return false;
+  }
+
+  std::vector<llvm::BasicBlock *> blocks;
+  std::vector<llvm::Instruction *> insts;
+  for (llvm::BasicBlock &BB : F) {
+    blocks.push_back(&BB);
+    for (llvm::Instruction &I : BB) {
+      insts.push_back(&I);
+    }
+  }
+
+  Reader R((*BufOrErr)->getBuffer());
+  llvm::StringRef magic;
+  uint32_t format, codegen, count;
+  uint64_t stored_hash;
+  if (!R.bytes(4, magic) || magic != llvm::StringRef(kMagic, 4) || !R.u32(format) ||
+      format != kFormatVersion || !R.u32(codegen) || codegen != asmcode::kCodegenVersion ||
+      !R.u64(stored_hash) || stored_hash != hash || !R.u32(count)) {
+    return false;
+  }
+
+  std::vector<CachedExecutor> result(count);
+  for (CachedExecutor &E : result) {
+    uint32_t block, start, terminator, next, num_trace, num_deopts, num_slots, code_size;
+    if (!R.u32(block) || block >= blocks.size() || !R.u32(start) || start >= blocks[block]->size() ||
+        !R.u32(terminator) || terminator >= insts.size() || !R.u32(next) || !R.u32(num_trace)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < num_trace; ++i) {
+      uint32_t traced;
+      if (!R.u32(traced) || traced >= blocks.size()) {
+        return false;
+      }
+      E.trace.push_back(blocks[traced]);
+    }
+    uint8_t loops;
+    if (!R.u8(loops) || !R.u32(num_deopts)) {
+      return false;
+    }
+    for (uint32_t i = 0; i < num_deopts; ++i) {
+      uint32_t resume;
+      if (!R.u32(resume) || resume >= insts.size()) {
+        return false;
+      }
+      E.deopts.push_back(insts[resume]);
+    }
+    if (!R.u32(num_slots)) {
+      return false;
+    }
+    E.loops = loops != 0;
+    E.block = blocks[block];
+    E.start = start;
+    E.terminator = insts[terminator];
+    E.next = static_cast<int32_t>(next);
+    if (E.next < -1 || E.next >= static_cast<int>(count)) {
+      return false;
+    }
+
+    for (uint32_t i = 0; i < num_slots; ++i) {
+      uint8_t kind, owned;
+      if (!R.u8(kind) || !R.u8(owned)) {
+        return false;
+      }
+      llvm::Value *V = nullptr;
+      if (kind == GlobalSlot) {
+        uint32_t len;
+        llvm::StringRef name;
+        if (!R.u32(len) || !R.bytes(len, name)) {
+          return false;
+        }
+        V = F.getParent()->getNamedValue(name);
+      } else {
+        uint32_t index;
+        if (!R.u32(index)) {
+          return false;
+        }
+        if (kind == ArgumentSlot && index < F.arg_size()) {
+          V = F.getArg(index);
+        } else if (kind == InstructionSlot && index < insts.size()) {
+          V = insts[index];
+        }
+      }
+      if (!V) {
+        return false;
+      }
+      E.slots.push_back(V);
+      E.owned.push_back(owned != 0);
+    }
+
+    llvm::StringRef code;
+    if (!R.u32(code_size) || !R.bytes(code_size, code)) {
+      return false;
+    }
+    E.code.assign(code.begin(), code.end());
+  }
+
+  Execs = std::move(result);
+  return true;
+}
+
+bool CodeCache::store(llvm::Function &F, const std::vector<CachedExecutor> &Execs) const {
+  std::unordered_map<const llvm::BasicBlock *, uint32_t> block_ids;
+  std::unordered_map<const llvm::Instruction *, uint32_t> inst_ids;
+  for (llvm::BasicBlock &BB : F) {
+    block_ids.emplace(&BB, block_ids.size());
+    for (llvm::Instruction &I : BB) {
+      inst_ids.emplace(&I, inst_ids.size());
+    }
+  }
+
+  uint64_t hash = hashFunction(F);
+  Writer W;
+  W.bytes(kMagic, 4);
+  W.u32(kFormatVersion);
+  W.u32(asmcode::kCodegenVersion);
+  W.u64(hash);
+  W.u32(Execs.size());
+  for (const CachedExecutor &E : Execs) {
+    if (!E.terminator || !inst_ids.count(E.terminator)) {
+      return false;
+    }
+    W.u32(block_ids.at(E.block));
+    W.u32(E.start);
+    W.u32(inst_ids.at(E.terminator));
+    W.u32(static_cast<uint32_t>(E.next));
+    W.u32(E.trace.size());
+    for (llvm::BasicBlock *BB : E.trace) {
+      W.u32(block_ids.at(BB));
+    }
+    W.u8(E.loops ? 1 : 0);
+    W.u32(E.deopts.size());
+    for (llvm::Instruction *I : E.deopts) {
+      W.u32(inst_ids.at(I));
+    }
+    W.u32(E.slots.size());
+    for (size_t i = 0; i < E.slots.size(); ++i) {
+      llvm::Value *V = E.slots[i];
+      uint8_t owned = E.owned[i] ? 1 : 0;
+      if (auto *A = llvm::dyn_cast<llvm::Argument>(V)) {
+        W.u8(ArgumentSlot);
+        W.u8(owned);
+        W.u32(A->getArgNo());
+      } else if (auto *I = llvm::dyn_cast<llvm::Instruction>(V)) {
+        auto it = inst_ids.find(I);
+        if (it == inst_ids.end()) {
+          return false;
+        }
+        W.u8(InstructionSlot);
+        W.u8(owned);
+        W.u32(it->second);
+      } else if (auto *G = llvm::dyn_cast<llvm::GlobalValue>(V)) {
+        if (!G->hasName()) {
+          return false;
+        }
+        W.u8(GlobalSlot);
+        W.u8(owned);
+        W.u32(G->getName().size());
+        W.bytes(G->getName().data(), G->getName().size());
+      } else {
+        return false;
+      }
+    }
+    W.u32(E.code.size());
+    W.bytes(E.code.data(), E.code.size());
+  }
+
+  // Write to a private temporary and rename over the entry, so concurrent
+  // runs never observe a partially written file.
+  std::string path = pathFor(hash);
+  std::string tmp = path + ".tmp." + std::to_string(getpid());
+  {
+    std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+    out.write(W.buf.data(), W.buf.size());
+    if (!out) {
+      llvm::sys::fs::remove(tmp);
+      return false;
+    }
+  }
+  if (llvm::sys::fs::rename(tmp, path)) {
+    llvm::sys::fs::remove(tmp);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,48 @@
+#ifndef CODECACHE_HPP
+#define CODECACHE_HPP
+
+#include <string>
+#include "../util/util.hpp"
+
+/// A compiled block segment in a form that outlives the process: its machine
+/// code, which reads every address from the frame, plus the IR positions
+/// needed to rebuild the executor against a freshly loaded module.
+struct CachedExecutor {
+  llvm::BasicBlock* block = nullptr;
+  unsigned start = 0;                                  // index of the first instruction of the segment
+  llvm::Instruction* terminator = nullptr;
+  int next = -1;                                       // index of the following segment, -1 if none
+  std::vector<llvm::BasicBlock*> trace;                // blocks a superblock runs after `block`, in order
+  bool loops = false;                                  // the code runs the trace again while it branches back to `block`
+  std::vector<llvm::Instruction*> deopts;              // where the interpreter resumes when each guard fails
+  std::vector<llvm::Value*> slots;                     // values owning a slot, in slot order
+  std::vector<bool> owned;                             // slot holds an alloca materialized by this segment
+  std::vector<unsigned char> code;
+};
+
+/// On-disk cache of compiled code, one file per function.  Files are keyed by
+/// a hash of the function's IR, the module's data layout and triple, the
+/// code generator version and Target, the instruction set options the code
+/// was generated for, so a stale entry is simply never found.
+class CodeCache {
+public:
+  CodeCache(const std::string &Dir, const llvm::Module &M, const std::string &Target);
+
+  /// Read the cached segments of F.  Returns false if there is no usable entry.
+  bool load(llvm::Function &F, std::vector<CachedExecutor> &Execs) const;
+
+  /// Persist the segments of F, replacing any previous entry atomically.
+  /// Returns false if a segment refers to a value that cannot be named across
+  /// runs, in which case nothing is written.
+  bool store(llvm::Function &F, const std::vector<CachedExecutor> &Execs) const;
+
+private:
+  uint64_t hashFunction(llvm::Function &F) const;
+
+  std::string pathFor(uint64_t Hash) const;
+
+  std::string dir;
+  std::string module_salt;
+};
+
+#endif // CODECACHE_HPP
@@ -0,0 +1,65 @@
+#include "cpufeatures.hpp"
+#include <sstream>
+#include <stdexcept>
+#include <sys/auxv.h>
+#if defined(__riscv)
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+
+// riscv_hwprobe(2), from Linux 6.4 on.  Spelled out here so the runner also
+// builds against older kernel headers.
+constexpr long kSysRiscvHwprobe = 258;
+constexpr long long kHwprobeKeyIMAExt0 = 4;
+constexpr unsigned long long kHwprobeExtZbb = 1ULL << 4;
+constexpr unsigned long long kHwprobeExtZicond = 1ULL << 35;
+
+struct HwprobePair {
+  long long key;
+  unsigned long long value;
+};
+
+} // namespace
+#endif
+
+CPUFeatures CPUFeatures::detect() {
+  CPUFeatures F;
+#if defined(__riscv)
+  // Single-letter extensions are bits of AT_HWCAP, 'A' being bit 0.
+  unsigned long hwcap = getauxval(AT_HWCAP);
+  F.c = hwcap & (1UL << ('C' - 'A'));
+  F.v = hwcap & (1UL << ('V' - 'A'));
+  // Multi-letter ones come from riscv_hwprobe; on older kernels the call
+  // fails and none of them are assumed.
+  HwprobePair pair = {kHwprobeKeyIMAExt0, 0};
+  if (syscall(kSysRiscvHwprobe, &pair, 1, 0, nullptr, 0) == 0 && pair.key == kHwprobeKeyIMAExt0) {
+    F.zbb = pair.value & kHwprobeExtZbb;
+    F.zicond = pair.value & kHwprobeExtZicond;
+  }
+#endif
+  return F;
+}
+
+void CPUFeatures::apply(const std::string &Spec) {
+  std::stringstream in(Spec);
+  std::string name;
+  while (std::getline(in, name, ',')) {
+    if (name.empty()) {
+      continue;
+    }
+    bool enable = name[0] != '-';
+    std::string ext = enable ? name : name.substr(1);
+    if (ext == "c") {
+      c = enable;
+    } else if (ext == "v") {
+      v = enable;
+    } else if (ext == "zbb") {
+      zbb = enable;
+    } else if (ext == "zicond") {
+      zicond = enable;
+    } else {
+      throw std::runtime_error("Unknown extension in --jit-ext: " + ext);
+    }
+  }
+}
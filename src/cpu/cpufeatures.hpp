@@ -0,0 +1,22 @@
+#ifndef CPUFEATURES_HPP
+#define CPUFEATURES_HPP
+
+#include <string>
+
+/// Instruction set extensions of the CPU the runner executes on, as reported
+/// by the kernel.  Everything is false on hosts that are not RISC-V.
+struct CPUFeatures {
+  bool c = false;      // Compressed instructions
+  bool v = false;      // Vector extension 1.0
+  bool zbb = false;    // Basic bit manipulation: min/max among others
+  bool zicond = false; // Integer conditional zeroing: czero.eqz/nez
+
+  static CPUFeatures detect();
+
+  /// Turn extensions on or off as Spec says: a comma-separated list of
+  /// names (c, v, zbb, zicond), each optionally prefixed with '-' to turn it
+  /// off.  Throws on a name it does not know.
+  void apply(const std::string &Spec);
+};
+
+#endif // CPUFEATURES_HPP
@@ -0,0 +1,199 @@
+#include "datasegment.hpp"
+#include <llvm/IR/Operator.h>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace {
+
+size_t pageSize() {
+  static const size_t page = sysconf(_SC_PAGESIZE);
+  return page;
+}
+
+size_t roundToPage(size_t Size) {
+  return (Size + pageSize() - 1) & ~(pageSize() - 1);
+}
+
+/// Little-endian bytes of Value, zero-extended or truncated to Bytes.
+void writeInt(const llvm::APInt &Value, char *Dest, uint64_t Bytes) {
+  for (uint64_t i = 0; i < Bytes && i * 8 < Value.getBitWidth(); ++i) {
+    unsigned bits = std::min<unsigned>(8, Value.getBitWidth() - i * 8);
+    Dest[i] = (char)Value.extractBitsAsZExtValue(bits, i * 8);
+  }
+}
+
+} // namespace
+
+DataSegment::DataSegment(const llvm::Module &M) : layout(M.getDataLayout()) {
+  // Intrinsic globals (llvm.used and friends) describe the module rather
+  // than hold program data.
+  auto hasStorage = [](const llvm::GlobalVariable &GV) {
+    return !GV.isDeclaration() && !GV.getName().startswith("llvm.");
+  };
+  uint64_t top = 0;
+  auto place = [&](const llvm::GlobalVariable &GV) {
+    uint64_t align = layout.getPreferredAlign(&GV).value();
+    top = (top + align - 1) & ~(align - 1);
+    offsets[&GV] = top;
+    top += std::max<uint64_t>(layout.getTypeAllocSize(GV.getValueType()), 1);
+  };
+  for (const llvm::GlobalVariable &GV : M.globals()) {
+    if (hasStorage(GV) && GV.isConstant()) {
+      place(GV);
+    }
+  }
+  read_only_size = roundToPage(top);
+  top = read_only_size;
+  for (const llvm::GlobalVariable &GV : M.globals()) {
+    if (hasStorage(GV) && !GV.isConstant()) {
+      place(GV);
+    }
+  }
+  image.assign(top, 0);
+  for (const llvm::GlobalVariable &GV : M.globals()) {
+    if (hasStorage(GV) && !write(GV.getInitializer(), offsets[&GV])) {
+      throw std::runtime_error("Unsupported initializer for global @" + GV.getName().str() + ".");
+    }
+  }
+  std::sort(fixups.begin(), fixups.end(), [](const Fixup &A, const Fixup &B) { return A.offset < B.offset; });
+}
+
+uint64_t DataSegment::offsetOf(const llvm::GlobalVariable *GV) const {
+  auto it = offsets.find(GV);
+  if (it == offsets.end()) {
+    throw std::runtime_error("Global @" + GV->getName().str() + " has no definition.");
+  }
+  return it->second;
+}
+
+bool DataSegment::decompose(const llvm::Constant *C, const llvm::DataLayout &DL, const llvm::GlobalVariable *&GV,
+                            int64_t &Offset) {
+  if ((GV = llvm::dyn_cast<llvm::GlobalVariable>(C))) {
+    Offset = 0;
+    return true;
+  }
+  auto *CE = llvm::dyn_cast<llvm::ConstantExpr>(C);
+  if (!CE) {
+    return false;
+  }
+  switch (CE->getOpcode()) {
+  case llvm::Instruction::BitCast:
+  case llvm::Instruction::AddrSpaceCast:
+  case llvm::Instruction::PtrToInt:
+    return decompose(CE->getOperand(0), DL, GV, Offset);
+  case llvm::Instruction::GetElementPtr: {
+    llvm::APInt offset(DL.getIndexTypeSizeInBits(CE->getType()), 0);
+    if (!llvm::cast<llvm::GEPOperator>(CE)->accumulateConstantOffset(DL, offset) ||
+        !decompose(CE->getOperand(0), DL, GV, Offset)) {
+      return false;
+    }
+    Offset += offset.getSExtValue();
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+bool DataSegment::write(const llvm::Constant *C, uint64_t Offset) {
+  char *dest = image.data() + Offset;
+  if (llvm::isa<llvm::ConstantAggregateZero>(C) || llvm::isa<llvm::ConstantPointerNull>(C) ||
+      llvm::isa<llvm::UndefValue>(C)) {
+    return true; // The image starts out zeroed
+  }
+  if (auto *CI = llvm::dyn_cast<llvm::ConstantInt>(C)) {
+    writeInt(CI->getValue(), dest, layout.getTypeStoreSize(C->getType()));
+    return true;
+  }
+  if (auto *CF = llvm::dyn_cast<llvm::ConstantFP>(C)) {
+    writeInt(CF->getValueAPF().bitcastToAPInt(), dest, layout.getTypeStoreSize(C->getType()));
+    return true;
+  }
+  if (auto *CDS = llvm::dyn_cast<llvm::ConstantDataSequential>(C)) {
+    llvm::StringRef raw = CDS->getRawDataValues();
+    memcpy(dest, raw.data(), raw.size());
+    return true;
+  }
+  if (auto *CS = llvm::dyn_cast<llvm::ConstantStruct>(C)) {
+    const llvm::StructLayout *SL = layout.getStructLayout(CS->getType());
+    for (unsigned i = 0; i < CS->getNumOperands(); ++i) {
+      if (!write(CS->getOperand(i), Offset + SL->getElementOffset(i))) {
+        return false;
+      }
+    }
+    return true;
+  }
+  if (llvm::isa<llvm::ConstantArray>(C) || llvm::isa<llvm::ConstantVector>(C)) {
+    uint64_t stride = layout.getTypeAllocSize(C->getOperand(0)->getType());
+    for (unsigned i = 0; i < C->getNumOperands(); ++i) {
+      if (!write(llvm::cast<llvm::Constant>(C->getOperand(i)), Offset + i * stride)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  // Addresses of other globals are filled in once the base is known.
+  const llvm::GlobalVariable *GV;
+  int64_t addend;
+  if (layout.getTypeStoreSize(C->getType()) == 8 && decompose(C, layout, GV, addend) && offsets.count(GV)) {
+    fixups.push_back({Offset, offsets[GV] + addend});
+    return true;
+  }
+  return false;
+}
+
+DataSegment::Instance::Instance(const DataSegment &Segment) : segment(Segment) {
+  mapped = roundToPage(segment.size());
+  if (!mapped) {
+    return;
+  }
+  void *addr = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error("Failed to map global data: " + std::string(strerror(errno)));
+  }
+  mem = static_cast<char *>(addr);
+  initialize(0);
+  if (segment.readOnlySize() && mprotect(mem, segment.readOnlySize(), PROT_READ) != 0) {
+    std::string error = strerror(errno);
+    munmap(mem, mapped);
+    throw std::runtime_error("Failed to protect constant global data: " + error);
+  }
+}
+
+DataSegment::Instance::~Instance() {
+  if (mem) {
+    munmap(mem, mapped);
+  }
+}
+
+void DataSegment::Instance::reset() {
+  initialize(segment.readOnlySize());
+}
+
+void DataSegment::Instance::initialize(size_t From) {
+  if (From >= segment.size()) {
+    return;
+  }
+  memcpy(mem + From, segment.image.data() + From, segment.size() - From);
+  auto it = std::lower_bound(segment.fixups.begin(), segment.fixups.end(), From,
+                             [](const Fixup &F, size_t Offset) { return F.offset < Offset; });
+  for (; it != segment.fixups.end(); ++it) {
+    int64_t address = reinterpret_cast<int64_t>(mem + it->target);
+    memcpy(mem + it->offset, &address, sizeof(address));
+  }
+}
+
+bool DataSegment::Instance::addressOf(const llvm::Constant *C, const llvm::DataLayout &DL, int64_t &Out) const {
+  if (llvm::isa<llvm::ConstantPointerNull>(C)) {
+    Out = 0;
+    return true;
+  }
+  const llvm::GlobalVariable *GV;
+  int64_t offset;
+  if (!decompose(C, DL, GV, offset)) {
+    return false;
+  }
+  Out = reinterpret_cast<int64_t>(mem + segment.offsetOf(GV)) + offset;
+  return true;
+}
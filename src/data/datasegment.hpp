@@ -0,0 +1,79 @@
+#ifndef DATASEGMENT_HPP
+#define DATASEGMENT_HPP
+
+#include "../util/util.hpp"
+#include <unordered_map>
+
+/// Memory for the module's global variables.  The layout is computed once
+/// at load: every defined global gets an offset from the segment base, per
+/// the module's DataLayout and in module order, with the constant globals
+/// packed together at the start so they can be mapped read-only.  The
+/// initial contents are kept as an image plus the pointers in it, which
+/// are stored as offsets until an Instance knows its base.
+class DataSegment {
+public:
+  explicit DataSegment(const llvm::Module &M);
+
+  /// Offset of GV from the segment base.  Throws for globals without
+  /// storage here, i.e. declarations of external ones.
+  uint64_t offsetOf(const llvm::GlobalVariable *GV) const;
+
+  /// Bytes of the read-only part, a whole number of pages (0 if empty).
+  size_t readOnlySize() const { return read_only_size; }
+
+  /// Bytes of the whole segment.
+  size_t size() const { return image.size(); }
+
+  /// Splits an address constant (a global, or a cast or constant GEP of
+  /// one) into the global and a byte offset.  False if C is not one.
+  static bool decompose(const llvm::Constant *C, const llvm::DataLayout &DL, const llvm::GlobalVariable *&GV,
+                        int64_t &Offset);
+
+  /// The globals of one execution context: its own copy of the segment, so
+  /// that concurrent runs never see each other's stores.
+  class Instance {
+  public:
+    explicit Instance(const DataSegment &Segment);
+
+    Instance(const Instance &) = delete;
+
+    Instance &operator=(const Instance &) = delete;
+
+    ~Instance();
+
+    /// Restore every writable global to its initializer.
+    void reset();
+
+    char *base() const { return mem; }
+
+    /// Value of an address constant, or of a null pointer; see decompose().
+    /// DL is the caller's own, since its struct layout cache is not shared.
+    bool addressOf(const llvm::Constant *C, const llvm::DataLayout &DL, int64_t &Out) const;
+
+  private:
+    void initialize(size_t From);
+
+    const DataSegment &segment;
+    char *mem = nullptr;
+    size_t mapped = 0;
+  };
+
+private:
+  // A pointer in the image: at `offset` goes the address of `target`, itself
+  // an offset from the segment base.
+  struct Fixup {
+    uint64_t offset;
+    uint64_t target;
+  };
+
+  /// Put C's bytes into the image at Offset; false if C is not supported.
+  bool write(const llvm::Constant *C, uint64_t Offset);
+
+  const llvm::DataLayout &layout;
+  std::unordered_map<const llvm::GlobalVariable *, uint64_t> offsets;
+  std::vector<char> image;
+  std::vector<Fixup> fixups; // Sorted by offset
+  size_t read_only_size = 0;
+};
+
+#endif // DATASEGMENT_HPP
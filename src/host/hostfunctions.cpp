@@ -0,0 +1,106 @@
+#include "hostfunctions.hpp"
+#include <dlfcn.h>
+#include <stdexcept>
+
+namespace {
+
+struct Allowed {
+  const char *name;
+  unsigned params; // Fixed parameters; a variadic function takes more after them
+  bool variadic;
+};
+
+const Allowed kAllowed[] = {
+  {"putchar", 1, false}, {"getchar", 0, false}, {"puts", 1, false},   {"printf", 1, true},
+  {"malloc", 1, false},  {"calloc", 2, false},  {"realloc", 2, false}, {"free", 1, false},
+  {"strlen", 1, false},  {"strcmp", 2, false},  {"strncmp", 3, false}, {"strcpy", 2, false},
+  {"memcmp", 3, false},  {"atoi", 1, false},    {"atol", 1, false},    {"abs", 1, false},
+  {"labs", 1, false},    {"llabs", 1, false},   {"rand", 0, false},    {"srand", 1, false},
+};
+
+bool isScalar(const llvm::Type *T) {
+  return T->isIntegerTy() || T->isPointerTy();
+}
+
+} // namespace
+
+bool HostFunctions::isAllowed(const llvm::Function &F) {
+  if (!F.isDeclaration() || F.isIntrinsic() || !F.hasName()) {
+    return false;
+  }
+  for (const Allowed &A : kAllowed) {
+    if (F.getName() != A.name) {
+      continue;
+    }
+    if (F.arg_size() != A.params || F.isVarArg() != A.variadic) {
+      return false;
+    }
+    for (const llvm::Argument &Arg : F.args()) {
+      if (!isScalar(Arg.getType())) {
+        return false;
+      }
+    }
+    return F.getReturnType()->isVoidTy() || isScalar(F.getReturnType());
+  }
+  return false;
+}
+
+void *HostFunctions::resolve(const llvm::Function &F) {
+  void *address = dlsym(RTLD_DEFAULT, F.getName().str().c_str());
+  if (!address) {
+    throw std::runtime_error("Host function " + F.getName().str() + " not found.");
+  }
+  return address;
+}
+
+HostFunctions::HostCall HostFunctions::describe(const llvm::CallInst &CI) {
+  HostCall site;
+  const llvm::Function *F = CI.getCalledFunction();
+  if (!F || !isAllowed(*F) || CI.arg_size() > kMaxArgs) {
+    return site;
+  }
+  site.address = dlsym(RTLD_DEFAULT, F->getName().str().c_str());
+  site.num_args = CI.arg_size();
+  site.variadic = F->isVarArg();
+  llvm::Type *T = F->getReturnType();
+  site.result_bits = T->isVoidTy() ? 0 : T->isIntegerTy() ? T->getIntegerBitWidth() : 64;
+  return site;
+}
+
+int64_t HostFunctions::call(const HostCall &Site, const int64_t *Args) {
+  using V = int64_t (*)(int64_t, ...);
+  void *Fn = Site.address;
+  const int64_t *a = Args;
+  int64_t ret;
+  // A variadic function is called as one, so that the caller sets up what
+  // the ABI asks of it; every argument is a 64-bit integer in a register.
+  if (Site.variadic) {
+    switch (Site.num_args) {
+    case 1: ret = reinterpret_cast<V>(Fn)(a[0]); break;
+    case 2: ret = reinterpret_cast<V>(Fn)(a[0], a[1]); break;
+    case 3: ret = reinterpret_cast<V>(Fn)(a[0], a[1], a[2]); break;
+    case 4: ret = reinterpret_cast<V>(Fn)(a[0], a[1], a[2], a[3]); break;
+    case 5: ret = reinterpret_cast<V>(Fn)(a[0], a[1], a[2], a[3], a[4]); break;
+    case 6: ret = reinterpret_cast<V>(Fn)(a[0], a[1], a[2], a[3], a[4], a[5]); break;
+    case 7: ret = reinterpret_cast<V>(Fn)(a[0], a[1], a[2], a[3], a[4], a[5], a[6]); break;
+    default: ret = reinterpret_cast<V>(Fn)(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7]); break;
+    }
+  } else {
+    switch (Site.num_args) {
+    case 0: ret = reinterpret_cast<int64_t (*)()>(Fn)(); break;
+    case 1: ret = reinterpret_cast<int64_t (*)(int64_t)>(Fn)(a[0]); break;
+    case 2: ret = reinterpret_cast<int64_t (*)(int64_t, int64_t)>(Fn)(a[0], a[1]); break;
+    default: ret = reinterpret_cast<int64_t (*)(int64_t, int64_t, int64_t)>(Fn)(a[0], a[1], a[2]); break;
+    }
+  }
+  // Results narrower than 64 bits come back with the upper bits undefined.
+  switch (Site.result_bits) {
+  case 0: return 0;
+  case 1: return ret & 1;
+  case 64: return ret;
+  default: {
+    unsigned shift = 64 - Site.result_bits;
+    return static_cast<int64_t>(static_cast<uint64_t>(ret) << shift) >> shift;
+  }
+  }
+}
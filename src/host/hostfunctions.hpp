@@ -0,0 +1,42 @@
+#ifndef HOSTFUNCTIONS_HPP
+#define HOSTFUNCTIONS_HPP
+
+#include "../util/util.hpp"
+
+/// C library functions a module may declare and call: I/O, heap, string and
+/// integer routines on a fixed allow-list, found in the running process with
+/// dlsym().  Everything else that is only declared stays an error to call.
+/// The runner holds every value as a 64-bit integer, so only functions whose
+/// parameters and result are integers or pointers are on the list; libm's
+/// double routines are not.
+class HostFunctions {
+public:
+  /// Arguments a call may pass, all in registers on RISC-V.
+  static constexpr unsigned kMaxArgs = 8;
+
+  /// How one call site calls its host function, decided once.
+  struct HostCall {
+    void *address = nullptr;  // Null if the site calls no host function
+    unsigned num_args = 0;    // Passed at this site, variadic ones included
+    bool variadic = false;
+    unsigned result_bits = 0; // Width the result is extended from; 0 for void
+  };
+
+  /// Whether F declares an allowed function with the parameters the C
+  /// library's has.
+  static bool isAllowed(const llvm::Function &F);
+
+  /// Address of allowed F in this process.  Throws if it is not there.
+  static void *resolve(const llvm::Function &F);
+
+  /// The host call CI makes, resolved; its address is null if CI calls no
+  /// allowed function, passes it more than kMaxArgs arguments, or the
+  /// function is not in this process.
+  static HostCall describe(const llvm::CallInst &CI);
+
+  /// Make Site's call with its num_args arguments.  The result is extended
+  /// as the runner holds the return type, and 0 for void.
+  static int64_t call(const HostCall &Site, const int64_t *Args);
+};
+
+#endif // HOSTFUNCTIONS_HPP
@@ -0,0 +1,67 @@
+#ifndef CODEARENA_HPP
+#define CODEARENA_HPP
+
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+
+/// Bump allocator for generated code.  Carves executable memory out of large
+/// mappings instead of mapping a page per block.  Not thread-safe: every
+/// compiling thread owns its own arena.
+class CodeArena {
+public:
+  CodeArena() = default;
+
+  CodeArena(const CodeArena &) = delete;
+
+  CodeArena &operator=(const CodeArena &) = delete;
+
+  ~CodeArena() {
+    for (auto &chunk : chunks) {
+      munmap(chunk.first, chunk.second);
+    }
+  }
+
+  /// Copy Size bytes of code into the arena and return their new address.
+  void *emit(const unsigned char *Code, size_t Size) {
+    size_t aligned = (Size + kAlign - 1) & ~(kAlign - 1);
+    if (cur + aligned > end) {
+      size_t chunk_size = aligned > kChunkSize ? aligned : kChunkSize;
+      void *mem = mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_ANON | MAP_PRIVATE, -1, 0);
+      if (mem == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate executable memory: " + std::string(strerror(errno)));
+      }
+      chunks.emplace_back(mem, chunk_size);
+      mapped_bytes.fetch_add(chunk_size, std::memory_order_relaxed);
+      cur = static_cast<char *>(mem);
+      end = cur + chunk_size;
+    }
+    char *dst = cur;
+    std::memcpy(dst, Code, Size);
+    // The code may be published to and run by another thread.
+    __builtin___clear_cache(dst, dst + Size);
+    cur += aligned;
+    used_bytes.fetch_add(Size, std::memory_order_relaxed);
+    return dst;
+  }
+
+  /// The counters may be read from any thread.
+  size_t usedBytes() const { return used_bytes.load(std::memory_order_relaxed); }
+
+  size_t mappedBytes() const { return mapped_bytes.load(std::memory_order_relaxed); }
+
+private:
+  static constexpr size_t kAlign = 16;
+  static constexpr size_t kChunkSize = 256 * 1024;
+
+  std::vector<std::pair<void *, size_t>> chunks;
+  char *cur = nullptr;
+  char *end = nullptr;
+  std::atomic<size_t> used_bytes{0};
+  std::atomic<size_t> mapped_bytes{0};
+};
+
+#endif // CODEARENA_HPP
@@ -0,0 +1,73 @@
+#ifndef COMPILEQUEUE_HPP
+#define COMPILEQUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/// Bounded multi-producer/single-consumer ring buffer.  Execution threads push
+/// compile requests and the compiler thread pops them; nobody ever blocks or
+/// takes a lock.  Every cell carries a sequence number telling producers and
+/// the consumer whose turn it is (Vyukov's bounded queue).
+template <typename T, size_t Capacity>
+class CompileQueue {
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+  CompileQueue() {
+    for (size_t i = 0; i < Capacity; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  /// Returns false if the queue is full.  Safe to call from any thread.
+  bool push(const T &Item) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    for (;;) {
+      Cell &cell = cells_[pos & (Capacity - 1)];
+      intptr_t diff = (intptr_t)cell.seq.load(std::memory_order_acquire) - (intptr_t)pos;
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.item = Item;
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  /// Returns false if the queue is empty.  Only called by the consumer.
+  bool pop(T &Item) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Cell &cell = cells_[pos & (Capacity - 1)];
+    if (cell.seq.load(std::memory_order_acquire) != pos + 1) {
+      return false;
+    }
+    Item = cell.item;
+    cell.seq.store(pos + Capacity, std::memory_order_release);
+    head_.store(pos + 1, std::memory_order_relaxed);
+    return true;
+  }
+
+  /// Only called by the consumer.
+  bool empty() const {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    return cells_[pos & (Capacity - 1)].seq.load(std::memory_order_acquire) != pos + 1;
+  }
+
+private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    T item;
+  };
+
+  Cell cells_[Capacity];
+  alignas(64) std::atomic<size_t> head_{0};
+  alignas(64) std::atomic<size_t> tail_{0};
+};
+
+#endif // COMPILEQUEUE_HPP
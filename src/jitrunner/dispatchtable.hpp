@@ -0,0 +1,74 @@
+#ifndef DISPATCHTABLE_HPP
+#define DISPATCHTABLE_HPP
+
+#include <array>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace llvm {
+class BasicBlock;
+}
+
+/// Per-block state shared by every thread running a module, split into
+/// independently locked shards so that threads entering different blocks do
+/// not contend.  Entries are never removed and never move, so a reference
+/// obtained once can be used without the lock afterwards.  Other IR objects
+/// than blocks may key the same kind of table.
+template <typename Entry, typename Key = llvm::BasicBlock>
+class DispatchTable {
+public:
+  /// Find the entry of BB, creating it on first use.
+  Entry &get(const Key *BB) {
+    Shard &shard = shardFor(BB);
+    {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      auto it = shard.map.find(BB);
+      if (it != shard.map.end()) {
+        return *it->second;
+      }
+    }
+    std::unique_lock<std::shared_mutex> lock(shard.mutex);
+    auto &slot = shard.map[BB];
+    if (!slot) {
+      slot = std::make_unique<Entry>();
+    }
+    return *slot;
+  }
+
+  /// Find the entry of BB, or null if it has none yet.
+  Entry *find(const Key *BB) {
+    Shard &shard = shardFor(BB);
+    std::shared_lock<std::shared_mutex> lock(shard.mutex);
+    auto it = shard.map.find(BB);
+    return it == shard.map.end() ? nullptr : it->second.get();
+  }
+
+  /// Call Fn(block, entry) for every entry.
+  template <typename Fn>
+  void forEach(Fn &&F) {
+    for (Shard &shard : shards) {
+      std::shared_lock<std::shared_mutex> lock(shard.mutex);
+      for (auto &it : shard.map) {
+        F(it.first, *it.second);
+      }
+    }
+  }
+
+private:
+  static constexpr size_t kShards = 16;
+
+  struct Shard {
+    std::shared_mutex mutex;
+    std::unordered_map<const Key *, std::unique_ptr<Entry>> map;
+  };
+
+  Shard &shardFor(const Key *BB) {
+    return shards[(reinterpret_cast<uintptr_t>(BB) >> 6) % kShards];
+  }
+
+  std::array<Shard, kShards> shards;
+};
+
+#endif // DISPATCHTABLE_HPP
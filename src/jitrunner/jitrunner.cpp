@@ -3,12 +3,473 @@
 #include "../asm/asmcmd.hpp"
 #include "../asm/asmstruct.hpp"
 #include "../asm/asmdata.hpp"
+#include "../cache/codecache.hpp"
+#include "../perf/perfregistry.hpp"
+#include "../cpu/cpufeatures.hpp"
+#include <llvm/ADT/MapVector.h>
+#include <llvm/IR/CFG.h>
 
 // -------- Helpers ---------
 static inline int64_t asInt(const llvm::APInt &A) { return A.getSExtValue(); }
 
-JITRunner::JITRunner(llvm::Module &M)
-  : module(M), data_layout(M.getDataLayout()) {
+// Memory holds values at their store size; in registers and slots they are
+// sign-extended to 64 bits, as the lb/lh/lw of compiled code leave them.
+static int64_t loadMemory(int64_t Ptr, uint64_t Bytes) {
+  switch (Bytes) {
+  case 1: return *reinterpret_cast<int8_t *>(Ptr);
+  case 2: return *reinterpret_cast<int16_t *>(Ptr);
+  case 4: return *reinterpret_cast<int32_t *>(Ptr);
+  case 8: return *reinterpret_cast<int64_t *>(Ptr);
+  default: throw std::runtime_error("Unsupported load width.");
+  }
+}
+
+static void storeMemory(int64_t Ptr, uint64_t Bytes, int64_t Value) {
+  switch (Bytes) {
+  case 1: *reinterpret_cast<int8_t *>(Ptr) = (int8_t)Value; break;
+  case 2: *reinterpret_cast<int16_t *>(Ptr) = (int16_t)Value; break;
+  case 4: *reinterpret_cast<int32_t *>(Ptr) = (int32_t)Value; break;
+  case 8: *reinterpret_cast<int64_t *>(Ptr) = Value; break;
+  default: throw std::runtime_error("Unsupported store width.");
+  }
+}
+
+// Operands the compiler specializes on when they keep one value: divisors,
+// array indices, and the bound a self-loop's exit compares against.
+static bool isSpeculated(const llvm::Use &U) {
+  if (llvm::isa<llvm::Constant>(U.get())) {
+    return false;
+  }
+  auto* I = llvm::cast<llvm::Instruction>(U.getUser());
+  switch (I->getOpcode()) {
+  case llvm::Instruction::SDiv:
+  case llvm::Instruction::SRem:
+    return U.getOperandNo() == 1;
+  case llvm::Instruction::GetElementPtr:
+    return U.getOperandNo() >= 1;
+  case llvm::Instruction::ICmp: {
+    auto* BI = llvm::dyn_cast<llvm::BranchInst>(I->getParent()->getTerminator());
+    return U.getOperandNo() == 1 && BI && BI->isConditional() && BI->getCondition() == I &&
+           (BI->getSuccessor(0) == I->getParent() || BI->getSuccessor(1) == I->getParent());
+  }
+  default:
+    return false;
+  }
+}
+
+// A call compiled code makes itself, to a C library function HostFunctions
+// allows, is described once per call site.
+const HostFunctions::HostCall* JITRunner::hostCall(const llvm::Instruction &I) {
+  auto* CI = llvm::dyn_cast<llvm::CallInst>(&I);
+  if (!CI || !CI->getCalledFunction() || !CI->getCalledFunction()->isDeclaration() ||
+      CI->getCalledFunction()->isIntrinsic()) {
+    return nullptr;
+  }
+  HostCallSite &site = host_calls.get(CI);
+  std::call_once(site.once, [&] { site.call = HostFunctions::describe(*CI); });
+  return site.call.address ? &site.call : nullptr;
+}
+
+// A call that ends a segment of compiled code, to a function the runner
+// executes.
+bool JITRunner::splitsCode(const llvm::Instruction &I) {
+  return llvm::isa<llvm::CallInst>(I) && !llvm::isa<llvm::MemIntrinsic>(I) && !asmcode::AsmBlock::isMinMax(&I) &&
+         !hostCall(I);
+}
+
+// Whether BB can be compiled into the middle of a superblock: calls split
+// code and allocas outlive it.
+bool JITRunner::isMergeable(const llvm::BasicBlock &BB) {
+  if (std::distance(BB.phis().begin(), BB.phis().end()) > asmcode::AsmBlock::kMaxEdgeCopies) {
+    return false;
+  }
+  for (const llvm::Instruction &I : BB) {
+    if (llvm::isa<llvm::AllocaInst>(I) || splitsCode(I)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Whether the superblock headed by BB can run as a loop: its last block
+// branches back to BB, nothing in it splits the code, and nothing outside
+// enters it but through BB, which so dominates the rest.
+bool JITRunner::closesLoop(llvm::BasicBlock* BB, const std::vector<llvm::BasicBlock*> &Trace) {
+  auto* BI = llvm::dyn_cast<llvm::BranchInst>((Trace.empty() ? BB : Trace.back())->getTerminator());
+  if (!BI || !llvm::is_contained(BI->successors(), BB) || !isMergeable(*BB)) {
+    return false;
+  }
+  for (llvm::BasicBlock* Traced : Trace) {
+    for (llvm::BasicBlock* Pred : llvm::predecessors(Traced)) {
+      if (Pred != BB && !llvm::is_contained(Trace, Pred)) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+// Bytes the address of GEP moves per unit of its operand OpNo, walking the
+// types as AsmBlock::addGetElementPtr() does; 0 for a struct field.
+static int64_t indexScale(llvm::GetElementPtrInst* GEP, unsigned OpNo, const llvm::DataLayout &DL) {
+  llvm::Type* curTy = GEP->getSourceElementType();
+  if (OpNo == 1) {
+    return DL.getTypeAllocSize(curTy);
+  }
+  for (unsigned i = 2; i <= OpNo; ++i) {
+    if (auto* STy = llvm::dyn_cast<llvm::StructType>(curTy)) {
+      auto* Field = llvm::dyn_cast<llvm::ConstantInt>(GEP->getOperand(i));
+      if (i == OpNo || !Field) {
+        return 0;
+      }
+      curTy = STy->getElementType(Field->getZExtValue());
+    } else if (auto* ATy = llvm::dyn_cast<llvm::ArrayType>(curTy)) {
+      curTy = ATy->getElementType();
+      if (i == OpNo) {
+        return DL.getTypeAllocSize(curTy);
+      }
+    } else {
+      return 0;
+    }
+  }
+  return 0;
+}
+
+// What a loop compiled by planLoop() computes before its first lap instead
+// of in every one.
+struct LoopPlan {
+  std::vector<llvm::Instruction*> hoisted; // Invariant, in program order
+  std::vector<std::pair<llvm::Value*, int64_t>> reduced; // GEPs of induction variables, and their step per lap
+  std::unordered_set<const llvm::Instruction*> moved; // Both, left out of the body
+};
+
+// Blocks is a loop headed by its first block, its last one branching back.
+// Arithmetic, GEPs and selects of values from outside the loop are hoisted
+// out of it, and so are loads from the head when nothing in the loop writes
+// memory.  A GEP of induction variables, phis of the head that the back
+// edge advances by a constant, and otherwise of invariants instead starts
+// at its first address and steps by a constant at the back edge.
+static LoopPlan planLoop(const std::vector<llvm::BasicBlock*> &Blocks, const llvm::DataLayout &DL) {
+  LoopPlan plan;
+  std::unordered_set<const llvm::BasicBlock*> body(Blocks.begin(), Blocks.end());
+  auto invariant = [&](llvm::Value* V) {
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    return !I || !body.count(I->getParent()) || plan.moved.count(I);
+  };
+  // Step of an induction variable per lap.
+  auto stepOf = [&](llvm::Value* V, int64_t &Step) {
+    auto* PN = llvm::dyn_cast<llvm::PHINode>(V);
+    if (!PN || PN->getParent() != Blocks.front() || PN->getBasicBlockIndex(Blocks.back()) < 0) {
+      return false;
+    }
+    auto* Inc = llvm::dyn_cast<llvm::BinaryOperator>(PN->getIncomingValueForBlock(Blocks.back()));
+    if (!Inc || Inc->getOpcode() != llvm::Instruction::Add) {
+      return false;
+    }
+    auto* C = llvm::dyn_cast<llvm::ConstantInt>(Inc->getOperand(Inc->getOperand(0) == PN ? 1 : 0));
+    if (!C || (Inc->getOperand(0) != PN && Inc->getOperand(1) != PN)) {
+      return false;
+    }
+    Step = C->getSExtValue();
+    return true;
+  };
+
+  bool writes = false;
+  for (llvm::BasicBlock* BB : Blocks) {
+    for (llvm::Instruction &I : *BB) {
+      // Calls left in a loop are to memory routines, min/max and host
+      // functions; any but min/max may write memory.
+      writes |= llvm::isa<llvm::StoreInst>(I) || (llvm::isa<llvm::CallInst>(I) && !asmcode::AsmBlock::isMinMax(&I));
+    }
+  }
+  for (llvm::BasicBlock* BB : Blocks) {
+    for (llvm::Instruction &I : *BB) {
+      bool hoistable = false;
+      switch (I.getOpcode()) {
+      case llvm::Instruction::Add:
+      case llvm::Instruction::Sub:
+      case llvm::Instruction::Mul:
+      case llvm::Instruction::ICmp:
+      case llvm::Instruction::GetElementPtr:
+      case llvm::Instruction::BitCast:
+      case llvm::Instruction::Select:
+        hoistable = true;
+        break;
+      case llvm::Instruction::Load:
+        // The head runs on every lap, so the load was going to happen.
+        hoistable = !writes && BB == Blocks.front();
+        break;
+      default:
+        break;
+      }
+      if (hoistable && llvm::all_of(I.operands(), [&](llvm::Use &U) { return invariant(U.get()); })) {
+        plan.hoisted.push_back(&I);
+        plan.moved.insert(&I);
+      }
+    }
+  }
+  for (llvm::BasicBlock* BB : Blocks) {
+    for (llvm::Instruction &I : *BB) {
+      auto* GEP = llvm::dyn_cast<llvm::GetElementPtrInst>(&I);
+      if (!GEP || plan.moved.count(GEP) || !invariant(GEP->getPointerOperand())) {
+        continue;
+      }
+      int64_t step = 0;
+      bool reducible = true;
+      for (unsigned i = 1; i < GEP->getNumOperands() && reducible; ++i) {
+        int64_t inc, scale;
+        if (invariant(GEP->getOperand(i))) {
+          continue;
+        }
+        reducible = (scale = indexScale(GEP, i, DL)) && stepOf(GEP->getOperand(i), inc);
+        if (reducible) {
+          step += inc * scale;
+        }
+      }
+      if (reducible) {
+        plan.reduced.emplace_back(GEP, step);
+      }
+    }
+  }
+  for (auto &reduced : plan.reduced) {
+    plan.moved.insert(llvm::cast<llvm::Instruction>(reduced.first));
+  }
+  return plan;
+}
+
+// A scalar of an alloca whose address never escapes: Width bytes at
+// Offset, which every access reaches through one of Pointers.
+struct AllocaCell {
+  llvm::AllocaInst* alloca;
+  int64_t offset;
+  unsigned width;
+  std::vector<llvm::Value*> pointers; // The alloca itself or constant GEPs of it
+  unsigned uses = 0;                  // Accesses in the code being compiled
+  bool stores = false;
+};
+
+// Escape analysis: the scalars of A if every use of it is a load or a
+// store through it, or a GEP with constant indices used only so, and no
+// two accesses overlap without being the same.  Empty otherwise.
+static std::vector<AllocaCell> allocaCells(llvm::AllocaInst* A, const llvm::DataLayout &DL) {
+  std::vector<AllocaCell> cells;
+  auto access = [&](llvm::Value* Ptr, llvm::User* U, int64_t Offset) {
+    llvm::Type* T;
+    if (auto* LI = llvm::dyn_cast<llvm::LoadInst>(U)) {
+      T = LI->getType();
+      if (LI->isVolatile()) {
+        return false;
+      }
+    } else if (auto* SI = llvm::dyn_cast<llvm::StoreInst>(U)) {
+      T = SI->getValueOperand()->getType();
+      if (SI->isVolatile() || SI->getValueOperand() == Ptr) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    uint64_t width = DL.getTypeStoreSize(T);
+    if (!(T->isIntegerTy() || T->isPointerTy()) || (width != 1 && width != 2 && width != 4 && width != 8) ||
+        Offset < 0 || Offset + width > 2048) {
+      return false;
+    }
+    for (AllocaCell &cell : cells) {
+      if (cell.offset == Offset && cell.width == width) {
+        if (!llvm::is_contained(cell.pointers, Ptr)) {
+          cell.pointers.push_back(Ptr);
+        }
+        return true;
+      }
+      if (Offset < cell.offset + cell.width && cell.offset < Offset + (int64_t)width) {
+        return false;
+      }
+    }
+    cells.push_back({A, Offset, (unsigned)width, {Ptr}});
+    return true;
+  };
+  for (llvm::User* U : A->users()) {
+    auto* GEP = llvm::dyn_cast<llvm::GetElementPtrInst>(U);
+    if (!GEP) {
+      if (!access(A, U, 0)) {
+        return {};
+      }
+      continue;
+    }
+    llvm::APInt offset(DL.getIndexTypeSizeInBits(GEP->getType()), 0);
+    if (GEP->getPointerOperand() != A || !GEP->accumulateConstantOffset(DL, offset)) {
+      return {};
+    }
+    for (llvm::User* GU : GEP->users()) {
+      if (!access(GEP, GU, offset.getSExtValue())) {
+        return {};
+      }
+    }
+  }
+  return cells;
+}
+
+JITRunner::JITRunner(llvm::Module &M, const JITOptions &Opts)
+  : module(M), data_segment(M), threshold(Opts.threshold), sample_out(Opts.sample_out), sample_counters(Opts.sample_counters),
+    profile_out(Opts.profile_out), vectorize(Opts.vectorize), compress(Opts.compress), superblocks(Opts.superblocks), speculate(Opts.speculate), native_loops(Opts.loops), promote_scalars(Opts.scalars), async_compile(Opts.async_compile),
+    aot(Opts.aot), aot_threads(Opts.aot_threads), sync_compiler(M.getDataLayout()),
+    background_compiler(M.getDataLayout()), collect_stats(Opts.collect_stats) {
+  collect_profile = !profile_out.empty();
+  if (Opts.perf_map || Opts.perf_jitdump) {
+    perf = std::make_unique<PerfRegistry>(Opts.perf_map, Opts.perf_jitdump);
+  }
+  if (!sample_out.empty()) {
+    sampler = std::make_unique<Sampler>(Opts.sample_hz);
+  }
+  CPUFeatures cpu = CPUFeatures::detect();
+  cpu.apply(Opts.extensions);
+  zbb = cpu.zbb;
+  zicond = cpu.zicond;
+  if (vectorize && !cpu.v) {
+    fprintf(stderr, "warning: the CPU has no vector extension; loops are not vectorized\n");
+    vectorize = false;
+  }
+  compress = compress && cpu.c;
+  if (async_compile) {
+    compiler_thread = std::thread(&JITRunner::compileLoop, this);
+  }
+  // Reading the profile materializes the functions it names, so it comes
+  // before the cache is consulted for every function with a body in memory.
+  // Functions of a lazily loaded module that are still on disk are looked up
+  // when they are first materialized.
+  if (!Opts.profile_in.empty()) {
+    profile.read(Opts.profile_in, module);
+  }
+  if (!Opts.cache_dir.empty()) {
+    // Code is only reused where the same instructions may be emitted.
+    std::string target = compress ? "c" : "";
+    for (auto [name, used] : {std::make_pair(",v", vectorize), std::make_pair(",zbb", zbb), std::make_pair(",zicond", zicond)}) {
+      if (used) {
+        target += name;
+      }
+    }
+    code_cache = std::make_unique<CodeCache>(Opts.cache_dir, M, target);
+    for (llvm::Function &F : module) {
+      if (!F.isDeclaration() && !F.isMaterializable()) {
+        loadCachedFunction(F);
+      }
+    }
+  }
+  if (!Opts.profile_in.empty()) {
+    warmUp();
+  }
+}
+
+JITRunner::~JITRunner() {
+  if (compiler_thread.joinable()) {
+    stop_compiler.store(true, std::memory_order_release);
+    compiler_cv.notify_one();
+    compiler_thread.join();
+  }
+  for (BasicBlockExecutor* Exec : retired) {
+    deleteExecutor(Exec);
+  }
+}
+
+void JITRunner::materializeFunction(llvm::Function &F) {
+  if (llvm::Error E = F.materialize()) {
+    throw std::runtime_error("Failed to materialize " + F.getName().str() + ": " + llvm::toString(std::move(E)));
+  }
+  if (code_cache) {
+    loadCachedFunction(F);
+  }
+}
+
+void JITRunner::ensureMaterialized(ExecContext &Ctx, llvm::Function &F) {
+  if (Ctx.ready_functions.count(&F)) {
+    return;
+  }
+  // The module is shared: only one thread may read a body in from disk, and
+  // nobody may look at a function while that happens.
+  std::lock_guard<std::mutex> lock(module_mutex);
+  if (F.isMaterializable()) {
+    materializeFunction(F);
+  }
+  Ctx.ready_functions.insert(&F);
+}
+
+void JITRunner::compileAheadOfTime() {
+  // Bodies are materialized here, on one thread, before any worker reads them.
+  std::vector<llvm::Function*> functions;
+  {
+    std::lock_guard<std::mutex> lock(module_mutex);
+    for (llvm::Function &F : module) {
+      if (F.isMaterializable()) {
+        materializeFunction(F);
+      }
+      if (!F.isDeclaration()) {
+        functions.push_back(&F);
+      }
+    }
+  }
+  if (functions.empty()) {
+    return;
+  }
+
+  unsigned num_threads = aot_threads ? aot_threads : std::max(1u, std::thread::hardware_concurrency());
+  num_threads = std::min<size_t>(num_threads, functions.size());
+
+  // One task per function.  Workers claim functions through a shared counter,
+  // compile with their own state and report back through per-function slots;
+  // the dispatch table is only updated once all of them have joined.
+  using Clock = std::chrono::steady_clock;
+  std::vector<std::vector<std::pair<llvm::BasicBlock*, BasicBlockExecutor*>>> compiled(functions.size());
+  std::vector<Clock::duration> task_time(functions.size());
+  std::atomic<size_t> next_function{0};
+  auto worker = [&](CompilerState &State) {
+    for (size_t i = next_function++; i < functions.size(); i = next_function++) {
+      Clock::time_point start = Clock::now();
+      for (llvm::BasicBlock &BB : *functions[i]) {
+        DispatchEntry *entry = fn_map.find(&BB);
+        if (entry && entry->exec.load(std::memory_order_relaxed)) {
+          continue; // Already mapped in from the code cache
+        }
+        if (BasicBlockExecutor* BBExec = compileBlock(&BB, State)) {
+          compiled[i].emplace_back(&BB, BBExec);
+        }
+      }
+      task_time[i] = Clock::now() - start;
+    }
+  };
+
+  Clock::time_point start = Clock::now();
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < num_threads; ++t) {
+    aot_compilers.push_back(std::make_unique<CompilerState>(module.getDataLayout()));
+    threads.emplace_back(worker, std::ref(*aot_compilers.back()));
+  }
+  for (std::thread &T : threads) {
+    T.join();
+  }
+  double wall_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+  aot_ms = wall_ms;
+
+  size_t num_blocks = 0;
+  double serial_ms = 0;
+  for (size_t i = 0; i < functions.size(); ++i) {
+    for (auto &it : compiled[i]) {
+      DispatchEntry &entry = fn_map.get(it.first);
+      entry.requested.store(true, std::memory_order_relaxed);
+      entry.exec.store(it.second, std::memory_order_release);
+    }
+    if (!compiled[i].empty()) {
+      std::lock_guard<std::mutex> lock(cache_mutex);
+      dirty_functions.insert(functions[i]);
+    }
+    num_blocks += compiled[i].size();
+    serial_ms += std::chrono::duration<double, std::milli>(task_time[i]).count();
+  }
+
+  if (collect_stats) {
+    fprintf(stderr, "AOT: compiled %zu blocks in %zu functions on %u thread%s in %.2f ms "
+            "(%.2f ms of compile work, %.2fx speedup)\n",
+            num_blocks, functions.size(), num_threads, num_threads == 1 ? "" : "s", wall_ms, serial_ms,
+            wall_ms > 0 ? serial_ms / wall_ms : 1.0);
+  }
 }
 
 int64_t JITRunner::runModule() {
@@ -19,34 +480,489 @@ int64_t JITRunner::runModule() {
   if (!Main->arg_empty()) {
     throw std::runtime_error("main() with arguments not supported.");
   }
-  return execFunction(Main, {});
+  int64_t ret = run(Main, {});
+  flush();
+  return ret;
+}
+
+int64_t JITRunner::run(llvm::Function *F, const std::vector<int64_t> &Args) {
+  {
+    std::lock_guard<std::mutex> lock(module_mutex);
+    if (F->isDeclaration()) {
+      throw std::runtime_error("Cannot run external function " + F->getName().str() + ".");
+    }
+  }
+  if (Args.size() != F->arg_size()) {
+    throw std::runtime_error("Wrong number of arguments passed to " + F->getName().str() + ".");
+  }
+  if (aot) {
+    std::call_once(aot_once, &JITRunner::compileAheadOfTime, this);
+  }
+  std::unique_ptr<ExecContext> Ctx = acquireContext();
+  if (sampler) {
+    Sampler::setCurrentStack(&Ctx->shadow);
+  }
+  {
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    ++active_runs;
+  }
+  // Executors dropped during a run may still be on some thread's stack
+  // until every run that could have entered them is over.
+  auto endRun = [this] {
+    std::vector<BasicBlockExecutor*> dropped;
+    {
+      std::lock_guard<std::mutex> lock(retired_mutex);
+      if (--active_runs == 0) {
+        dropped.swap(retired);
+      }
+    }
+    for (BasicBlockExecutor* Exec : dropped) {
+      deleteExecutor(Exec);
+    }
+  };
+  int64_t ret;
+  try {
+    ret = execFunction(*Ctx, F, Args);
+  } catch (...) {
+    Sampler::setCurrentStack(nullptr);
+    endRun();
+    throw;
+  }
+  Sampler::setCurrentStack(nullptr);
+  endRun();
+  releaseContext(std::move(Ctx));
+  return ret;
+}
+
+void JITRunner::retireExecutor(BasicBlockExecutor* Exec) {
+  std::lock_guard<std::mutex> lock(retired_mutex);
+  retired.push_back(Exec);
+}
+
+void JITRunner::deleteExecutor(BasicBlockExecutor* Exec) {
+  while (Exec) {
+    BasicBlockExecutor* next = Exec->next_segment;
+    deleteExecutor(Exec->scalar);
+    delete Exec;
+    Exec = next;
+  }
+}
+
+std::unique_ptr<JITRunner::ExecContext> JITRunner::acquireContext() {
+  {
+    std::lock_guard<std::mutex> lock(context_mutex);
+    if (!idle_contexts.empty()) {
+      std::unique_ptr<ExecContext> Ctx = std::move(idle_contexts.back());
+      idle_contexts.pop_back();
+      return Ctx;
+    }
+  }
+  return std::make_unique<ExecContext>(module.getDataLayout(), data_segment);
+}
+
+void JITRunner::releaseContext(std::unique_ptr<ExecContext> Ctx) {
+  if (collect_profile) {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    for (auto &it : Ctx->edges) {
+      profile.edges[it.first] += it.second;
+    }
+    for (auto &it : Ctx->calls) {
+      profile.calls[it.first] += it.second;
+    }
+  }
+  Ctx->edges.clear();
+  Ctx->calls.clear();
+  if (sampler) {
+    for (auto &it : Ctx->native_counters) {
+      sampler->addNativeCounters(it.first, it.second.first, it.second.second);
+    }
+    Ctx->native_counters.clear();
+  }
+  // Compiled code, dispatch lookups and counters stay warm; only what the
+  // program itself can observe starts over.  Globals keep their addresses.
+  Ctx->data.reset();
+  Ctx->stack_arena.reset();
+  std::lock_guard<std::mutex> lock(context_mutex);
+  idle_contexts.push_back(std::move(Ctx));
+}
+
+void JITRunner::flush() {
+  saveCodeCache();
+  if (sampler) {
+    sampler->writeReport(sample_out);
+  }
+  if (collect_profile) {
+    std::lock_guard<std::mutex> lock(profile_mutex);
+    fn_map.forEach([this](const llvm::BasicBlock *BB, DispatchEntry &Entry) {
+      unsigned long long count = Entry.count.load(std::memory_order_relaxed);
+      if (count) {
+        profile.blocks[BB] = count;
+      }
+    });
+    profile.write(profile_out);
+  }
+}
+
+JITStats JITRunner::stats() {
+  JITStats S;
+  S.blocks_compiled = blocks_compiled.load(std::memory_order_relaxed);
+  S.compile_ms = compileMillis();
+  S.code_bytes = code_bytes.load(std::memory_order_relaxed);
+  S.compiled_ir_instructions = compiled_ir_instructions.load(std::memory_order_relaxed);
+  S.loops_vectorized = loops_vectorized.load(std::memory_order_relaxed);
+  S.blocks_merged = blocks_merged.load(std::memory_order_relaxed);
+  S.guards = guards.load(std::memory_order_relaxed);
+  S.deopts = deopts.load(std::memory_order_relaxed);
+  S.loops_unrolled = loops_unrolled.load(std::memory_order_relaxed);
+  S.loops_compiled = loops_compiled.load(std::memory_order_relaxed);
+  S.invariants_hoisted = invariants_hoisted.load(std::memory_order_relaxed);
+  S.geps_reduced = geps_reduced.load(std::memory_order_relaxed);
+  S.scalars_promoted = scalars_promoted.load(std::memory_order_relaxed);
+  S.aot_ms = aot_ms;
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex);
+    S.compile_failures = compile_failures;
+    S.fallbacks = fallbacks;
+  }
+
+  S.code_used_bytes = sync_compiler.arena.usedBytes() + background_compiler.arena.usedBytes();
+  S.code_mapped_bytes = sync_compiler.arena.mappedBytes() + background_compiler.arena.mappedBytes();
+  for (auto &State : aot_compilers) {
+    S.code_used_bytes += State->arena.usedBytes();
+    S.code_mapped_bytes += State->arena.mappedBytes();
+  }
+  {
+    std::lock_guard<std::mutex> lock(context_mutex);
+    for (auto &Ctx : idle_contexts) {
+      S.stack_high_water = std::max(S.stack_high_water, Ctx->stack_arena.peak());
+    }
+  }
+
+  if (collect_stats) {
+    S.has_execution_counts = true;
+    fn_map.forEach([&S](const llvm::BasicBlock *BB, DispatchEntry &Entry) {
+      JITStats::Block B;
+      B.block = BB;
+      B.executions = Entry.count.load(std::memory_order_relaxed);
+      B.native_executions = Entry.native_count.load(std::memory_order_relaxed);
+      B.code_bytes = 0;
+      for (BasicBlockExecutor* Seg = Entry.exec.load(std::memory_order_acquire); Seg; Seg = Seg->next_segment) {
+        B.code_bytes += Seg->code_size;
+      }
+      S.native_executions += B.native_executions;
+      S.interpreted_executions += B.executions - B.native_executions;
+      if (B.executions) {
+        S.blocks.push_back(B);
+      }
+    });
+    std::sort(S.blocks.begin(), S.blocks.end(), [](const JITStats::Block &A, const JITStats::Block &B) {
+      return A.executions > B.executions;
+    });
+  }
+  return S;
+}
+
+void JITRunner::warmUp() {
+  // Resume the block counts where the profiled run left off, and compile up
+  // front every block that run found hot instead of interpreting it again.
+  // With background compilation this only queues the blocks.  Branch counts
+  // come first, as superblocks are formed from them.
+  for (auto &it : profile.edges) {
+    auto* BI = llvm::dyn_cast<llvm::BranchInst>(it.first.first->getTerminator());
+    if (BI && BI->isConditional()) {
+      DispatchEntry &entry = fn_map.get(it.first.first);
+      for (unsigned i = 0; i < 2; ++i) {
+        if (BI->getSuccessor(i) == it.first.second) {
+          entry.taken[i].store(it.second, std::memory_order_relaxed);
+        }
+      }
+    }
+  }
+  for (auto &it : profile.blocks) {
+    llvm::BasicBlock* BB = const_cast<llvm::BasicBlock*>(it.first);
+    DispatchEntry &entry = fn_map.get(BB);
+    entry.count.store(it.second, std::memory_order_relaxed);
+    if (it.second > threshold && !entry.exec.load(std::memory_order_relaxed)) {
+      requestCompile(BB, entry);
+    }
+  }
+}
+
+void JITRunner::requestCompile(llvm::BasicBlock *BB, DispatchEntry &Entry) {
+  // Several threads may cross the threshold at once; one of them wins.
+  if (Entry.requested.exchange(true, std::memory_order_acq_rel)) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex);
+    dirty_functions.insert(BB->getParent());
+  }
+  if (!async_compile) {
+    std::lock_guard<std::mutex> lock(sync_compiler_mutex);
+    Entry.exec.store(compileBlock(BB, sync_compiler), std::memory_order_release);
+    return;
+  }
+  // A full queue leaves the block unrequested; it is offered again the next
+  // time it runs.
+  if (!compile_queue.push({BB, &Entry})) {
+    Entry.requested.store(false, std::memory_order_release);
+    return;
+  }
+  compiler_cv.notify_one();
+}
+
+void JITRunner::compileLoop() {
+  CompileRequest req;
+  while (!stop_compiler.load(std::memory_order_acquire)) {
+    if (!compile_queue.pop(req)) {
+      std::unique_lock<std::mutex> lock(compiler_mutex);
+      compiler_cv.wait_for(lock, std::chrono::milliseconds(10), [this] {
+        return stop_compiler.load(std::memory_order_acquire) || !compile_queue.empty();
+      });
+      continue;
+    }
+    // A block that fails to compile leaves the entry empty, and the
+    // interpreter keeps running it.
+    req.entry->exec.store(compileBlock(req.block, background_compiler), std::memory_order_release);
+  }
 }
 
-int64_t JITRunner::execFunction(llvm::Function *F, const std::vector<int64_t> &Args) {
-  std::unordered_map<const llvm::Value *, int64_t>* old_localval_map = localval_map;
-  localval_map = new std::unordered_map<const llvm::Value *, int64_t>();
+int64_t JITRunner::execFunction(ExecContext &Ctx, llvm::Function *F, const std::vector<int64_t> &Args) {
+  ensureMaterialized(Ctx, *F);
+  if (sampler) {
+    Ctx.shadow.push(F);
+  }
+  std::unordered_map<const llvm::Value *, int64_t>* old_localval_map = Ctx.localval_map;
+  std::unordered_map<const llvm::Value *, int64_t> frame;
+  Ctx.localval_map = &frame;
+  size_t stack_mark = Ctx.stack_arena.mark();
   // Map arguments (none for now).
   for (size_t i = 0; i < Args.size(); ++i) {
     if (i >= F->arg_size()) {
       throw std::runtime_error("Too many arguments passed to function.");
     }
     llvm::Argument *Arg = &*std::next(F->arg_begin(), i);
-    localval_map->emplace(Arg, Args[i]);
+    Ctx.localval_map->emplace(Arg, Args[i]);
   }
-  // Start from the entry block
-  llvm::BasicBlock &Entry = F->getEntryBlock();
-  int64_t ret = execBasicBlock(&Entry);
-  localval_map = old_localval_map;
-  return ret;
+  // Start from the entry block and follow block exits until one returns.
+  llvm::BasicBlock* BB = &F->getEntryBlock();
+  llvm::BasicBlock* Pred = nullptr;
+  BlockExit exit = execBasicBlock(Ctx, BB, Pred);
+  while (exit.next) {
+    if (collect_profile) {
+      Ctx.edges[{exit.from ? exit.from : BB, exit.next}]++;
+    }
+    Pred = exit.from ? exit.from : BB;
+    BB = exit.next;
+    exit = execBasicBlock(Ctx, BB, Pred);
+  }
+  Ctx.stack_arena.release(stack_mark);
+  Ctx.localval_map = old_localval_map;
+  if (sampler) {
+    Ctx.shadow.pop();
+  }
+  return exit.ret;
+}
+
+JITRunner::BasicBlockExecutor* JITRunner::compileBlock(llvm::BasicBlock* BB, CompilerState &State) {
+  auto start = std::chrono::steady_clock::now();
+  BasicBlockExecutor* BBExec = nullptr;
+  std::vector<llvm::BasicBlock*> trace;
+  bool unrolled = false, loops = false;
+  if (unsigned trips = speculate ? tripCount(BB) : 0) {
+    // A small loop runs whole: a superblock of one copy of its block per
+    // iteration, every edge the back edge.
+    trace.assign(trips - 1, BB);
+    unrolled = true;
+  } else {
+    trace = formTrace(BB);
+    loops = native_loops && closesLoop(BB, trace);
+  }
+  while (!BBExec) {
+    try {
+      BBExec = constructBasicBlockExecutor(BB, BB->begin(), State, trace, loops);
+    } catch (const std::exception &e) {
+      // Something in the rest of a superblock the compiler does not take
+      // still leaves the block itself, or the superblock without its loop.
+      if (loops) {
+        loops = false;
+        continue;
+      }
+      if (!trace.empty()) {
+        trace.clear();
+        unrolled = false;
+        continue;
+      }
+      std::lock_guard<std::mutex> lock(stats_mutex);
+      ++compile_failures;
+      ++fallbacks[e.what()];
+      break;
+    }
+  }
+  if (vectorize) {
+    if (std::unique_ptr<VectorLoop> loop = VectorLoop::match(BB)) {
+      // The scalar code, if any, stays behind the vector code as its fallback.
+      BasicBlockExecutor* scalar = BBExec;
+      try {
+        BBExec = constructVectorLoopExecutor(BB, std::move(loop), State);
+        BBExec->scalar = scalar;
+        loops_vectorized.fetch_add(1, std::memory_order_relaxed);
+      } catch (const std::exception &e) {
+        std::lock_guard<std::mutex> lock(stats_mutex);
+        ++fallbacks[e.what()];
+      }
+    }
+  }
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  compile_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+  if (BBExec) {
+    size_t bytes = 0;
+    for (BasicBlockExecutor* Seg = BBExec; Seg; Seg = Seg->next_segment) {
+      bytes += Seg->code_size + (Seg->scalar ? Seg->scalar->code_size : 0);
+    }
+    size_t insts = BB->size();
+    for (llvm::BasicBlock* Traced : trace) {
+      insts += Traced->size();
+    }
+    blocks_compiled.fetch_add(1, std::memory_order_relaxed);
+    if (unrolled) {
+      loops_unrolled.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      loops_compiled.fetch_add(loops, std::memory_order_relaxed);
+      blocks_merged.fetch_add(trace.size(), std::memory_order_relaxed);
+    }
+    code_bytes.fetch_add(bytes, std::memory_order_relaxed);
+    compiled_ir_instructions.fetch_add(insts, std::memory_order_relaxed);
+  }
+  return BBExec;
 }
 
-JITRunner::BasicBlockExecutor* JITRunner::constructBasicBlockExecutor(llvm::BasicBlock* BB, llvm::BasicBlock::iterator startline) {
-  BasicBlockExecutor* BBExec = new BasicBlockExecutor();
-  asmcode::AsmBlock AB(BBExec->localval_map);
-  AB.regSave();
+// A superblock goes on from a block ending in a branch into the successor
+// it reaches unconditionally, if nothing else reaches it or nearly all of
+// its executions come from there, or into the side of a conditional branch
+// the interpreter saw taken kTraceBias of the time; the other side is a
+// side exit.  It stops before a block it already holds,
+// a block with calls or allocas, which split or outlive the code, and at
+// kMaxTraceInsts instructions.
+std::vector<llvm::BasicBlock*> JITRunner::formTrace(llvm::BasicBlock* BB) {
+  constexpr size_t kMaxTraceBlocks = 8;
+  constexpr size_t kMaxTraceInsts = 256;
+  constexpr unsigned long long kTraceMinBranches = 32;
+  constexpr double kTraceBias = 0.9;
+
+  std::vector<llvm::BasicBlock*> trace;
+  if (!superblocks) {
+    return trace;
+  }
+  size_t insts = BB->size();
+  for (llvm::BasicBlock* cur = BB; trace.size() + 1 < kMaxTraceBlocks;) {
+    auto* BI = llvm::dyn_cast<llvm::BranchInst>(cur->getTerminator());
+    if (!BI) {
+      break;
+    }
+    llvm::BasicBlock* next = nullptr;
+    if (BI->isUnconditional()) {
+      // Every entry into the successor but a few comes from here, e.g. a
+      // loop latch joining a hot path and a rare one.
+      llvm::BasicBlock* succ = BI->getSuccessor(0);
+      unsigned long long from = fn_map.get(cur).count.load(std::memory_order_relaxed);
+      unsigned long long total = fn_map.get(succ).count.load(std::memory_order_relaxed);
+      if (succ->getSinglePredecessor() == cur || (from >= kTraceMinBranches && from >= kTraceBias * total)) {
+        next = succ;
+      }
+    } else {
+      DispatchEntry &entry = fn_map.get(cur);
+      unsigned long long taken = entry.taken[0].load(std::memory_order_relaxed);
+      unsigned long long total = taken + entry.taken[1].load(std::memory_order_relaxed);
+      if (total >= kTraceMinBranches && taken >= kTraceBias * total) {
+        next = BI->getSuccessor(0);
+      } else if (total >= kTraceMinBranches && total - taken >= kTraceBias * total) {
+        next = BI->getSuccessor(1);
+      }
+    }
+    if (!next || next == BB || std::find(trace.begin(), trace.end(), next) != trace.end() ||
+        insts + next->size() > kMaxTraceInsts) {
+      break;
+    }
+    if (!isMergeable(*next)) {
+      break;
+    }
+    insts += next->size();
+    trace.push_back(next);
+    cur = next;
+  }
+  return trace;
+}
+
+// A self-loop unrolls fully when its induction variable starts at a
+// constant and steps by a constant, and the exit compares it or its next
+// value against a bound that is constant or has a stableValue().  The
+// copies still check the exit branch each, so a loop that runs longer or
+// shorter than counted stays correct, only slower.
+unsigned JITRunner::tripCount(llvm::BasicBlock* BB) {
+  constexpr unsigned kMaxUnroll = 16;
+  constexpr size_t kMaxUnrollInsts = 256;
+
+  auto* BI = llvm::dyn_cast<llvm::BranchInst>(BB->getTerminator());
+  if (!BI || !BI->isConditional() || !isMergeable(*BB)) {
+    return 0;
+  }
+  bool again = BI->getSuccessor(0) == BB; // The compare's result that loops
+  if (!again && BI->getSuccessor(1) != BB) {
+    return 0;
+  }
+  auto* Cmp = llvm::dyn_cast<llvm::ICmpInst>(BI->getCondition());
+  int64_t bound;
+  if (!Cmp || Cmp->getParent() != BB || !Cmp->getOperand(0)->getType()->isIntegerTy()) {
+    return 0;
+  }
+  if (auto* C = llvm::dyn_cast<llvm::ConstantInt>(Cmp->getOperand(1))) {
+    bound = C->getSExtValue();
+  } else if (!stableValue(Cmp->getOperandUse(1), bound)) {
+    return 0;
+  }
+  llvm::Value* L = Cmp->getOperand(0);
+  auto* Inc = llvm::dyn_cast<llvm::BinaryOperator>(L);
+  auto* PN = llvm::dyn_cast<llvm::PHINode>(Inc && Inc->getOpcode() == llvm::Instruction::Add ? Inc->getOperand(0) : L);
+  if (!PN || PN->getParent() != BB || PN->getNumIncomingValues() != 2 || PN->getBasicBlockIndex(BB) < 0) {
+    return 0;
+  }
+  unsigned latch = PN->getBasicBlockIndex(BB);
+  Inc = llvm::dyn_cast<llvm::BinaryOperator>(PN->getIncomingValue(latch));
+  if (!Inc || Inc->getOpcode() != llvm::Instruction::Add || Inc->getOperand(0) != PN || (L != PN && L != Inc)) {
+    return 0;
+  }
+  auto* Step = llvm::dyn_cast<llvm::ConstantInt>(Inc->getOperand(1));
+  auto* Start = llvm::dyn_cast<llvm::ConstantInt>(PN->getIncomingValue(1 - latch));
+  if (!Step || !Start) {
+    return 0;
+  }
+  llvm::APInt i = Start->getValue();
+  llvm::APInt limit(i.getBitWidth(), bound, true);
+  for (unsigned trips = 1; trips <= kMaxUnroll && trips * BB->size() <= kMaxUnrollInsts; ++trips) {
+    llvm::APInt next = i + Step->getValue();
+    if (llvm::ICmpInst::compare(L == PN ? i : next, limit, Cmp->getPredicate()) != again) {
+      return trips > 1 ? trips : 0;
+    }
+    i = next;
+  }
+  return 0;
+}
+
+JITRunner::BasicBlockExecutor* JITRunner::constructBasicBlockExecutor(llvm::BasicBlock* BB, llvm::BasicBlock::iterator startline, CompilerState &State,
+                                                                      const std::vector<llvm::BasicBlock*> &Trace, bool Loops) {
+  std::unique_ptr<BasicBlockExecutor> BBExec(new BasicBlockExecutor());
+  BBExec->block = BB;
+  BBExec->start = std::distance(BB->begin(), startline);
+  asmcode::AsmBlock AB(BBExec->slots);
+  AB.setCompressed(compress);
+  AB.setVector(vectorize);
+  AB.setZbb(zbb);
+  AB.setZicond(zicond);
   bool flag = 0;
-  for (auto it = startline; it != BB->end() && !flag; ++it) {
-    llvm::Instruction& I = *it;
+  llvm::BasicBlock* cur = BB;
+  auto it = startline;
+  auto compile = [&](llvm::Instruction &I) {
     switch (I.getOpcode()) {
     case llvm::Instruction::Add:
     case llvm::Instruction::Sub:
@@ -58,19 +974,28 @@ JITRunner::BasicBlockExecutor* JITRunner::constructBasicBlockExecutor(llvm::Basi
       break;
     }
     case llvm::Instruction::PHI: {
+      // Resolved into its slot before the code runs; see resolvePhis().
       AB.addPhi(&I);
       break;
     }
     case llvm::Instruction::Load: {
-      AB.addLoad(&I);
+      AB.addLoad(&I, State.layout);
       break;
     }
     case llvm::Instruction::Store: {
-      AB.addStore(&I);
+      AB.addStore(&I, State.layout);
       break;
     }
     case llvm::Instruction::GetElementPtr: {
-      AB.addGetElementPtr(&I, data_layout);
+      AB.addGetElementPtr(&I, State.layout);
+      break;
+    }
+    case llvm::Instruction::BitCast: {
+      AB.addBitCast(&I);
+      break;
+    }
+    case llvm::Instruction::Select: {
+      AB.addSelect(&I);
       break;
     }
     case llvm::Instruction::Ret:
@@ -78,85 +1003,516 @@ JITRunner::BasicBlockExecutor* JITRunner::constructBasicBlockExecutor(llvm::Basi
       BBExec->terminator = &I;
       break;
     }
+    case llvm::Instruction::Switch: {
+      auto* SI = llvm::cast<llvm::SwitchInst>(&I);
+      SwitchTable table(*SI);
+      if (table.isDense()) {
+        AB.addSwitchTable(SI, table.low(), table.denseTable());
+      } else {
+        AB.addSwitchTree(SI, table.cases());
+      }
+      BBExec->terminator = &I;
+      break;
+    }
     case llvm::Instruction::Call: {
+      if (llvm::isa<llvm::MemIntrinsic>(I)) {
+        AB.addMemIntrinsic(&I);
+        break;
+      }
+      if (asmcode::AsmBlock::isMinMax(&I)) {
+        AB.addMinMax(&I);
+        break;
+      }
+      if (hostCall(I)) {
+        AB.addHostCall(llvm::cast<llvm::CallInst>(&I));
+        break;
+      }
+      // Only the head of a superblock has calls; the trace goes on in the
+      // segment after them.
       BBExec->terminator = &I;
-      BBExec->next_segment = constructBasicBlockExecutor(BB, std::next(it));
+      BBExec->next_segment = constructBasicBlockExecutor(BB, std::next(it), State, Trace);
       flag = 1;
       break;
     }
     case llvm::Instruction::Alloca: {
-      BBExec->localval_map[&I] = new int64_t(allocateMemory(I.getType()));
+      // The memory itself belongs to the run executing the segment.
+      BBExec->allocas.emplace_back(AB.slotOf(&I), llvm::cast<llvm::AllocaInst>(&I));
       break;
     }
 
     default:
-      // Ignore other instructions in this threshold mode
+      // The whole block stays in the interpreter.
+      throw std::runtime_error("Unsupported instruction in compile mode: " + std::string(I.getOpcodeName()));
+    }
+  };
+
+  // The code runs the rest of this segment, up to a call, and the trace
+  // if no call ends it first.
+  auto segment_end = std::find_if(startline, BB->end(), [this](llvm::Instruction &I) { return splitsCode(I); });
+  std::vector<std::pair<llvm::Instruction*, llvm::Instruction*>> ranges(1, {&*startline, nullptr});
+  if (segment_end != BB->end()) {
+    ranges[0].second = &*segment_end;
+  } else {
+    for (llvm::BasicBlock* Traced : Trace) {
+      ranges.emplace_back(&Traced->front(), nullptr);
+    }
+  }
+  auto forEachInst = [&](auto Fn) {
+    for (auto &range : ranges) {
+      for (auto I = range.first->getIterator(), E = range.first->getParent()->end(); I != E && &*I != range.second; ++I) {
+        Fn(*I);
+      }
+    }
+  };
+
+  // Scalar replacement: loads and stores of allocas whose address does not
+  // escape, once the alloca has run, can use a register instead.
+  llvm::MapVector<llvm::AllocaInst*, std::vector<AllocaCell>> scalars;
+  forEachInst([&](llvm::Instruction &I) {
+    llvm::Value* Ptr = llvm::getLoadStorePointerOperand(&I);
+    if (!Ptr || !promote_scalars) {
+      return;
+    }
+    auto* GEP = llvm::dyn_cast<llvm::GetElementPtrInst>(Ptr);
+    auto* A = llvm::dyn_cast<llvm::AllocaInst>(GEP ? GEP->getPointerOperand() : Ptr);
+    if (!A || (A->getParent() == BB && segment_end != BB->end() && !A->comesBefore(&*segment_end))) {
+      return;
+    }
+    auto found = scalars.find(A);
+    if (found == scalars.end()) {
+      found = scalars.insert({A, allocaCells(A, State.layout)}).first;
+    }
+    for (AllocaCell &cell : found->second) {
+      if (llvm::is_contained(cell.pointers, Ptr)) {
+        ++cell.uses;
+        cell.stores |= llvm::isa<llvm::StoreInst>(I);
+      }
+    }
+  });
+
+  LoopPlan plan;
+  std::vector<std::pair<llvm::Value*, int64_t>> loop_guards;
+  // What gets a register of its own: a value, which is loaded if its slot
+  // is current on entry, or an alloca scalar; the most used first.
+  struct Home {
+    llvm::Value* value;
+    bool live_in;
+    const AllocaCell* cell;
+    unsigned uses;
+  };
+  std::vector<Home> ranked;
+  // Outside a loop a scalar only pays for its load, store and spill if the
+  // code accesses it a few times.
+  constexpr unsigned kMinScalarUses = 4;
+  auto addScalars = [&](unsigned MinUses) {
+    for (auto &scalar : scalars) {
+      for (const AllocaCell &cell : scalar.second) {
+        if (cell.uses >= MinUses) {
+          ranked.push_back({cell.alloca, false, &cell, cell.uses});
+        }
+      }
+    }
+  };
+  if (Loops) {
+    std::vector<llvm::BasicBlock*> blocks(1, BB);
+    blocks.insert(blocks.end(), Trace.begin(), Trace.end());
+    std::unordered_set<const llvm::BasicBlock*> body(blocks.begin(), blocks.end());
+    plan = planLoop(blocks, State.layout);
+    // Values from outside the loop are guarded once, before it.  Address
+    // steppers get registers before other values, scalars before values
+    // used as often, and no value needs one to address a scalar.
+    std::unordered_set<llvm::Value*> guarded;
+    llvm::MapVector<llvm::Value*, unsigned> uses;
+    for (llvm::BasicBlock* Block : blocks) {
+      for (llvm::Instruction &I : *Block) {
+        for (llvm::Use &U : I.operands()) {
+          llvm::Value* V = U.get();
+          auto* Def = llvm::dyn_cast<llvm::Instruction>(V);
+          int64_t value;
+          if ((!Def || !body.count(Def->getParent())) && speculate && !guarded.count(V) && stableValue(U, value)) {
+            loop_guards.emplace_back(V, value);
+            guarded.insert(V);
+          }
+          auto* PN = llvm::dyn_cast<llvm::PHINode>(&I);
+          bool scalar = V == llvm::getLoadStorePointerOperand(&I) && llvm::any_of(scalars, [&](auto &S) {
+            return llvm::any_of(S.second, [&](const AllocaCell &C) { return llvm::is_contained(C.pointers, V); });
+          });
+          if (plan.moved.count(&I) || guarded.count(V) || scalar || (PN && !body.count(PN->getIncomingBlock(U))) ||
+              !(Def || llvm::isa<llvm::Argument>(V) || llvm::isa<llvm::GlobalVariable>(V))) {
+            continue;
+          }
+          ++uses[V];
+        }
+      }
+    }
+    for (auto &reduced : plan.reduced) {
+      ranked.push_back({reduced.first, false, nullptr, ~0u});
+    }
+    addScalars(1);
+    for (auto &use : uses) {
+      if (!llvm::any_of(plan.reduced, [&](auto &R) { return R.first == use.first; })) {
+        auto* Def = llvm::dyn_cast<llvm::Instruction>(use.first);
+        bool live_in = !Def || !body.count(Def->getParent()) || (llvm::isa<llvm::PHINode>(Def) && Def->getParent() == BB);
+        ranked.push_back({use.first, live_in, nullptr, use.second});
+      }
+    }
+  }
+  if (!Loops) {
+    addScalars(kMinScalarUses);
+  }
+  std::stable_sort(ranked.begin(), ranked.end(), [](const Home &L, const Home &R) { return L.uses > R.uses; });
+  ranked.resize(std::min<size_t>(ranked.size(), asmcode::AsmBlock::kExtraRegisters - Loops));
+
+  AB.regSave(Loops + ranked.size());
+  if (Loops) {
+    AB.beginLoop();
+  }
+  for (size_t i = 0; i < ranked.size(); ++i) {
+    asmcode::Register R = asmcode::AsmBlock::extraRegister(Loops + i);
+    if (const AllocaCell* cell = ranked[i].cell) {
+      AB.assignCell(cell->alloca, cell->offset, cell->width, cell->pointers, R, cell->stores);
+    } else {
+      AB.assignRegister(ranked[i].value, R, ranked[i].live_in);
+    }
+  }
+  if (Loops) {
+    // Before the first lap, after the registers, which the exits write
+    // back: guards, which resume at the head, invariants, and the first
+    // address of each stepped GEP.
+    for (auto &guard : loop_guards) {
+      AB.addGuard(guard.first, guard.second);
+      BBExec->deopts.push_back(BB->getFirstNonPHI());
+    }
+    for (llvm::Instruction* I : plan.hoisted) {
+      compile(*I);
+    }
+    for (auto &reduced : plan.reduced) {
+      AB.addGetElementPtr(llvm::cast<llvm::Instruction>(reduced.first), State.layout);
+    }
+    AB.addLoopHead();
+  }
+  for (size_t traced = 0;; ++traced) {
+    for (; it != cur->end() && !flag; ++it) {
+      llvm::Instruction& I = *it;
+      if (plan.moved.count(&I)) {
+        continue;
+      }
+      // Guards go right before the instruction using the value, which the
+      // interpreter resumes at if one fails.
+      for (llvm::Use &U : I.operands()) {
+        int64_t value;
+        if (speculate && !AB.constantOf(U.get(), value) && stableValue(U, value)) {
+          AB.addGuard(U.get(), value);
+          BBExec->deopts.push_back(&I);
+        }
+      }
+      compile(I);
+    }
+    if (Loops && !flag && traced == Trace.size()) {
+      AB.addLoopEdge(llvm::cast<llvm::BranchInst>(BBExec->terminator), BB, plan.reduced);
+    }
+    if (flag || traced == Trace.size()) {
       break;
     }
+    // Superblock: the code goes on into the next block of the trace.
+    AB.addTraceEdge(llvm::cast<llvm::BranchInst>(BBExec->terminator), Trace[traced]);
+    cur = Trace[traced];
+    it = cur->begin();
+  }
+  if (!flag) {
+    BBExec->trace = Trace;
+    BBExec->loops = Loops;
   }
   AB.regLoad();
   AB.addRet();
-  // printf("AsmBlock for BB:\n%s", AB.toString().c_str());
+  emitCode(*BBExec, AB, State);
+  guards.fetch_add(BBExec->deopts.size(), std::memory_order_relaxed);
+  invariants_hoisted.fetch_add(plan.hoisted.size(), std::memory_order_relaxed);
+  geps_reduced.fetch_add(plan.reduced.size(), std::memory_order_relaxed);
+  scalars_promoted.fetch_add(llvm::count_if(ranked, [](const Home &H) { return H.cell; }), std::memory_order_relaxed);
+  return BBExec.release();
+}
+
+JITRunner::BasicBlockExecutor* JITRunner::constructVectorLoopExecutor(llvm::BasicBlock* BB, std::unique_ptr<VectorLoop> Loop, CompilerState &State) {
+  std::unique_ptr<BasicBlockExecutor> BBExec(new BasicBlockExecutor());
+  BBExec->block = BB;
+  BBExec->terminator = BB->getTerminator();
+  asmcode::AsmBlock AB(BBExec->slots);
+  AB.setCompressed(compress);
+  Loop->emit(AB);
+  BBExec->loop = std::move(Loop);
+  emitCode(*BBExec, AB, State);
+  return BBExec.release();
+}
+
+void JITRunner::emitCode(BasicBlockExecutor &BBExec, const asmcode::AsmBlock &AB, CompilerState &State) {
   unsigned char* encode;
   size_t encode_size, count;
 
   AB.encode(&encode, &encode_size, &count);
+  BBExec.execFunc = reinterpret_cast<void(*)(int64_t*)>(State.arena.emit(encode, encode_size));
+  BBExec.code_size = encode_size;
+  free(encode);
+  registerCode(BBExec);
+}
 
-  // for (int i = 0; i < encode_size; i += 4) {
-  //   printf("0x%02x%02x%02x%02x\n", encode[i + 3], encode[i + 2], encode[i + 1], encode[i]);
-  // }
-  // printf("\n");
-
-  // std::cout << "Encoded " << count << " instructions, size = " << encode_size << std::endl;
-
-  void* exec = mmap(nullptr, encode_size, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_ANON | MAP_PRIVATE, -1, 0);
-
-  if (exec == MAP_FAILED) {
-    throw std::runtime_error("Failed to allocate executable memory: " + std::string(strerror(errno)));
+void JITRunner::loadCachedFunction(llvm::Function &F) {
+  std::vector<CachedExecutor> cached;
+  if (!code_cache->load(F, cached)) {
+    return;
+  }
+  std::vector<BasicBlockExecutor*> execs;
+  std::lock_guard<std::mutex> lock(sync_compiler_mutex);
+  for (CachedExecutor &CE : cached) {
+    BasicBlockExecutor* BBExec = new BasicBlockExecutor();
+    BBExec->block = CE.block;
+    BBExec->start = CE.start;
+    BBExec->terminator = CE.terminator;
+    BBExec->trace = CE.trace;
+    BBExec->loops = CE.loops;
+    BBExec->deopts = CE.deopts;
+    BBExec->slots = CE.slots;
+    for (size_t i = 0; i < CE.slots.size(); ++i) {
+      if (CE.owned[i]) {
+        BBExec->allocas.emplace_back(i, llvm::cast<llvm::AllocaInst>(CE.slots[i]));
+      }
+    }
+    BBExec->execFunc = reinterpret_cast<void(*)(int64_t*)>(sync_compiler.arena.emit(CE.code.data(), CE.code.size()));
+    BBExec->code_size = CE.code.size();
+    registerCode(*BBExec);
+    execs.push_back(BBExec);
   }
+  for (size_t i = 0; i < cached.size(); ++i) {
+    if (cached[i].next >= 0) {
+      execs[i]->next_segment = execs[cached[i].next];
+    }
+    if (cached[i].start == 0) {
+      DispatchEntry &entry = fn_map.get(cached[i].block);
+      entry.requested.store(true, std::memory_order_relaxed);
+      entry.exec.store(execs[i], std::memory_order_release);
+    }
+  }
+}
 
-  std::memcpy(exec, encode, encode_size);
+void JITRunner::registerCode(const BasicBlockExecutor &BBExec) {
+  if (sampler) {
+    sampler->registerCode(reinterpret_cast<const void*>(BBExec.execFunc), BBExec.code_size, BBExec.block);
+  }
+  if (!perf) {
+    return;
+  }
+  // Segments after a call are named by the instruction they start at.
+  std::string name = blockName(BBExec.block);
+  if (BBExec.start) {
+    name += "+" + std::to_string(BBExec.start);
+  }
+  perf->recordCode(reinterpret_cast<const void*>(BBExec.execFunc), BBExec.code_size, name);
+}
 
-  BBExec->execFunc = reinterpret_cast<void(*)()>(exec);
+void JITRunner::saveCodeCache() {
+  if (!code_cache) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(cache_mutex);
+  for (const llvm::Function* F : dirty_functions) {
+    std::vector<CachedExecutor> cached;
+    for (const llvm::BasicBlock &BB : *F) {
+      DispatchEntry *entry = fn_map.find(&BB);
+      if (!entry) {
+        continue;
+      }
+      BasicBlockExecutor* first = entry->exec.load(std::memory_order_acquire);
+      if (first && first->loop) {
+        first = first->scalar; // Vector loops are not cached; they are matched again when compiled
+      }
+      for (BasicBlockExecutor* BBExec = first; BBExec; BBExec = BBExec->next_segment) {
+        CachedExecutor CE;
+        CE.block = BBExec->block;
+        CE.start = BBExec->start;
+        CE.terminator = BBExec->terminator;
+        CE.next = BBExec->next_segment ? (int)cached.size() + 1 : -1;
+        CE.trace = BBExec->trace;
+        CE.loops = BBExec->loops;
+        CE.deopts = BBExec->deopts;
+        CE.slots = BBExec->slots;
+        CE.owned.assign(CE.slots.size(), false);
+        for (auto &alloca : BBExec->allocas) {
+          CE.owned[alloca.first] = true;
+        }
+        const unsigned char* code = reinterpret_cast<const unsigned char*>(BBExec->execFunc);
+        CE.code.assign(code, code + BBExec->code_size);
+        cached.push_back(std::move(CE));
+      }
+    }
+    code_cache->store(*const_cast<llvm::Function*>(F), cached);
+  }
+  dirty_functions.clear();
+}
 
-  return BBExec;
+bool JITRunner::enterVectorLoop(ExecContext &Ctx, BasicBlockExecutor &BBExec) {
+  const VectorLoop &L = *BBExec.loop;
+  int64_t count;
+  if (!L.tripCount(getValue(Ctx, L.induction), getValue(Ctx, L.bound), count)) {
+    return false;
+  }
+  // Evaluating the GEPs for the current iteration gives each access's
+  // first address; the code reads them, and the trip count, from slots.
+  std::vector<int64_t> starts;
+  for (llvm::GetElementPtrInst* GEP : L.accesses) {
+    starts.push_back(visitInst(Ctx, GEP));
+  }
+  if (!L.independent(starts, count)) {
+    return false;
+  }
+  for (size_t i = 0; i < starts.size(); ++i) {
+    storeValue(Ctx, L.accesses[i], starts[i]);
+  }
+  storeValue(Ctx, L.branch, count);
+  return true;
 }
 
-int64_t JITRunner::runBasicBlockExecutor(BasicBlockExecutor& BBExec) {
-  for (auto it : BBExec.localval_map) {
-    try {
-      *it.second = getValue(it.first);
-    } catch(...) {
+JITRunner::BlockExit JITRunner::runBasicBlockExecutor(ExecContext &Ctx, BasicBlockExecutor& BBExec) {
+  size_t num_slots = BBExec.slots.size();
+  // Code that can leave early says why in a word after the slots, and a
+  // loop counts its laps in the next; see AsmBlock::exitWord().
+  bool early = !BBExec.trace.empty() || !BBExec.deopts.empty() || BBExec.loops;
+  if (Ctx.frame.size() < num_slots + early + BBExec.loops) {
+    Ctx.frame.resize(num_slots + early + BBExec.loops);
+  }
+  int64_t* frame = Ctx.frame.data();
+  if (early) {
+    frame[num_slots] = 0;
+  }
+  // Values not computed yet keep whatever the slot held.
+  for (size_t i = 0; i < num_slots; ++i) {
+    lookupValue(Ctx, BBExec.slots[i], frame[i]);
+  }
+  for (auto &alloca : BBExec.allocas) {
+    frame[alloca.first] = allocateMemory(Ctx, alloca.second->getAllocatedType());
+  }
 
+  if (!sampler) {
+    BBExec.execFunc(frame);
+  } else {
+    Ctx.shadow.native = true;
+    // A counter follows the thread that opened it, and a context may be
+    // reused by another thread, so it is reopened when the thread changes.
+    if (sample_counters && Ctx.counter_tid != Sampler::currentThread()) {
+      if (Ctx.counter_fd >= 0) {
+        close(Ctx.counter_fd);
+      }
+      int fd = Sampler::openInstructionCounter();
+      Ctx.counter_fd = fd >= 0 ? fd : -2; // Not retried every execution on this thread
+      Ctx.counter_tid = Sampler::currentThread();
+    }
+    if (Ctx.counter_fd >= 0) {
+      uint64_t before = Sampler::readCounter(Ctx.counter_fd);
+      BBExec.execFunc(frame);
+      auto &counter = Ctx.native_counters[BBExec.block];
+      counter.first += Sampler::readCounter(Ctx.counter_fd) - before;
+      ++counter.second;
+    } else {
+      BBExec.execFunc(frame);
     }
+    Ctx.shadow.native = false;
   }
 
-  BBExec.execFunc();
-
-  printf("Finish executing BasicBlockExecutor.\n");
-  
-  for (auto& it : BBExec.localval_map) {
-    try {
-      storeValue(it.first, *(it.second));
-    } catch(...) {
+  int64_t exit_word = early ? frame[num_slots] : 0;
+  int64_t laps = BBExec.loops ? frame[num_slots + 1] : 0;
+  for (size_t i = 0; i < num_slots; ++i) {
+    storeValue(Ctx, BBExec.slots[i], frame[i]);
+  }
+  if (BBExec.loop) {
+    // The vector code leaves the induction variable to us.
+    const VectorLoop &L = *BBExec.loop;
+    int64_t end = getValue(Ctx, L.induction) + getValue(Ctx, L.branch);
+    storeValue(Ctx, L.induction, end - 1);
+    storeValue(Ctx, L.next, end);
+    storeValue(Ctx, L.compare, L.exit_compare);
+  }
 
+  // A superblock ran its blocks up to the edge it left by, or all of them.
+  // Each block passed counts as executed, as it would have outside one.
+  auto passTrace = [&](size_t Passed) {
+    llvm::BasicBlock* from = BBExec.block;
+    for (size_t i = 0; i < Passed; ++i) {
+      llvm::BasicBlock* next = BBExec.trace[i];
+      DispatchEntry &entry = entryOf(Ctx, next);
+      entry.count.fetch_add(1, std::memory_order_relaxed);
+      if (collect_stats) {
+        entry.native_count.fetch_add(1, std::memory_order_relaxed);
+      }
+      if (collect_profile) {
+        Ctx.edges[{from, next}]++;
+      }
+      from = next;
+    }
+    return from;
+  };
+  if (laps) {
+    // Each lap ran the whole trace and went back to the head.
+    llvm::BasicBlock* from = BBExec.block;
+    for (size_t i = 0; i <= BBExec.trace.size(); ++i) {
+      llvm::BasicBlock* next = i < BBExec.trace.size() ? BBExec.trace[i] : BBExec.block;
+      DispatchEntry &entry = entryOf(Ctx, next);
+      entry.count.fetch_add(laps, std::memory_order_relaxed);
+      if (collect_stats) {
+        entry.native_count.fetch_add(laps, std::memory_order_relaxed);
+      }
+      if (collect_profile) {
+        Ctx.edges[{from, next}] += laps;
+      }
+      from = next;
+    }
+  }
+  if (exit_word > 0) {
+    // A guard failed.  The slots hold the state before the instruction it
+    // guarded, which the interpreter goes on from.  Code that keeps failing
+    // is dropped, to be compiled again from what the interpreter sees next.
+    constexpr unsigned kMaxDeopts = 4;
+    llvm::Instruction* resume = BBExec.deopts[exit_word - 1];
+    size_t passed = 0;
+    if (resume->getParent() != BBExec.block) {
+      passed = std::find(BBExec.trace.begin(), BBExec.trace.end(), resume->getParent()) - BBExec.trace.begin() + 1;
+    }
+    llvm::BasicBlock* from = passTrace(passed);
+    deopts.fetch_add(1, std::memory_order_relaxed);
+    if (BBExec.deopt_count.fetch_add(1, std::memory_order_relaxed) + 1 == kMaxDeopts) {
+      DispatchEntry &head = entryOf(Ctx, BBExec.block);
+      if (BasicBlockExecutor* dropped = head.exec.exchange(nullptr, std::memory_order_acq_rel)) {
+        retireExecutor(dropped);
+      }
+      head.requested.store(false, std::memory_order_release);
     }
+    BlockExit exit = interpret(Ctx, entryOf(Ctx, from), resume->getIterator());
+    exit.from = from;
+    return exit;
+  }
+  if (exit_word < 0) {
+    size_t edge = -exit_word - 1;
+    llvm::BasicBlock* from = passTrace(edge);
+    auto& BI = llvm::cast<llvm::BranchInst>(*from->getTerminator());
+    return {BI.getSuccessor(0) == BBExec.trace[edge] ? BI.getSuccessor(1) : BI.getSuccessor(0), 0, from};
   }
+  llvm::BasicBlock* from = passTrace(BBExec.trace.size());
 
   if (llvm::isa<llvm::ReturnInst>(BBExec.terminator)) {
     llvm::ReturnInst& RI = llvm::cast<llvm::ReturnInst>(*BBExec.terminator);
     if (RI.getNumOperands() == 0) {
-      return 0;
+      return {nullptr, 0};
     }
-    return getValue(RI.getOperand(0));
+    return {nullptr, getValue(Ctx, RI.getOperand(0))};
   } else if (llvm::isa<llvm::BranchInst>(BBExec.terminator)) {
     llvm::BranchInst& BI = llvm::cast<llvm::BranchInst>(*BBExec.terminator);
     if (BI.isUnconditional()) {
-      return execBasicBlock(BI.getSuccessor(0));
+      return {BI.getSuccessor(0), 0, from};
     } else {
-      int64_t cond = getValue(BI.getCondition());
-      return execBasicBlock(cond ? BI.getSuccessor(0) : BI.getSuccessor(1));
+      int64_t cond = getValue(Ctx, BI.getCondition());
+      return {cond ? BI.getSuccessor(0) : BI.getSuccessor(1), 0, from};
     }
+  } else if (auto* SI = llvm::dyn_cast<llvm::SwitchInst>(BBExec.terminator)) {
+    // The code left the successor index in the switch's slot.
+    return {SI->getSuccessor(getValue(Ctx, SI)), 0, from};
   } else if (llvm::isa<llvm::CallInst>(BBExec.terminator)) {
     llvm::CallInst& CI = llvm::cast<llvm::CallInst>(*BBExec.terminator);
     llvm::Function* Callee = CI.getCalledFunction();
@@ -166,73 +1522,96 @@ int64_t JITRunner::runBasicBlockExecutor(BasicBlockExecutor& BBExec) {
     std::vector<int64_t> argVals;
     for (llvm::Use& U : CI.args()) {
       llvm::Value* V = U.get();
-      argVals.push_back(getValue(V));
+      argVals.push_back(getValue(Ctx, V));
+    }
+    if (collect_profile) {
+      Ctx.calls[{&CI, Callee}]++;
     }
-    int64_t ret = execFunction(Callee, argVals);
-    storeValue(&CI, ret);
-    return runBasicBlockExecutor(*BBExec.next_segment);
+    int64_t ret = execFunction(Ctx, Callee, argVals);
+    storeValue(Ctx, &CI, ret);
+    return runBasicBlockExecutor(Ctx, *BBExec.next_segment);
   }
 
   throw std::runtime_error("BasicBlockExecutor did not end with a return or branch instruction.");
 }
 
-int64_t JITRunner::execBasicBlock(llvm::BasicBlock *BB) {
-  if (bb_map.find(BB) != bb_map.end()) {
-    bb_map[BB]++;
-  } else {
-    bb_map[BB] = 1;
+void JITRunner::resolvePhis(ExecContext &Ctx, llvm::BasicBlock *BB, llvm::BasicBlock *Pred) {
+  // Phis read the value flowing in along the edge we arrived by; all of them
+  // are evaluated before any is written.
+  llvm::SmallVector<std::pair<llvm::Value*, int64_t>, 4> PhiBuffer;
+  for (llvm::PHINode &PN : BB->phis()) {
+    llvm::BasicBlock *From = Pred ? Pred : PN.getIncomingBlock(0);
+    PhiBuffer.emplace_back(&PN, getValue(Ctx, PN.getIncomingValueForBlock(From)));
   }
-  
-  if (bb_map[BB] > threshold) {
-    if (fn_map.find(BB) != fn_map.end()) {
-      BasicBlockExecutor &BBExec = *fn_map[BB];
-      return runBasicBlockExecutor(BBExec);
-    } else {
-      BasicBlockExecutor* BBExec = constructBasicBlockExecutor(BB, BB->begin());
-      fn_map[BB] = BBExec;
-      return runBasicBlockExecutor(*BBExec);
+  for (auto &pair : PhiBuffer) {
+    storeValue(Ctx, pair.first, pair.second);
+  }
+}
+
+JITRunner::DispatchEntry &JITRunner::entryOf(ExecContext &Ctx, const llvm::BasicBlock *BB) {
+  DispatchEntry *&cached = Ctx.entries[BB];
+  if (!cached) {
+    cached = &fn_map.get(BB);
+  }
+  return *cached;
+}
+
+JITRunner::BlockExit JITRunner::execBasicBlock(ExecContext &Ctx, llvm::BasicBlock *BB, llvm::BasicBlock *Pred) {
+  DispatchEntry &entry = entryOf(Ctx, BB);
+  if (sampler) {
+    Ctx.shadow.enter(BB);
+  }
+  unsigned long long count = entry.count.fetch_add(1, std::memory_order_relaxed) + 1;
+
+  // Compiled code runs as soon as it is published, including code mapped in
+  // from the cache before the block reached the threshold.
+  BasicBlockExecutor* BBExec = entry.exec.load(std::memory_order_acquire);
+  if (!BBExec && count > threshold && !entry.requested.load(std::memory_order_relaxed)) {
+    requestCompile(BB, entry);
+    BBExec = entry.exec.load(std::memory_order_acquire);
+  }
+
+  resolvePhis(Ctx, BB, Pred);
+  if (BBExec && BBExec->loop && !enterVectorLoop(Ctx, *BBExec)) {
+    BBExec = BBExec->scalar;
+  }
+  if (BBExec) {
+    if (collect_stats) {
+      entry.native_count.fetch_add(1, std::memory_order_relaxed);
     }
-  } else {
-    std::unordered_map<llvm::Value *, int64_t> PhiBuffer;
-    for (llvm::Instruction& I : *BB) {
-      if (llvm::isa<llvm::PHINode>(I)) {
-        llvm::PHINode& PN = llvm::cast<llvm::PHINode>(I);
-        // Naïve: choose incoming based on first predecessor (works because we
-        // evaluate edge‑by‑edge).
-        llvm::BasicBlock *Pred = PN.getIncomingBlock(0);
-        llvm::Value *Incoming = PN.getIncomingValueForBlock(Pred);
-        PhiBuffer[&I] = getValue(Incoming);
+    return runBasicBlockExecutor(Ctx, *BBExec);
+  }
+  return interpret(Ctx, entry, BB->getFirstNonPHI()->getIterator());
+}
+
+JITRunner::BlockExit JITRunner::interpret(ExecContext &Ctx, DispatchEntry &Entry, llvm::BasicBlock::iterator It) {
+  for (auto it = It; it != It->getParent()->end(); ++it) {
+    llvm::Instruction &I = *it;
+    if (llvm::isa<llvm::ReturnInst>(I)) {
+      llvm::ReturnInst &RI = llvm::cast<llvm::ReturnInst>(I);
+      if (RI.getNumOperands() == 0)
+        return {nullptr, 0};
+      return {nullptr, getValue(Ctx, RI.getOperand(0))};
+    } else if (llvm::isa<llvm::BranchInst>(I)) {
+      llvm::BranchInst &BI = llvm::cast<llvm::BranchInst>(I);
+      if (BI.isUnconditional()) {
+        return {BI.getSuccessor(0), 0};
       } else {
-        if (!PhiBuffer.empty()) {
-          for (auto &pair : PhiBuffer) {
-            storeValue(pair.first, pair.second);
-            PhiBuffer.erase(pair.first);
-          }
-        }
-        if (llvm::isa<llvm::ReturnInst>(I)) {
-          llvm::ReturnInst &RI = llvm::cast<llvm::ReturnInst>(I);
-          if (RI.getNumOperands() == 0)
-            return 0;
-          return getValue(RI.getOperand(0));
-        } else if (llvm::isa<llvm::BranchInst>(I)) {
-          llvm::BranchInst &BI = llvm::cast<llvm::BranchInst>(I);
-          if (BI.isUnconditional()) {
-            return execBasicBlock(BI.getSuccessor(0));
-          } else {
-            int64_t cond = getValue(BI.getCondition());
-            return execBasicBlock(cond ? BI.getSuccessor(0) : BI.getSuccessor(1));
-          }
-        } else {
-          // Compute & memoize result of non‑terminator instruction
-          storeValue(&I, visitInst(&I));
-        }
+        int64_t cond = getValue(Ctx, BI.getCondition());
+        Entry.taken[cond ? 0 : 1].fetch_add(1, std::memory_order_relaxed);
+        return {cond ? BI.getSuccessor(0) : BI.getSuccessor(1), 0};
       }
+    } else if (auto* SI = llvm::dyn_cast<llvm::SwitchInst>(&I)) {
+      return {execSwitch(Ctx, *SI), 0};
+    } else {
+      // Compute & memoize result of non‑terminator instruction
+      storeValue(Ctx, &I, visitInst(Ctx, &I));
     }
   }
   throw std::runtime_error("Fell off end of basic block - malformed IR.");
 }
 
-int64_t JITRunner::visitInst(llvm::Instruction* I) {
+int64_t JITRunner::visitInst(ExecContext &Ctx, llvm::Instruction* I) {
   switch (I->getOpcode()) {
     case llvm::Instruction::Add:
     case llvm::Instruction::Sub:
@@ -240,8 +1619,9 @@ int64_t JITRunner::visitInst(llvm::Instruction* I) {
     case llvm::Instruction::SDiv:
     case llvm::Instruction::SRem: {
       auto *B = llvm::cast<llvm::BinaryOperator>(I);
-      int64_t lhs = getValue(B->getOperand(0));
-      int64_t rhs = getValue(B->getOperand(1));
+      int64_t lhs = getValue(Ctx, B->getOperand(0));
+      int64_t rhs = getValue(Ctx, B->getOperand(1));
+      profileValue(Ctx, B->getOperandUse(1), rhs);
       switch (I->getOpcode()) {
       case llvm::Instruction::Add:
         return lhs + rhs;
@@ -263,8 +1643,9 @@ int64_t JITRunner::visitInst(llvm::Instruction* I) {
     }
     case llvm::Instruction::ICmp: {
       auto *C = llvm::cast<llvm::ICmpInst>(I);
-      int64_t lhs = getValue(C->getOperand(0));
-      int64_t rhs = getValue(C->getOperand(1));
+      int64_t lhs = getValue(Ctx, C->getOperand(0));
+      int64_t rhs = getValue(Ctx, C->getOperand(1));
+      profileValue(Ctx, C->getOperandUse(1), rhs);
       switch (C->getPredicate()) {
       case llvm::CmpInst::ICMP_EQ:
         return lhs == rhs;
@@ -278,74 +1659,112 @@ int64_t JITRunner::visitInst(llvm::Instruction* I) {
         return lhs < rhs;
       case llvm::CmpInst::ICMP_SLE:
         return lhs <= rhs;
+      case llvm::CmpInst::ICMP_UGT:
+        return (uint64_t)lhs > (uint64_t)rhs;
+      case llvm::CmpInst::ICMP_UGE:
+        return (uint64_t)lhs >= (uint64_t)rhs;
+      case llvm::CmpInst::ICMP_ULT:
+        return (uint64_t)lhs < (uint64_t)rhs;
+      case llvm::CmpInst::ICMP_ULE:
+        return (uint64_t)lhs <= (uint64_t)rhs;
       default:
         throw std::runtime_error("Unsupported ICmp predicate");
       }
     }
     case llvm::Instruction::Call: {
       auto* CI = llvm::cast<llvm::CallInst>(I);
+      if (auto* MI = llvm::dyn_cast<llvm::MemIntrinsic>(CI)) {
+        execMemIntrinsic(Ctx, MI);
+        return 0;
+      }
+      if (asmcode::AsmBlock::isMinMax(CI)) {
+        return execMinMax(Ctx, llvm::cast<llvm::IntrinsicInst>(CI));
+      }
       llvm::Function* Callee = CI->getCalledFunction();
+      if (Callee && Callee->isDeclaration()) {
+        auto found = Ctx.host_calls.find(CI);
+        if (found == Ctx.host_calls.end()) {
+          found = Ctx.host_calls.emplace(CI, hostCall(*CI)).first;
+        }
+        if (const HostFunctions::HostCall* site = found->second) {
+          // Arguments go straight from their values to the call.
+          int64_t args[HostFunctions::kMaxArgs];
+          for (unsigned i = 0; i < site->num_args; ++i) {
+            args[i] = getValue(Ctx, CI->getArgOperand(i));
+          }
+          return HostFunctions::call(*site, args);
+        }
+      }
       if (!Callee || Callee->isDeclaration())
         throw std::runtime_error("External function call not allowed.");
 
       std::vector<int64_t> argVals;
       for (llvm::Use& U : CI->args()) {
         llvm::Value* V = U.get();
-        argVals.push_back(getValue(V));
+        argVals.push_back(getValue(Ctx, V));
+      }
+      if (collect_profile) {
+        Ctx.calls[{CI, Callee}]++;
       }
       // Recursive call
-      int64_t ret = execFunction(Callee, argVals);
+      int64_t ret = execFunction(Ctx, Callee, argVals);
       return ret;
     }
+    case llvm::Instruction::Select: {
+      auto* SI = llvm::cast<llvm::SelectInst>(I);
+      int64_t cond = getValue(Ctx, SI->getCondition());
+      return getValue(Ctx, cond ? SI->getTrueValue() : SI->getFalseValue());
+    }
     case llvm::Instruction::PHI: {
       auto* PN = llvm::cast<llvm::PHINode>(I);
       // Naïve: choose incoming based on first predecessor (works because we
       // evaluate edge‑by‑edge).
       llvm::BasicBlock* Pred = PN->getIncomingBlock(0);
       llvm::Value* Incoming = PN->getIncomingValueForBlock(Pred);
-      return getValue(Incoming);
+      return getValue(Ctx, Incoming);
     }
     case llvm::Instruction::Alloca: {
       auto* A = llvm::cast<llvm::AllocaInst>(I);
       llvm::Type* T = A->getAllocatedType();
       uint64_t Align = A->getAlign().value();
-      int64_t ptr = allocateMemory(T);
+      int64_t ptr = allocateMemory(Ctx, T);
       return ptr;
     }
     case llvm::Instruction::Load: {
       auto* LI = llvm::cast<llvm::LoadInst>(I);
-      int64_t ptr = getValue(LI->getPointerOperand());
+      int64_t ptr = getValue(Ctx, LI->getPointerOperand());
       if (ptr == 0)
         throw std::runtime_error("Dereferencing null pointer.");
-      // Assume pointer points to an int64_t
-      return *(reinterpret_cast<int64_t *>(ptr));
+      return loadMemory(ptr, Ctx.layout.getTypeStoreSize(LI->getType()));
     }
     case llvm::Instruction::Store: {
       auto* SI = llvm::cast<llvm::StoreInst>(I);
-      int64_t ptr = getValue(SI->getPointerOperand());
+      int64_t ptr = getValue(Ctx, SI->getPointerOperand());
       if (ptr == 0)
         throw std::runtime_error("Dereferencing null pointer.");
-      int64_t value = getValue(SI->getValueOperand());
-      *(reinterpret_cast<int64_t *>(ptr)) = value;
+      int64_t value = getValue(Ctx, SI->getValueOperand());
+      storeMemory(ptr, Ctx.layout.getTypeStoreSize(SI->getValueOperand()->getType()), value);
       return 0; // Store does not return a value.
     }
     case llvm::Instruction::GetElementPtr: {
       auto* GEP = llvm::cast<llvm::GetElementPtrInst>(I);
-      int64_t basePtr = getValue(GEP->getPointerOperand());
+      int64_t basePtr = getValue(Ctx, GEP->getPointerOperand());
       if (basePtr == 0)
         throw std::runtime_error("Dereferencing null pointer in GEP");
       llvm::Type* curTy = GEP->getSourceElementType();
       int64_t offset = 0;
       auto idxIt = GEP->idx_begin();
-      int64_t idxVal = getValue(*idxIt);
+      int64_t idxVal = getValue(Ctx, *idxIt);
+      profileValue(Ctx, *idxIt, idxVal);
       if (idxVal != 0) {
-        offset += idxVal * static_cast<int64_t>(data_layout.getTypeAllocSize(curTy));
+        offset += idxVal * static_cast<int64_t>(Ctx.layout.getTypeAllocSize(curTy));
       }
       for (++idxIt; idxIt != GEP->idx_end(); ++idxIt) {
-        int64_t idxVal = getValue(*idxIt);
+        int64_t idxVal = getValue(Ctx, *idxIt);
+        profileValue(Ctx, *idxIt, idxVal);
         if (curTy->isStructTy()) {
           auto* STy = llvm::cast<llvm::StructType>(curTy);
-          const auto* SL = data_layout.getStructLayout(STy);
+          const auto* SL = Ctx.layout.getStructLayout(STy);
 
           if (!llvm::isa<llvm::Constant>(*idxIt))
             throw std::runtime_error("Non-constant struct index in GEP");
@@ -359,7 +1778,7 @@ int64_t JITRunner::visitInst(llvm::Instruction* I) {
         } else if (curTy->isArrayTy()) {
           const auto* ATy = llvm::cast<llvm::ArrayType>(curTy);
           llvm::Type* EltT = ATy->getElementType();
-          uint64_t eltSize = data_layout.getTypeAllocSize(EltT);
+          uint64_t eltSize = Ctx.layout.getTypeAllocSize(EltT);
           offset += idxVal * static_cast<int64_t>(eltSize);
           curTy = EltT;
         } else {
@@ -369,9 +1788,11 @@ int64_t JITRunner::visitInst(llvm::Instruction* I) {
 
       return basePtr + offset;
     }
+    case llvm::Instruction::BitCast:
+      return getValue(Ctx, I->getOperand(0));
     case llvm::Instruction::SExt: {
       auto* SExt = llvm::cast<llvm::SExtInst>(I);
-      int64_t value = getValue(SExt->getOperand(0));
+      int64_t value = getValue(Ctx, SExt->getOperand(0));
       // Sign-extend the value to 64 bits
       return (int64_t)(int64_t(value));
     }
@@ -380,52 +1801,166 @@ int64_t JITRunner::visitInst(llvm::Instruction* I) {
   }
 }
 
-int64_t JITRunner::allocateMemory(llvm::Type *T) {
-  if (T->isIntegerTy()) {
-    return (int64_t)(new int64_t);
-  } else if (T->isArrayTy()) {
-    auto* AT = llvm::cast<llvm::ArrayType>(T);
-    llvm::Type *ElemType = AT->getElementType();
-    if (ElemType->isArrayTy()) {
-      int64_t ret = (int64_t)(new int64_t[AT->getNumElements()]);
-      for (uint64_t i = 0; i < AT->getNumElements(); ++i) {
-        // Allocate each element separately
-        int64_t elemPtr = allocateMemory(ElemType);
-        ((int64_t *)ret)[i] = elemPtr;
-      }
-      return ret;
-    } else {
-      return (int64_t)(malloc(data_layout.getTypeAllocSize(ElemType) * AT->getNumElements()));
-    }
-  } else if (T->isPointerTy()) {
-    return (int64_t)(new int64_t); // Dummy pointer allocation
-  } else if (T->isStructTy()) {
-    return (int64_t)(malloc(data_layout.getTypeAllocSize(T)));
+void JITRunner::profileValue(ExecContext &Ctx, const llvm::Use &U, int64_t Value) {
+  if (!speculate || !isSpeculated(U)) {
+    return;
+  }
+  ValueSite *&site = Ctx.value_sites[&U];
+  if (!site) {
+    site = &value_sites.get(&U);
+  }
+  if (site->varied.load(std::memory_order_relaxed)) {
+    return;
+  }
+  // Threads racing on the first value may both count theirs; that only
+  // costs a guard that fails.
+  if (site->hits.load(std::memory_order_relaxed) == 0) {
+    site->value.store(Value, std::memory_order_relaxed);
+  }
+  if (site->value.load(std::memory_order_relaxed) == Value) {
+    site->hits.fetch_add(1, std::memory_order_relaxed);
   } else {
-    throw std::runtime_error("Unsupported type for allocation");
+    site->varied.store(true, std::memory_order_relaxed);
+  }
+}
+
+bool JITRunner::stableValue(const llvm::Use &U, int64_t &Out) {
+  constexpr unsigned long long kMinValueHits = 16;
+  if (!isSpeculated(U)) {
+    return false;
+  }
+  ValueSite* site = value_sites.find(&U);
+  if (!site || site->varied.load(std::memory_order_relaxed) ||
+      site->hits.load(std::memory_order_relaxed) < kMinValueHits) {
+    return false;
+  }
+  Out = site->value.load(std::memory_order_relaxed);
+  return true;
+}
+
+llvm::BasicBlock* JITRunner::execSwitch(ExecContext &Ctx, llvm::SwitchInst &SI) {
+  auto it = Ctx.switch_tables.find(&SI);
+  if (it == Ctx.switch_tables.end()) {
+    it = Ctx.switch_tables.emplace(&SI, SwitchTable(SI)).first;
+  }
+  return SI.getSuccessor(it->second.lookup(getValue(Ctx, SI.getCondition())));
+}
+
+int64_t JITRunner::execMinMax(ExecContext &Ctx, llvm::IntrinsicInst *II) {
+  int64_t a = getValue(Ctx, II->getArgOperand(0));
+  if (II->getIntrinsicID() == llvm::Intrinsic::abs) {
+    return a < 0 ? -(uint64_t)a : a;
+  }
+  int64_t b = getValue(Ctx, II->getArgOperand(1));
+  switch (II->getIntrinsicID()) {
+    case llvm::Intrinsic::smin:
+      return std::min(a, b);
+    case llvm::Intrinsic::smax:
+      return std::max(a, b);
+    case llvm::Intrinsic::umin:
+      return (int64_t)std::min((uint64_t)a, (uint64_t)b);
+    default:
+      return (int64_t)std::max((uint64_t)a, (uint64_t)b);
   }
-  return 0; // No size means no allocation.
 }
 
-void JITRunner::storeValue(llvm::Value* V, int64_t val) {
-  if (auto* GV = llvm::dyn_cast<llvm::GlobalVariable>(V)) {
-    globalval_map[V] = val;
+void JITRunner::execMemIntrinsic(ExecContext &Ctx, llvm::MemIntrinsic *MI) {
+  size_t len = getValue(Ctx, MI->getLength());
+  if (len == 0) {
+    return;
+  }
+  void* dest = reinterpret_cast<void*>(getValue(Ctx, MI->getRawDest()));
+  if (!dest) {
+    throw std::runtime_error("Dereferencing null pointer.");
+  }
+  if (auto* MS = llvm::dyn_cast<llvm::MemSetInst>(MI)) {
+    memset(dest, (int)getValue(Ctx, MS->getValue()), len);
+    return;
+  }
+  void* source = reinterpret_cast<void*>(getValue(Ctx, llvm::cast<llvm::MemTransferInst>(MI)->getRawSource()));
+  if (!source) {
+    throw std::runtime_error("Dereferencing null pointer.");
+  }
+  if (llvm::isa<llvm::MemMoveInst>(MI)) {
+    memmove(dest, source, len);
   } else {
-    (*localval_map)[V] = val;
+    memcpy(dest, source, len);
   }
 }
 
-int64_t JITRunner::getValue(llvm::Value* V) {
+/// The C library routine compiled code calls for a memory intrinsic, or null.
+static void* memRoutine(const llvm::Function &F) {
+  switch (F.getIntrinsicID()) {
+    case llvm::Intrinsic::memcpy:
+    case llvm::Intrinsic::memcpy_inline:
+      return reinterpret_cast<void*>(&memcpy);
+    case llvm::Intrinsic::memmove:
+      return reinterpret_cast<void*>(&memmove);
+    case llvm::Intrinsic::memset:
+      return reinterpret_cast<void*>(&memset);
+    default:
+      return nullptr;
+  }
+}
+
+int64_t JITRunner::allocateMemory(ExecContext &Ctx, llvm::Type *T) {
+  if (!T->isSized()) {
+    throw std::runtime_error("Unsupported type for allocation");
+  }
+  // Aggregates are laid out flat, exactly as GEP addresses them.
+  uint64_t size = Ctx.layout.getTypeAllocSize(T);
+  uint64_t align = std::max<uint64_t>(Ctx.layout.getPrefTypeAlign(T).value(), 8);
+  return (int64_t)Ctx.stack_arena.allocate(size, align);
+}
+
+void JITRunner::storeValue(ExecContext &Ctx, llvm::Value* V, int64_t val) {
+  // Compiled code hands back every slot, those of global addresses included;
+  // constants never change.
+  if (!llvm::isa<llvm::Constant>(V)) {
+    (*Ctx.localval_map)[V] = val;
+  }
+}
+
+bool JITRunner::lookupValue(ExecContext &Ctx, llvm::Value* V, int64_t &Out) {
   if (auto* CI = llvm::dyn_cast<llvm::ConstantInt>(V)) {
-    return asInt(CI->getValue());
+    Out = asInt(CI->getValue());
+    return true;
+  }
+  auto it = Ctx.globalval_map.find(V);
+  if (it != Ctx.globalval_map.end()) {
+    Out = it->second;
+    return true;
   }
-  auto it = globalval_map.find(V);
-  if (it != globalval_map.end()) {
-    return it->second;
+  auto localIt = Ctx.localval_map->find(V);
+  if (localIt != Ctx.localval_map->end()) {
+    Out = localIt->second;
+    return true;
   }
-  auto localIt = localval_map->find(V);
-  if (localIt != localval_map->end()) {
-    return localIt->second;
+  // Globals and the constant expressions built on them are addresses in
+  // this context's data segment, fixed for its lifetime.
+  auto* C = llvm::dyn_cast<llvm::Constant>(V);
+  if (C && Ctx.data.addressOf(C, Ctx.layout, Out)) {
+    Ctx.globalval_map[V] = Out;
+    return true;
   }
-  throw std::runtime_error("Value not computed yet.");
-}
\ No newline at end of file
+  if (auto* F = llvm::dyn_cast<llvm::Function>(V)) {
+    if (void* routine = memRoutine(*F)) {
+      Out = reinterpret_cast<int64_t>(routine);
+      return true;
+    }
+    if (HostFunctions::isAllowed(*F)) {
+      Out = reinterpret_cast<int64_t>(HostFunctions::resolve(*F));
+      Ctx.globalval_map[V] = Out;
+      return true;
+    }
+  }
+  return false;
+}
+
+int64_t JITRunner::getValue(ExecContext &Ctx, llvm::Value* V) {
+  int64_t val;
+  if (!lookupValue(Ctx, V, val)) {
+    throw std::runtime_error("Value not computed yet.");
+  }
+  return val;
+}
@@ -3,51 +3,345 @@
 
 #include <stdexcept>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_set>
+#include <unistd.h>
 #include "../util/util.hpp"
+#include "../asm/asmstruct.hpp"
+#include "../profile/profile.hpp"
+#include "../stats/stats.hpp"
+#include "../sampler/sampler.hpp"
+#include "../vector/vectorloop.hpp"
+#include "../data/datasegment.hpp"
+#include "../host/hostfunctions.hpp"
+#include "compilequeue.hpp"
+#include "codearena.hpp"
+#include "stackarena.hpp"
+#include "dispatchtable.hpp"
+#include "switchtable.hpp"
+
+class CodeCache;
+struct CachedExecutor;
+class PerfRegistry;
+
+struct JITOptions {
+  std::string cache_dir;             // Directory of the persistent code cache, empty to disable
+  unsigned long long threshold = 1;  // Executions after which a block is compiled
+  std::string profile_in;            // Profile of an earlier run used to warm up, empty for none
+  std::string profile_out;           // File the profile of this run is written to, empty for none
+  bool async_compile = true;         // Compile on a background thread while interpreting
+  bool aot = false;                  // Compile every defined function before running main
+  unsigned aot_threads = 0;          // Threads used by ahead-of-time compilation, 0 for one per core
+  bool collect_stats = false;        // Count interpreted and native executions of every block
+  bool perf_map = false;             // Name generated code in /tmp/perf-<pid>.map
+  bool perf_jitdump = false;         // Record generated code in /tmp/jit-<pid>.dump
+  std::string sample_out;            // File the sampling profile is written to, empty to disable
+  unsigned sample_hz = 997;          // Samples per second of CPU time
+  bool sample_counters = false;      // Count instructions retired by native executions of every block
+  bool vectorize = false;            // Run simple counted loops with RVV code, if the CPU has it
+  bool compress = true;              // Emit compressed (RVC) instructions, if the CPU has them
+  bool superblocks = true;           // Compile chains of blocks along hot paths as one unit
+  bool speculate = true;             // Specialize code on values the interpreter saw never change, behind guards
+  bool loops = true;                 // Run loops inside compiled code, with invariants hoisted and GEPs strength-reduced
+  bool scalars = true;               // Keep allocas whose address does not escape in registers in compiled code
+  std::string extensions;            // Extensions to assume on top of or instead of detection; see CPUFeatures::apply()
+};
 
 class JITRunner {
 
 private:
   struct BasicBlockExecutor {
-    std::unordered_map<llvm::Value *, int64_t*> localval_map;
-    void (*execFunc)();
+    std::vector<llvm::Value *> slots;   // Value held in each frame slot
+    std::vector<std::pair<unsigned, llvm::AllocaInst*>> allocas; // Slots of the allocas this segment performs
+    void (*execFunc)(int64_t* frame);
     llvm::Instruction* terminator = nullptr;
     BasicBlockExecutor* next_segment = nullptr;
+    llvm::BasicBlock* block = nullptr;
+    std::vector<llvm::BasicBlock*> trace; // Blocks a superblock runs after `block`, in order
+    bool loops = false; // The code goes back to `block` from the end of the trace itself
+    std::vector<llvm::Instruction*> deopts; // Where the interpreter resumes when each guard fails
+    std::atomic<unsigned> deopt_count{0};
+    unsigned start = 0; // Index of the first instruction of this segment in its block
+    size_t code_size = 0;
+    std::unique_ptr<VectorLoop> loop;   // Set if the code runs all remaining iterations of a self-loop
+    BasicBlockExecutor* scalar = nullptr; // Used when the vector code cannot run, null to interpret
+  };
+
+  // Where control goes after a block: the successor to run next, or the
+  // function's return value when `next` is null.  A superblock also says
+  // which of its blocks branched there.
+  struct BlockExit {
+    llvm::BasicBlock* next;
+    int64_t ret;
+    llvm::BasicBlock* from = nullptr; // Null for the block that was entered
+  };
+
+  // Dispatch table entry of a block, shared by all threads.  `exec` is
+  // published by whichever thread compiled the block.
+  struct DispatchEntry {
+    std::atomic<BasicBlockExecutor*> exec{nullptr};
+    std::atomic<unsigned long long> count{0};
+    std::atomic<unsigned long long> native_count{0}; // Only counted with collect_stats
+    std::atomic<bool> requested{false};
+    std::atomic<unsigned long long> taken[2] = {{0}, {0}}; // Conditional branch sides seen by the interpreter
+  };
+
+  // Values the interpreter saw one operand take: the first one, and how
+  // often it came again, until any other one shows up.
+  struct ValueSite {
+    std::atomic<int64_t> value{0};
+    std::atomic<unsigned long long> hits{0};
+    std::atomic<bool> varied{false};
+  };
+
+  // How a call site calls into the C library, decided by whichever thread
+  // looks at it first.
+  struct HostCallSite {
+    std::once_flag once;
+    HostFunctions::HostCall call;
+  };
+
+  struct CompileRequest {
+    llvm::BasicBlock* block;
+    DispatchEntry* entry;
+  };
+
+  // What a thread needs to compile: an arena its code goes into, and its own
+  // DataLayout, whose struct layout cache is not safe to share.
+  struct CompilerState {
+    explicit CompilerState(const llvm::DataLayout &DL) : layout(DL) {}
+    CodeArena arena;
+    llvm::DataLayout layout;
+  };
+
+  // Everything a single execution of the program mutates.  A context is used
+  // by one thread at a time; contexts are pooled and reset between runs.
+  struct ExecContext {
+    ExecContext(const llvm::DataLayout &DL, const DataSegment &Data) : data(Data), layout(DL) {}
+    ~ExecContext() {
+      if (counter_fd >= 0) {
+        close(counter_fd);
+      }
+    }
+    std::unordered_map<const llvm::Value *, int64_t> globalval_map; // Addresses of globals in `data`
+    std::unordered_map<const llvm::Value *, int64_t>* localval_map = nullptr;
+    std::vector<int64_t> frame;  // Slot frame handed to compiled code
+    StackArena stack_arena;      // Allocas
+    DataSegment::Instance data;  // Globals
+    llvm::DataLayout layout;
+    std::unordered_map<const llvm::BasicBlock*, DispatchEntry*> entries; // Dispatch table lookups already done
+    std::unordered_map<const llvm::Use*, ValueSite*> value_sites;
+    std::unordered_map<const llvm::CallInst*, const HostFunctions::HostCall*> host_calls;
+    std::unordered_set<const llvm::Function*> ready_functions;          // Functions known to be materialized
+    std::unordered_map<const llvm::SwitchInst*, SwitchTable> switch_tables;
+    std::map<Profile::Edge, uint64_t> edges;
+    std::map<Profile::CallTarget, uint64_t> calls;
+    ShadowStack shadow;          // IR call stack seen by the sampler
+    int counter_fd = -1;         // Instructions retired with sample_counters; -2 if unavailable
+    pid_t counter_tid = 0;       // Thread counter_fd counts
+    std::unordered_map<const llvm::BasicBlock*, std::pair<uint64_t, uint64_t>> native_counters;
   };
 
 public:
-  JITRunner(llvm::Module &M);
+  JITRunner(llvm::Module &M, const JITOptions &Opts = JITOptions());
+
+  ~JITRunner();
 
+  /// Run `main` once, then persist the code cache and profile.
   int64_t runModule();
 
+  /// Run F with the given arguments on a fresh program state: globals and
+  /// allocas start over, compiled code and execution counts stay warm.
+  /// May be called any number of times, from any number of threads at once;
+  /// concurrent runs share compiled code but nothing the program can observe.
+  int64_t run(llvm::Function *F, const std::vector<int64_t> &Args);
+
+  /// Write the code cache and profile, if enabled.  Must not race with run().
+  void flush();
+
+  /// Time spent generating code so far, summed over all compiling threads.
+  double compileMillis() const { return compile_ns.load(std::memory_order_relaxed) / 1e6; }
+
+  /// Snapshot of the statistics collected so far.  Must not race with run().
+  JITStats stats();
+
 private:
-  int64_t execFunction(llvm::Function *F, const std::vector<int64_t> &Args);
+  int64_t execFunction(ExecContext &Ctx, llvm::Function *F, const std::vector<int64_t> &Args);
 
-  int64_t execBasicBlock(llvm::BasicBlock *BB);
+  BlockExit execBasicBlock(ExecContext &Ctx, llvm::BasicBlock *BB, llvm::BasicBlock *Pred);
 
-  BasicBlockExecutor* constructBasicBlockExecutor(llvm::BasicBlock* BB, llvm::BasicBlock::iterator startline);
+  /// Interpret the rest of a block from It on; Entry is the block's.
+  BlockExit interpret(ExecContext &Ctx, DispatchEntry &Entry, llvm::BasicBlock::iterator It);
 
-  int64_t runBasicBlockExecutor(BasicBlockExecutor &BBExec);
+  BasicBlockExecutor* compileBlock(llvm::BasicBlock* BB, CompilerState &State);
 
-  int64_t visitInst(llvm::Instruction *I);
+  /// The host function call I makes, or null if it is no such call.
+  const HostFunctions::HostCall* hostCall(const llvm::Instruction &I);
 
-  int64_t getValue(llvm::Value *V);
+  /// Whether I is a call that ends a segment of compiled code.
+  bool splitsCode(const llvm::Instruction &I);
 
-  int64_t allocateMemory(llvm::Type *TempDIBasicType);
+  /// Whether BB can be compiled into the middle of a superblock.
+  bool isMergeable(const llvm::BasicBlock &BB);
 
-  void storeValue(llvm::Value *V, int64_t Value);
+  /// Whether the superblock of BB and Trace can run as a loop.
+  bool closesLoop(llvm::BasicBlock* BB, const std::vector<llvm::BasicBlock*> &Trace);
 
-private:
-  std::unordered_map<const llvm::Value *, int64_t> globalval_map;
-  std::unordered_map<const llvm::Value *, int64_t>* localval_map;
-  std::unordered_map<const llvm::BasicBlock *, unsigned long long> bb_map;
-  std::unordered_map<const llvm::BasicBlock*, BasicBlockExecutor*> fn_map;
+  /// The blocks a superblock headed by BB goes on into; see formTrace() in
+  /// the implementation for which ones qualify.
+  std::vector<llvm::BasicBlock*> formTrace(llvm::BasicBlock* BB);
+
+  /// Iterations of a small self-loop from its entry, if they are known and
+  /// few enough to unroll fully; 0 otherwise.
+  unsigned tripCount(llvm::BasicBlock* BB);
+
+  /// Note a value of an operand the compiler may specialize on.
+  void profileValue(ExecContext &Ctx, const llvm::Use &U, int64_t Value);
+
+  /// The one value U was seen with, if it has been seen often enough.
+  bool stableValue(const llvm::Use &U, int64_t &Out);
+
+  BasicBlockExecutor* constructBasicBlockExecutor(llvm::BasicBlock* BB, llvm::BasicBlock::iterator startline, CompilerState &State,
+                                                  const std::vector<llvm::BasicBlock*> &Trace = {}, bool Loops = false);
+
+  void resolvePhis(ExecContext &Ctx, llvm::BasicBlock *BB, llvm::BasicBlock *Pred);
+
+  BasicBlockExecutor* constructVectorLoopExecutor(llvm::BasicBlock* BB, std::unique_ptr<VectorLoop> Loop, CompilerState &State);
+
+  void emitCode(BasicBlockExecutor &BBExec, const asmcode::AsmBlock &AB, CompilerState &State);
+
+  bool enterVectorLoop(ExecContext &Ctx, BasicBlockExecutor &BBExec);
+
+  BlockExit runBasicBlockExecutor(ExecContext &Ctx, BasicBlockExecutor &BBExec);
 
-  const llvm::DataLayout &data_layout;
+  DispatchEntry &entryOf(ExecContext &Ctx, const llvm::BasicBlock *BB);
+
+  int64_t visitInst(ExecContext &Ctx, llvm::Instruction *I);
+
+  /// The successor a switch takes in the interpreter.
+  llvm::BasicBlock *execSwitch(ExecContext &Ctx, llvm::SwitchInst &SI);
+
+  /// An intrinsic AsmBlock::isMinMax() accepts.
+  int64_t execMinMax(ExecContext &Ctx, llvm::IntrinsicInst *II);
+
+  /// memcpy, memmove or memset through the C library.
+  void execMemIntrinsic(ExecContext &Ctx, llvm::MemIntrinsic *MI);
+
+  int64_t getValue(ExecContext &Ctx, llvm::Value *V);
+
+  bool lookupValue(ExecContext &Ctx, llvm::Value *V, int64_t &Out);
+
+  int64_t allocateMemory(ExecContext &Ctx, llvm::Type *TempDIBasicType);
+
+  void storeValue(ExecContext &Ctx, llvm::Value *V, int64_t Value);
+
+  std::unique_ptr<ExecContext> acquireContext();
+
+  void releaseContext(std::unique_ptr<ExecContext> Ctx);
+
+  void ensureMaterialized(ExecContext &Ctx, llvm::Function &F);
+
+  void loadCachedFunction(llvm::Function &F);
+
+  void registerCode(const BasicBlockExecutor &BBExec);
+
+  void saveCodeCache();
+
+  void warmUp();
+
+  void requestCompile(llvm::BasicBlock *BB, DispatchEntry &Entry);
+
+  void compileLoop();
+
+  void compileAheadOfTime();
+
+  void materializeFunction(llvm::Function &F);
+
+  /// Free Exec, dropped from the dispatch table, once no run may still be
+  /// executing it.
+  void retireExecutor(BasicBlockExecutor* Exec);
+
+  /// Free Exec with the segments after it and its scalar fallback.  The
+  /// code stays in its arena.
+  static void deleteExecutor(BasicBlockExecutor* Exec);
+
+private:
+  DispatchTable<DispatchEntry> fn_map;
+  DispatchTable<ValueSite, llvm::Use> value_sites;
+  DispatchTable<HostCallSite, llvm::CallInst> host_calls;
 
   llvm::Module &module;
+  std::mutex module_mutex; // Serializes lazy materialization
+  DataSegment data_segment;
+
+  unsigned long long threshold; // Threshold for basic block execution
+
+  std::unique_ptr<CodeCache> code_cache;
+  std::unique_ptr<PerfRegistry> perf;
+  std::unique_ptr<Sampler> sampler;
+  std::string sample_out;
+  bool sample_counters;
+  std::mutex cache_mutex;
+  std::unordered_set<const llvm::Function*> dirty_functions; // Compiled code not yet in the cache
+
+  std::mutex profile_mutex;
+  Profile profile;
+  bool collect_profile = false;
+  std::string profile_out;
+
+  std::mutex context_mutex;
+  std::vector<std::unique_ptr<ExecContext>> idle_contexts;
+
+  std::mutex retired_mutex;
+  unsigned active_runs = 0;                    // Calls of run() in progress
+  std::vector<BasicBlockExecutor*> retired;    // Dropped code, freed when no run is active
+
+  bool vectorize;
+  bool compress;
+  bool superblocks;
+  bool speculate;
+  bool native_loops;
+  bool promote_scalars;
+  bool zbb = false;    // Zbb min/max in generated code
+  bool zicond = false; // Zicond conditional zeroing in generated code
+  bool async_compile;
+  CompileQueue<CompileRequest, 1024> compile_queue;
+  std::thread compiler_thread;
+  std::mutex compiler_mutex; // Only used to park the idle compiler thread
+  std::condition_variable compiler_cv;
+  std::atomic<bool> stop_compiler{false};
+
+  bool aot;
+  unsigned aot_threads;
+  std::once_flag aot_once;
+
+  std::mutex sync_compiler_mutex;
+  CompilerState sync_compiler;       // Synchronous compiles and code cache loads
+  CompilerState background_compiler; // The background compiler thread
+  std::vector<std::unique_ptr<CompilerState>> aot_compilers;
+  std::atomic<uint64_t> compile_ns{0};
 
-  unsigned long long threshold = 1; // Threshold for basic block execution
+  bool collect_stats;
+  std::atomic<uint64_t> blocks_compiled{0};
+  std::atomic<uint64_t> code_bytes{0};
+  std::atomic<uint64_t> compiled_ir_instructions{0};
+  std::atomic<uint64_t> loops_vectorized{0};
+  std::atomic<uint64_t> blocks_merged{0};
+  std::atomic<uint64_t> guards{0};
+  std::atomic<uint64_t> deopts{0};
+  std::atomic<uint64_t> loops_unrolled{0};
+  std::atomic<uint64_t> loops_compiled{0};
+  std::atomic<uint64_t> invariants_hoisted{0};
+  std::atomic<uint64_t> geps_reduced{0};
+  std::atomic<uint64_t> scalars_promoted{0};
+  double aot_ms = 0;
+  std::mutex stats_mutex;
+  uint64_t compile_failures = 0;
+  std::map<std::string, uint64_t> fallbacks; // Compile error -> blocks it kept in the interpreter
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,68 @@
+#ifndef STACKARENA_HPP
+#define STACKARENA_HPP
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+
+/// Memory for the program's allocas.  A single large reservation that pages
+/// are committed into on first touch, used as a stack: a function releases
+/// what it allocated when it returns, and reset() hands every page back so
+/// the next run starts from zeroed memory.
+class StackArena {
+public:
+  explicit StackArena(size_t Reserve = kDefaultReserve) : capacity(Reserve) {
+    void *mem = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (mem == MAP_FAILED) {
+      throw std::runtime_error("Failed to reserve stack arena: " + std::string(strerror(errno)));
+    }
+    base = static_cast<char *>(mem);
+  }
+
+  StackArena(const StackArena &) = delete;
+
+  StackArena &operator=(const StackArena &) = delete;
+
+  ~StackArena() { munmap(base, capacity); }
+
+  void *allocate(size_t Size, size_t Align) {
+    size_t start = (top + Align - 1) & ~(Align - 1);
+    if (start + Size > capacity) {
+      throw std::runtime_error("Stack arena exhausted.");
+    }
+    top = start + (Size ? Size : 1);
+    if (top > high_water) {
+      high_water = top;
+    }
+    return base + start;
+  }
+
+  size_t mark() const { return top; }
+
+  void release(size_t Mark) { top = Mark; }
+
+  void reset() {
+    size_t page = 4096;
+    madvise(base, (high_water + page - 1) & ~(page - 1), MADV_DONTNEED);
+    peak_bytes = peak();
+    top = 0;
+    high_water = 0;
+  }
+
+  size_t highWater() const { return high_water; }
+
+  /// Highest high water mark of any run, including the current one.
+  size_t peak() const { return high_water > peak_bytes ? high_water : peak_bytes; }
+
+private:
+  static constexpr size_t kDefaultReserve = size_t(256) << 20;
+
+  char *base = nullptr;
+  size_t capacity;
+  size_t top = 0;
+  size_t high_water = 0;
+  size_t peak_bytes = 0;
+};
+
+#endif // STACKARENA_HPP
@@ -0,0 +1,68 @@
+#ifndef SWITCHTABLE_HPP
+#define SWITCHTABLE_HPP
+
+#include "../util/util.hpp"
+#include <algorithm>
+
+/// The cases of a switch, ready for lookup.  Values map to successor
+/// indices as SwitchInst::getSuccessor() numbers them: 0 is the default
+/// destination, i + 1 the destination of case i.  Dense cases get a table
+/// indexed by value - low(); sparse ones are kept sorted for binary search.
+class SwitchTable {
+public:
+  explicit SwitchTable(const llvm::SwitchInst &SI) {
+    for (const auto &Case : SI.cases()) {
+      sorted.emplace_back(Case.getCaseValue()->getSExtValue(), Case.getSuccessorIndex());
+    }
+    std::sort(sorted.begin(), sorted.end());
+    if (sorted.empty()) {
+      return;
+    }
+    // Computed in unsigned arithmetic: the cases may span all of int64_t.
+    uint64_t range = (uint64_t)sorted.back().first - (uint64_t)sorted.front().first + 1;
+    if (range != 0 && range <= kMaxTable && range <= kMaxSparseness * sorted.size()) {
+      table.assign(range, 0);
+      for (const auto &Case : sorted) {
+        table[(uint64_t)Case.first - (uint64_t)sorted.front().first] = Case.second;
+      }
+    }
+  }
+
+  /// Successor index for Value.
+  unsigned lookup(int64_t Value) const {
+    if (isDense()) {
+      uint64_t index = (uint64_t)Value - (uint64_t)low();
+      return index < table.size() ? table[index] : 0;
+    }
+    auto it = std::lower_bound(sorted.begin(), sorted.end(), std::make_pair(Value, 0u));
+    return it != sorted.end() && it->first == Value ? it->second : 0;
+  }
+
+  bool isDense() const {
+    return !table.empty();
+  }
+
+  /// The smallest case value, which the dense table starts at.
+  int64_t low() const {
+    return sorted.front().first;
+  }
+
+  /// Successor index for each value from low() on; empty for sparse cases.
+  const std::vector<unsigned> &denseTable() const {
+    return table;
+  }
+
+  /// (value, successor index) of every case, by value.
+  const std::vector<std::pair<int64_t, unsigned>> &cases() const {
+    return sorted;
+  }
+
+private:
+  static constexpr uint64_t kMaxSparseness = 4; // At least one case in four table entries
+  static constexpr uint64_t kMaxTable = 4096;
+
+  std::vector<std::pair<int64_t, unsigned>> sorted;
+  std::vector<unsigned> table;
+};
+
+#endif // SWITCHTABLE_HPP
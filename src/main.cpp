@@ -8,14 +8,73 @@
 int main(int argc, char **argv) {
   llvm::InitLLVM X(argc, argv);
   llvm::cl::opt<std::string> InputFile(llvm::cl::Positional, llvm::cl::desc("<input .ll/.bc>"), llvm::cl::Required);
+  llvm::cl::opt<std::string> CacheDir("cache-dir", llvm::cl::desc("Persist compiled code in <dir> and reuse it on later runs"), llvm::cl::value_desc("dir"));
+  llvm::cl::opt<unsigned long long> Threshold("jit-threshold", llvm::cl::desc("Compile a block once it has run more than <n> times"), llvm::cl::value_desc("n"), llvm::cl::init(1));
+  llvm::cl::opt<std::string> ProfileIn("profile-in", llvm::cl::desc("Compile the blocks found hot in <file> at startup"), llvm::cl::value_desc("file"));
+  llvm::cl::opt<std::string> ProfileOut("profile-out", llvm::cl::desc("Write block, edge and call-site counts to <file> at exit"), llvm::cl::value_desc("file"));
+  llvm::cl::opt<bool> AsyncCompile("jit-async", llvm::cl::desc("Compile hot blocks on a background thread (default on)"), llvm::cl::init(true));
+  llvm::cl::opt<bool> AOT("aot", llvm::cl::desc("Compile every defined function in parallel before running main; --jit-stats reports the speedup"));
+  llvm::cl::opt<unsigned> AOTThreads("aot-threads", llvm::cl::desc("Threads used by --aot (default: one per core)"), llvm::cl::value_desc("n"), llvm::cl::init(0));
+  llvm::cl::opt<bool> Lazy("lazy", llvm::cl::desc("Materialize bitcode function bodies on first call"));
+  llvm::cl::opt<std::string> ParseCacheDir("parse-cache-dir", llvm::cl::desc("Keep bitcode for textual IR inputs in <dir> and load it instead of reparsing"), llvm::cl::value_desc("dir"));
+  llvm::cl::opt<bool> Stats("jit-stats", llvm::cl::desc("Print execution, compilation and memory statistics to stderr at exit"));
+  llvm::cl::opt<std::string> StatsJSON("jit-stats-json", llvm::cl::desc("Write statistics, including per-block counts, to <file> as JSON"), llvm::cl::value_desc("file"));
+  llvm::cl::opt<bool> PerfMap("perf-map", llvm::cl::desc("Name generated code for perf in /tmp/perf-<pid>.map"));
+  llvm::cl::opt<bool> PerfJitDump("perf-jitdump", llvm::cl::desc("Record generated code for perf inject --jit in /tmp/jit-<pid>.dump"));
+  llvm::cl::opt<bool> Vectorize("jit-rvv", llvm::cl::desc("Run simple counted array loops and bulk memory operations with RISC-V vector code when the CPU has the V extension"));
+  llvm::cl::opt<bool> Compress("jit-rvc", llvm::cl::desc("Emit compressed instructions where they fit, when the CPU has the C extension (default on)"), llvm::cl::init(true));
+  llvm::cl::opt<bool> Superblocks("jit-superblocks", llvm::cl::desc("Compile single-predecessor chains and the hot side of biased branches together with the block before them (default on)"), llvm::cl::init(true));
+  llvm::cl::opt<bool> Speculate("jit-speculate", llvm::cl::desc("Specialize compiled code on divisors, indices and loop bounds the interpreter saw never change, and unroll small loops (default on)"), llvm::cl::init(true));
+  llvm::cl::opt<bool> Loops("jit-loops", llvm::cl::desc("Run loops inside compiled code, computing invariants once and stepping array addresses instead of recomputing them (default on)"), llvm::cl::init(true));
+  llvm::cl::opt<bool> Scalars("jit-scalars", llvm::cl::desc("Keep local variables whose address does not escape in registers in compiled code (default on)"), llvm::cl::init(true));
+  llvm::cl::opt<std::string> Extensions("jit-ext", llvm::cl::desc("Override the detected CPU extensions: comma-separated c, v, zbb, zicond, each optionally prefixed with '-' to turn it off"), llvm::cl::value_desc("list"));
+  llvm::cl::opt<std::string> SampleOut("sample", llvm::cl::desc("Sample where time goes per IR function and block, and write the profile to <file>"), llvm::cl::value_desc("file"));
+  llvm::cl::opt<unsigned> SampleHz("sample-hz", llvm::cl::desc("Samples per second of CPU time for --sample"), llvm::cl::value_desc("n"), llvm::cl::init(997));
+  llvm::cl::opt<bool> SampleCounters("sample-counters", llvm::cl::desc("With --sample, also count instructions retired by native block executions"));
   llvm::cl::ParseCommandLineOptions(argc, argv, "Naïve IR Runner\n");
 
   llvm::LLVMContext Ctx;
   try {
-    auto Module = loadModuleFromFile(InputFile, Ctx);
-    JITRunner Runner(*Module);
+    LoadOptions LoadOpts;
+    LoadOpts.lazy = Lazy;
+    LoadOpts.parse_cache_dir = ParseCacheDir;
+    LoadInfo Info;
+    auto Module = loadModuleFromFile(InputFile, Ctx, LoadOpts, &Info);
+    JITOptions Opts;
+    Opts.cache_dir = CacheDir;
+    Opts.threshold = Threshold;
+    Opts.profile_in = ProfileIn;
+    Opts.profile_out = ProfileOut;
+    Opts.async_compile = AsyncCompile;
+    Opts.aot = AOT;
+    Opts.aot_threads = AOTThreads;
+    Opts.collect_stats = Stats || !StatsJSON.empty();
+    Opts.perf_map = PerfMap;
+    Opts.perf_jitdump = PerfJitDump;
+    Opts.sample_out = SampleOut;
+    Opts.sample_hz = SampleHz;
+    Opts.sample_counters = SampleCounters;
+    Opts.vectorize = Vectorize;
+    Opts.compress = Compress;
+    Opts.superblocks = Superblocks;
+    Opts.speculate = Speculate;
+    Opts.loops = Loops;
+    Opts.scalars = Scalars;
+    Opts.extensions = Extensions;
+    JITRunner Runner(*Module, Opts);
     int64_t exitCode = Runner.runModule();
     std::cout << "Program exited with code: " << exitCode << "\n";
+    if (Opts.collect_stats) {
+      JITStats S = Runner.stats();
+      S.has_load_info = true;
+      S.load = Info;
+      if (Stats) {
+        S.print(llvm::errs());
+      }
+      if (!StatsJSON.empty()) {
+        S.writeJSON(StatsJSON);
+      }
+    }
   } catch (const std::exception &e) {
     std::cerr << "Error: " << e.what() << "\n";
     return 1;
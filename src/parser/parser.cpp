@@ -1,13 +1,105 @@
 #include "parser.hpp"
+#include "llvm/Bitcode/BitcodeReader.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Support/xxhash.h"
+#include <chrono>
+#include <unistd.h>
 
-std::unique_ptr<llvm::Module> loadModuleFromFile(const std::string &Filename, llvm::LLVMContext &Ctx) {
+static std::unique_ptr<llvm::Module> parseBuffer(std::unique_ptr<llvm::MemoryBuffer> Buf, llvm::SMDiagnostic &Err,
+                                                 llvm::LLVMContext &Ctx, bool Lazy) {
+  if (Lazy) {
+    return llvm::getLazyIRModule(std::move(Buf), Err, Ctx);
+  }
+  return llvm::parseIR(Buf->getMemBufferRef(), Err, Ctx);
+}
+
+/// Path of the cached bitcode for textual IR with the given contents.  The
+/// LLVM version is part of the key since bitcode is only read back by the
+/// same reader that wrote it.
+static std::string parseCachePath(const std::string &Dir, llvm::StringRef Contents) {
+  uint64_t hash = llvm::xxHash64(Contents) ^ llvm::xxHash64(LLVM_VERSION_STRING);
+  char name[32];
+  snprintf(name, sizeof(name), "%016llx.bc", static_cast<unsigned long long>(hash));
+  llvm::SmallString<128> path(Dir);
+  llvm::sys::path::append(path, name);
+  return std::string(path.str());
+}
+
+/// Write M as bitcode to Path through a temporary file, so concurrent
+/// launches never read a partially written entry.
+static bool writeParseCache(const std::string &Path, const llvm::Module &M) {
+  std::string tmp = Path + ".tmp." + std::to_string(getpid());
+  {
+    std::error_code EC;
+    llvm::raw_fd_ostream os(tmp, EC, llvm::sys::fs::OF_None);
+    if (EC) {
+      return false;
+    }
+    llvm::WriteBitcodeToFile(M, os);
+    os.close();
+    if (os.has_error()) {
+      os.clear_error();
+      llvm::sys::fs::remove(tmp);
+      return false;
+    }
+  }
+  if (llvm::sys::fs::rename(tmp, Path)) {
+    llvm::sys::fs::remove(tmp);
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<llvm::Module> loadModuleFromFile(const std::string &Filename, llvm::LLVMContext &Ctx,
+                                                 const LoadOptions &Opts, LoadInfo *Info) {
+  auto start = std::chrono::steady_clock::now();
+  LoadInfo info;
   llvm::SMDiagnostic Err;
-  auto Mod = llvm::parseIRFile(Filename, Err, Ctx);
+  std::unique_ptr<llvm::Module> Mod;
+
+  auto BufOrErr = llvm::MemoryBuffer::getFileOrSTDIN(Filename);
+  if (!BufOrErr) {
+    throw std::runtime_error("loadModule: could not open " + Filename + ": " + BufOrErr.getError().message());
+  }
+  std::unique_ptr<llvm::MemoryBuffer> Buf = std::move(*BufOrErr);
+  info.textual = !llvm::isBitcode(reinterpret_cast<const unsigned char *>(Buf->getBufferStart()),
+                                  reinterpret_cast<const unsigned char *>(Buf->getBufferEnd()));
+
+  std::string cache_path;
+  if (info.textual && !Opts.parse_cache_dir.empty() &&
+      !llvm::sys::fs::create_directories(Opts.parse_cache_dir)) {
+    cache_path = parseCachePath(Opts.parse_cache_dir, Buf->getBuffer());
+    // Large entries are memory-mapped rather than read.
+    auto CachedOrErr = llvm::MemoryBuffer::getFile(cache_path, /*IsText=*/false,
+                                                   /*RequiresNullTerminator=*/false);
+    if (CachedOrErr) {
+      llvm::SMDiagnostic CacheErr;
+      Mod = parseBuffer(std::move(*CachedOrErr), CacheErr, Ctx, Opts.lazy);
+      // An unreadable entry is ignored and rewritten below.
+      info.parse_cache_hit = Mod != nullptr;
+    }
+  }
+
   if (!Mod) {
-    std::string msg;
-    llvm::raw_string_ostream os(msg);
-    Err.print("loadModule", os);
-    throw std::runtime_error(os.str());
+    Mod = parseBuffer(std::move(Buf), Err, Ctx, Opts.lazy);
+    if (!Mod) {
+      std::string msg;
+      llvm::raw_string_ostream os(msg);
+      Err.print("loadModule", os);
+      throw std::runtime_error(os.str());
+    }
+    if (!cache_path.empty()) {
+      info.parse_cache_written = writeParseCache(cache_path, *Mod);
+    }
+  }
+
+  info.load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+  if (Info) {
+    *Info = info;
   }
   return Mod;
-}
\ No newline at end of file
+}
@@ -6,8 +6,25 @@
 #include <stdexcept>
 #include "../util/util.hpp"
 
+struct LoadOptions {
+  bool lazy = false;           // Leave bitcode function bodies on disk until materialized
+  std::string parse_cache_dir; // Sidecar bitcode cache for textual IR, empty to disable
+};
+
+struct LoadInfo {
+  double load_ms = 0;          // Time spent reading and parsing the input
+  bool textual = false;        // The input is textual IR
+  bool parse_cache_hit = false;
+  bool parse_cache_written = false;
+};
+
 /// Load an LLVM IR (".ll") or bitcode (".bc") file into a Module.
+/// With Opts.lazy set, function bodies of bitcode are left on disk until they
+/// are materialized; textual IR is always parsed in full.  With a parse cache
+/// directory, textual IR is converted to bitcode once, keyed by a hash of the
+/// file contents, and later loads map that bitcode instead of parsing text.
 /// Throws std::runtime_error on failure.
-std::unique_ptr<llvm::Module> loadModuleFromFile(const std::string &Filename, llvm::LLVMContext &Ctx);
+std::unique_ptr<llvm::Module> loadModuleFromFile(const std::string &Filename, llvm::LLVMContext &Ctx,
+                                                 const LoadOptions &Opts = LoadOptions(), LoadInfo *Info = nullptr);
 
-#endif // PARSER
\ No newline at end of file
+#endif // PARSER
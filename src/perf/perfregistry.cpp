@@ -0,0 +1,135 @@
+#include "perfregistry.hpp"
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <elf.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// -------- jitdump format ---------
+// See tools/perf/Documentation/jitdump-specification.txt in the kernel tree.
+// A file header, then records that each start with a record header.  Only
+// code load records (with the code bytes) and the closing record are written.
+
+namespace {
+
+const uint32_t kJitDumpMagic = 0x4A695444; // "JiTD"
+const uint32_t kJitDumpVersion = 1;
+
+enum RecordType : uint32_t { CodeLoad = 0, CodeClose = 3 };
+
+struct FileHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct RecordHeader {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+struct CodeLoadRecord {
+  RecordHeader header;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+  // Followed by the nul-terminated name and the code bytes.
+};
+
+uint32_t elfMachine() {
+#if defined(__riscv)
+  return EM_RISCV;
+#elif defined(__x86_64__)
+  return EM_X86_64;
+#elif defined(__aarch64__)
+  return EM_AARCH64;
+#else
+  return EM_NONE;
+#endif
+}
+
+/// perf matches jitdump records to samples by CLOCK_MONOTONIC time.
+uint64_t timestamp() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+} // namespace
+
+PerfRegistry::PerfRegistry(bool Map, bool JitDump) {
+  pid_t pid = getpid();
+  if (Map) {
+    std::string path = "/tmp/perf-" + std::to_string(pid) + ".map";
+    map_file = fopen(path.c_str(), "w");
+    if (!map_file) {
+      throw std::runtime_error("Cannot create " + path + ": " + strerror(errno));
+    }
+  }
+  if (JitDump) {
+    std::string path = "/tmp/jit-" + std::to_string(pid) + ".dump";
+    dump_file = fopen(path.c_str(), "w+");
+    if (!dump_file) {
+      throw std::runtime_error("Cannot create " + path + ": " + strerror(errno));
+    }
+    FileHeader header = {kJitDumpMagic, kJitDumpVersion, sizeof(FileHeader), elfMachine(), 0,
+                         (uint32_t)pid, timestamp(), 0};
+    fwrite(&header, sizeof(header), 1, dump_file);
+    fflush(dump_file);
+    // perf record notices the dump through an executable mapping of it.
+    marker_size = sysconf(_SC_PAGESIZE);
+    marker = mmap(nullptr, marker_size, PROT_READ | PROT_EXEC, MAP_PRIVATE, fileno(dump_file), 0);
+    if (marker == MAP_FAILED) {
+      marker = nullptr;
+    }
+  }
+}
+
+PerfRegistry::~PerfRegistry() {
+  if (map_file) {
+    fclose(map_file);
+  }
+  if (dump_file) {
+    RecordHeader close = {CodeClose, sizeof(RecordHeader), timestamp()};
+    fwrite(&close, sizeof(close), 1, dump_file);
+    if (marker) {
+      munmap(marker, marker_size);
+    }
+    fclose(dump_file);
+  }
+}
+
+void PerfRegistry::recordCode(const void *Code, size_t Size, const std::string &Name) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (map_file) {
+    fprintf(map_file, "%lx %zx %s\n", (unsigned long)Code, Size, Name.c_str());
+    fflush(map_file);
+  }
+  if (dump_file) {
+    CodeLoadRecord record;
+    record.header.id = CodeLoad;
+    record.header.total_size = sizeof(record) + Name.size() + 1 + Size;
+    record.header.timestamp = timestamp();
+    record.pid = getpid();
+    record.tid = syscall(SYS_gettid);
+    record.vma = record.code_addr = (uint64_t)Code;
+    record.code_size = Size;
+    record.code_index = code_index++;
+    fwrite(&record, sizeof(record), 1, dump_file);
+    fwrite(Name.c_str(), Name.size() + 1, 1, dump_file);
+    fwrite(Code, Size, 1, dump_file);
+    fflush(dump_file);
+  }
+}
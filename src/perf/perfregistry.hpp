@@ -0,0 +1,37 @@
+#ifndef PERFREGISTRY_HPP
+#define PERFREGISTRY_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+/// Tells Linux `perf` where generated code lives.  With a perf map, every code
+/// region gets a line in /tmp/perf-<pid>.map, which `perf report` reads to
+/// name samples that land in JIT code.  With jitdump, regions are also written
+/// with their bytes to /tmp/jit-<pid>.dump; `perf record -k mono` followed by
+/// `perf inject --jit` turns that into symbols `perf annotate` can
+/// disassemble.  Safe to call from any thread.
+class PerfRegistry {
+public:
+  /// Throws std::runtime_error if a requested file cannot be created.
+  PerfRegistry(bool Map, bool JitDump);
+
+  ~PerfRegistry();
+
+  PerfRegistry(const PerfRegistry &) = delete;
+
+  PerfRegistry &operator=(const PerfRegistry &) = delete;
+
+  void recordCode(const void *Code, size_t Size, const std::string &Name);
+
+private:
+  std::mutex mutex;
+  FILE *map_file = nullptr;
+  FILE *dump_file = nullptr;
+  void *marker = nullptr; // Mapping of the dump that tells perf record about it
+  size_t marker_size = 0;
+  uint64_t code_index = 0;
+};
+
+#endif // PERFREGISTRY_HPP
@@ -0,0 +1,198 @@
+#include "profile.hpp"
+#include <fstream>
+#include <set>
+#include <sstream>
+
+// -------- File format ---------
+//   # naive_ir_runner profile v1
+//   block <function> <block> <count>
+//   edge <function> <from> <to> <count> <back|forward>
+//   call <function> <block> <instruction> <callee> <count>
+// Blocks and instructions are numbered by their position in the function.
+
+static const char *kHeader = "# naive_ir_runner profile v1";
+
+/// Edges of F that lead back to a block still on the depth-first search stack.
+static std::set<Profile::Edge> findBackEdges(const llvm::Function &F) {
+  std::set<Profile::Edge> result;
+  std::set<const llvm::BasicBlock*> visited, on_stack;
+  std::vector<std::pair<const llvm::BasicBlock*, unsigned>> stack;
+  const llvm::BasicBlock* entry = &F.getEntryBlock();
+  stack.push_back({entry, 0});
+  visited.insert(entry);
+  on_stack.insert(entry);
+  while (!stack.empty()) {
+    auto &top = stack.back();
+    const llvm::Instruction* term = top.first->getTerminator();
+    unsigned num_succ = term ? term->getNumSuccessors() : 0;
+    if (top.second == num_succ) {
+      on_stack.erase(top.first);
+      stack.pop_back();
+      continue;
+    }
+    const llvm::BasicBlock* succ = term->getSuccessor(top.second++);
+    if (on_stack.count(succ)) {
+      result.insert({top.first, succ});
+    } else if (visited.insert(succ).second) {
+      on_stack.insert(succ);
+      stack.push_back({succ, 0});
+    }
+  }
+  return result;
+}
+
+void Profile::write(const std::string &Filename) const {
+  const llvm::Module* M = nullptr;
+  if (!blocks.empty()) {
+    M = blocks.begin()->first->getModule();
+  }
+
+  std::ofstream out(Filename, std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("Cannot write profile " + Filename);
+  }
+  out << kHeader << "\n";
+  if (!M) {
+    return;
+  }
+
+  for (const llvm::Function &F : *M) {
+    if (F.isDeclaration() || !F.hasName()) {
+      continue;
+    }
+    std::unordered_map<const llvm::BasicBlock*, unsigned> block_ids;
+    std::unordered_map<const llvm::Instruction*, unsigned> inst_ids;
+    for (const llvm::BasicBlock &BB : F) {
+      block_ids.emplace(&BB, block_ids.size());
+      for (const llvm::Instruction &I : BB) {
+        inst_ids.emplace(&I, inst_ids.size());
+      }
+    }
+    std::string name = F.getName().str();
+
+    for (const llvm::BasicBlock &BB : F) {
+      uint64_t count = blockCount(&BB);
+      if (count) {
+        out << "block " << name << " " << block_ids[&BB] << " " << count << "\n";
+      }
+    }
+
+    std::set<Edge> back_edges;
+    bool have_back_edges = false;
+    for (auto it = edges.begin(); it != edges.end(); ++it) {
+      if (it->first.first->getParent() != &F) {
+        continue;
+      }
+      if (!have_back_edges) {
+        back_edges = findBackEdges(F);
+        have_back_edges = true;
+      }
+      out << "edge " << name << " " << block_ids[it->first.first] << " " << block_ids[it->first.second]
+          << " " << it->second << (back_edges.count(it->first) ? " back" : " forward") << "\n";
+    }
+
+    for (const auto &it : calls) {
+      const llvm::CallInst* CI = it.first.first;
+      if (CI->getFunction() != &F || !it.first.second->hasName()) {
+        continue;
+      }
+      out << "call " << name << " " << block_ids[CI->getParent()] << " " << inst_ids[CI] << " "
+          << it.first.second->getName().str() << " " << it.second << "\n";
+    }
+  }
+
+  if (!out) {
+    throw std::runtime_error("Cannot write profile " + Filename);
+  }
+}
+
+void Profile::read(const std::string &Filename, llvm::Module &M) {
+  std::ifstream in(Filename);
+  if (!in) {
+    throw std::runtime_error("Cannot read profile " + Filename);
+  }
+
+  std::string line;
+  if (!std::getline(in, line) || line != kHeader) {
+    throw std::runtime_error("Not a profile: " + Filename);
+  }
+
+  // Position tables are built on first use of each function.  Functions of a
+  // lazily loaded module are materialized here: the profile only names code
+  // that ran, which is about to run again.
+  std::map<const llvm::Function*, std::pair<std::vector<llvm::BasicBlock*>, std::vector<llvm::Instruction*>>> tables;
+  auto tableFor = [&](const std::string &Name) -> decltype(&tables.begin()->second) {
+    llvm::Function* F = M.getFunction(Name);
+    if (!F || F->isDeclaration()) {
+      return nullptr;
+    }
+    auto it = tables.find(F);
+    if (it == tables.end()) {
+      if (llvm::Error E = F->materialize()) {
+        throw std::runtime_error("Failed to materialize " + Name + ": " + llvm::toString(std::move(E)));
+      }
+      it = tables.emplace(F, decltype(tables)::mapped_type()).first;
+      for (llvm::BasicBlock &BB : *F) {
+        it->second.first.push_back(&BB);
+        for (llvm::Instruction &I : BB) {
+          it->second.second.push_back(&I);
+        }
+      }
+    }
+    return &it->second;
+  };
+
+  unsigned line_no = 1;
+  while (std::getline(in, line)) {
+    ++line_no;
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    std::istringstream ls(line);
+    std::string kind, function;
+    ls >> kind >> function;
+    auto* table = tableFor(function);
+    bool ok = true;
+    if (kind == "block") {
+      size_t block;
+      uint64_t count;
+      ok = static_cast<bool>(ls >> block >> count);
+      if (ok && table && block < table->first.size()) {
+        blocks[table->first[block]] += count;
+      }
+    } else if (kind == "edge") {
+      size_t from, to;
+      uint64_t count;
+      ok = static_cast<bool>(ls >> from >> to >> count);
+      if (ok && table && from < table->first.size() && to < table->first.size()) {
+        edges[{table->first[from], table->first[to]}] += count;
+      }
+    } else if (kind == "call") {
+      size_t block, inst;
+      std::string callee;
+      uint64_t count;
+      ok = static_cast<bool>(ls >> block >> inst >> callee >> count);
+      llvm::Function* Callee = M.getFunction(callee);
+      if (ok && table && Callee && inst < table->second.size()) {
+        if (auto* CI = llvm::dyn_cast<llvm::CallInst>(table->second[inst])) {
+          calls[{CI, Callee}] += count;
+        }
+      }
+    } else {
+      ok = false;
+    }
+    if (!ok) {
+      throw std::runtime_error("Malformed profile " + Filename + " at line " + std::to_string(line_no));
+    }
+  }
+}
+
+uint64_t Profile::blockCount(const llvm::BasicBlock* BB) const {
+  auto it = blocks.find(BB);
+  return it == blocks.end() ? 0 : it->second;
+}
+
+uint64_t Profile::edgeCount(const llvm::BasicBlock* From, const llvm::BasicBlock* To) const {
+  auto it = edges.find({From, To});
+  return it == edges.end() ? 0 : it->second;
+}
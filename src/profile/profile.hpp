@@ -0,0 +1,34 @@
+#ifndef PROFILE_HPP
+#define PROFILE_HPP
+
+#include <map>
+#include <string>
+#include "../util/util.hpp"
+
+/// Execution profile of a module: block counts, CFG edge counts and call-site
+/// targets.  Collected while running, written with --profile-out and read back
+/// with --profile-in to warm up the next run.
+class Profile {
+public:
+  using Edge = std::pair<const llvm::BasicBlock*, const llvm::BasicBlock*>;
+  using CallTarget = std::pair<const llvm::CallInst*, const llvm::Function*>;
+
+  /// Write the profile as text.  Throws std::runtime_error on I/O failure.
+  void write(const std::string &Filename) const;
+
+  /// Read a profile written for M.  Entries naming functions, blocks or
+  /// instructions that no longer exist are dropped.  Throws std::runtime_error
+  /// if the file cannot be read or is malformed.
+  void read(const std::string &Filename, llvm::Module &M);
+
+  uint64_t blockCount(const llvm::BasicBlock* BB) const;
+
+  uint64_t edgeCount(const llvm::BasicBlock* From, const llvm::BasicBlock* To) const;
+
+public:
+  std::map<const llvm::BasicBlock*, uint64_t> blocks;
+  std::map<Edge, uint64_t> edges;
+  std::map<CallTarget, uint64_t> calls;
+};
+
+#endif // PROFILE_HPP
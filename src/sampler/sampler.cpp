@@ -0,0 +1,250 @@
+#include "sampler.hpp"
+#include "../stats/stats.hpp"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <set>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+static std::atomic<Sampler*> active_sampler{nullptr};
+static thread_local ShadowStack* current_stack = nullptr;
+
+static uintptr_t interruptedPC(void* Context) {
+  auto* uc = static_cast<ucontext_t*>(Context);
+#if defined(__riscv)
+  return uc->uc_mcontext.__gregs[REG_PC];
+#elif defined(__x86_64__)
+  return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__aarch64__)
+  return uc->uc_mcontext.pc;
+#else
+  return 0;
+#endif
+}
+
+Sampler::Sampler(unsigned Hz) : hz(Hz ? Hz : 1), samples(new Sample[kCapacity]) {
+  Sampler* expected = nullptr;
+  if (!active_sampler.compare_exchange_strong(expected, this)) {
+    throw std::runtime_error("Only one sampler can be active at a time.");
+  }
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_sigaction = &Sampler::handleSignal;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, &old_action) != 0) {
+    active_sampler.store(nullptr);
+    throw std::runtime_error("Cannot install SIGPROF handler: " + std::string(strerror(errno)));
+  }
+  itimerval timer;
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = std::max(1u, 1000000 / hz);
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    sigaction(SIGPROF, &old_action, nullptr);
+    active_sampler.store(nullptr);
+    throw std::runtime_error("Cannot start profiling timer: " + std::string(strerror(errno)));
+  }
+  running = true;
+}
+
+Sampler::~Sampler() {
+  stop();
+}
+
+void Sampler::stop() {
+  if (!running) {
+    return;
+  }
+  itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  sigaction(SIGPROF, &old_action, nullptr);
+  active_sampler.store(nullptr);
+  running = false;
+}
+
+ShadowStack* Sampler::setCurrentStack(ShadowStack* Stack) {
+  ShadowStack* old = current_stack;
+  current_stack = Stack;
+  return old;
+}
+
+void Sampler::handleSignal(int, siginfo_t*, void* Context) {
+  // Async-signal context: no locks, no allocation.
+  Sampler* S = active_sampler.load(std::memory_order_acquire);
+  if (!S) {
+    return;
+  }
+  size_t index = S->num_samples.fetch_add(1, std::memory_order_relaxed);
+  if (index >= kCapacity) {
+    S->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  Sample &sample = S->samples[index];
+  sample.pc = interruptedPC(Context);
+  sample.native = false;
+  sample.depth = 0;
+  ShadowStack* stack = current_stack;
+  if (!stack) {
+    return; // A compiler thread, or the runner outside any run
+  }
+  std::atomic_signal_fence(std::memory_order_acquire);
+  unsigned depth = stack->depth;
+  depth = std::min(depth, ShadowStack::kMaxDepth);
+  sample.native = stack->native;
+  for (unsigned i = 0; i < depth && i < kSampleDepth; ++i) {
+    sample.frames[i] = stack->frames[depth - 1 - i];
+  }
+  sample.depth = std::min<unsigned>(depth, kSampleDepth);
+}
+
+int Sampler::openInstructionCounter() {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+pid_t Sampler::currentThread() {
+  static thread_local pid_t tid = (pid_t)syscall(SYS_gettid);
+  return tid;
+}
+
+uint64_t Sampler::readCounter(int Fd) {
+  uint64_t value = 0;
+  if (read(Fd, &value, sizeof(value)) != (ssize_t)sizeof(value)) {
+    return 0;
+  }
+  return value;
+}
+
+void Sampler::registerCode(const void* Code, size_t Size, const llvm::BasicBlock* BB) {
+  std::lock_guard<std::mutex> lock(mutex);
+  regions[reinterpret_cast<uintptr_t>(Code)] = {Size, BB};
+}
+
+void Sampler::addNativeCounters(const llvm::BasicBlock* BB, uint64_t Instructions, uint64_t Executions) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &c = counters[BB];
+  c.first += Instructions;
+  c.second += Executions;
+}
+
+void Sampler::writeReport(const std::string &Filename) {
+  stop();
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::map<const llvm::Function*, uint64_t> self_fn, total_fn;
+  std::map<const llvm::BasicBlock*, std::pair<uint64_t, uint64_t>> self_block; // samples, of which native
+  std::map<std::pair<const llvm::Function*, const llvm::Function*>, uint64_t> calls;
+  uint64_t native = 0, interpreted = 0, outside = 0;
+  size_t n = std::min(num_samples.load(), kCapacity);
+  for (size_t i = 0; i < n; ++i) {
+    const Sample &s = samples[i];
+    const llvm::BasicBlock* block = nullptr;
+    bool in_code = false;
+    auto it = regions.upper_bound(s.pc);
+    if (it != regions.begin()) {
+      --it;
+      if (s.pc < it->first + it->second.size) {
+        block = it->second.block;
+        in_code = true;
+      }
+    }
+    if (!s.depth && !in_code) {
+      ++outside;
+      continue;
+    }
+    if (!block) {
+      block = s.frames[0].block;
+    }
+    const llvm::Function* fn = block ? block->getParent() : s.frames[0].function;
+    (in_code ? native : interpreted)++;
+    ++self_fn[fn];
+    if (block) {
+      auto &b = self_block[block];
+      ++b.first;
+      b.second += in_code;
+    }
+    std::set<const llvm::Function*> seen;
+    for (unsigned f = 0; f < s.depth; ++f) {
+      if (seen.insert(s.frames[f].function).second) {
+        ++total_fn[s.frames[f].function];
+      }
+      if (f + 1 < s.depth) {
+        ++calls[{s.frames[f + 1].function, s.frames[f].function}];
+      }
+    }
+  }
+
+  std::error_code EC;
+  llvm::raw_fd_ostream OS(Filename, EC);
+  if (EC) {
+    throw std::runtime_error("Cannot write sample profile " + Filename + ": " + EC.message());
+  }
+  uint64_t program = native + interpreted;
+  auto percent = [program](uint64_t V) { return program ? 100.0 * V / program : 0.0; };
+  OS << "# naive_ir_runner sample profile\n";
+  OS << llvm::format("# %llu samples at %u Hz: %llu in generated code, %llu in the interpreter and runtime, "
+                     "%llu outside any run (compiler threads, loading); %llu dropped\n",
+                     (unsigned long long)(program + outside), hz, (unsigned long long)native,
+                     (unsigned long long)interpreted, (unsigned long long)outside,
+                     (unsigned long long)dropped.load());
+
+  std::vector<std::pair<const llvm::Function*, uint64_t>> fns(self_fn.begin(), self_fn.end());
+  for (auto &it : total_fn) {
+    if (!self_fn.count(it.first)) {
+      fns.emplace_back(it.first, 0);
+    }
+  }
+  std::sort(fns.begin(), fns.end(), [&](const auto &A, const auto &B) {
+    return A.second != B.second ? A.second > B.second : total_fn[A.first] > total_fn[B.first];
+  });
+  OS << "\nFunctions\n";
+  OS << "   self%     self  total%    total  function\n";
+  for (auto &it : fns) {
+    uint64_t total = total_fn[it.first];
+    OS << llvm::format("  %6.2f %8llu  %6.2f %8llu  ", percent(it.second), (unsigned long long)it.second,
+                       percent(total), (unsigned long long)total)
+       << (it.first ? it.first->getName() : "?") << "\n";
+  }
+
+  std::vector<std::pair<const llvm::BasicBlock*, std::pair<uint64_t, uint64_t>>> blocks(self_block.begin(),
+                                                                                         self_block.end());
+  std::sort(blocks.begin(), blocks.end(), [](const auto &A, const auto &B) { return A.second.first > B.second.first; });
+  OS << "\nBlocks\n";
+  OS << "   self%     self   native  block\n";
+  for (auto &it : blocks) {
+    OS << llvm::format("  %6.2f %8llu %8llu  ", percent(it.second.first), (unsigned long long)it.second.first,
+                       (unsigned long long)it.second.second)
+       << blockName(it.first) << "\n";
+  }
+
+  OS << "\nCall graph (samples with the call on the stack)\n";
+  for (auto &it : calls) {
+    OS << llvm::format("  %8llu  ", (unsigned long long)it.second)
+       << (it.first.first ? it.first.first->getName() : "?") << " -> "
+       << (it.first.second ? it.first.second->getName() : "?") << "\n";
+  }
+
+  if (!counters.empty()) {
+    OS << "\nNative executions (hardware counters)\n";
+    OS << "  instructions   executions   per exec  block\n";
+    for (auto &it : counters) {
+      OS << llvm::format("  %12llu %12llu %10.1f  ", (unsigned long long)it.second.first,
+                         (unsigned long long)it.second.second,
+                         it.second.second ? (double)it.second.first / it.second.second : 0.0)
+         << blockName(it.first) << "\n";
+    }
+  }
+}
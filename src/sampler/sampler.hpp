@@ -0,0 +1,119 @@
+#ifndef SAMPLER_HPP
+#define SAMPLER_HPP
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <signal.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include "../util/util.hpp"
+
+/// The IR call stack of one execution, kept up to date by the runner while
+/// sampling so that the SIGPROF handler can see which function and block the
+/// interrupted thread is in.  Only ever written by its own thread.
+struct ShadowStack {
+  static constexpr unsigned kMaxDepth = 256;
+
+  struct Frame {
+    const llvm::Function* function;
+    const llvm::BasicBlock* block;
+  };
+
+  void push(const llvm::Function* F) {
+    if (depth < kMaxDepth) {
+      frames[depth] = {F, nullptr};
+    }
+    std::atomic_signal_fence(std::memory_order_release);
+    depth = depth + 1;
+  }
+
+  void pop() { depth = depth - 1; }
+
+  void enter(const llvm::BasicBlock* BB) {
+    if (depth && depth <= kMaxDepth) {
+      frames[depth - 1].block = BB;
+    }
+  }
+
+  Frame frames[kMaxDepth];
+  volatile unsigned depth = 0;
+  volatile bool native = false; // Inside compiled code of the top frame's block
+};
+
+/// Built-in statistical profiler.  A process-wide ITIMER_PROF timer raises
+/// SIGPROF at a fixed rate of CPU time; the handler records the interrupted
+/// PC and a copy of the thread's shadow stack into a preallocated buffer.
+/// Samples are attributed after the run: a PC inside generated code counts
+/// for the block it was compiled from, anything else for the block the
+/// interpreter was in.  Works wherever SIGPROF does, qemu-user included.
+class Sampler {
+public:
+  /// Throws std::runtime_error if the signal handler or timer cannot be set
+  /// up, or another Sampler is active.
+  explicit Sampler(unsigned Hz);
+
+  ~Sampler();
+
+  Sampler(const Sampler &) = delete;
+
+  Sampler &operator=(const Sampler &) = delete;
+
+  /// Make Stack the one sampled on the calling thread, or none for null.
+  /// Returns the previous one.
+  static ShadowStack* setCurrentStack(ShadowStack* Stack);
+
+  /// Code at [Code, Code + Size) was compiled from BB.
+  void registerCode(const void* Code, size_t Size, const llvm::BasicBlock* BB);
+
+  /// Hardware counter readings taken around native executions of BB.
+  void addNativeCounters(const llvm::BasicBlock* BB, uint64_t Instructions, uint64_t Executions);
+
+  /// A counter of instructions retired by the calling thread in user mode,
+  /// or -1 where perf events are unavailable.
+  static int openInstructionCounter();
+
+  /// Kernel id of the calling thread, the one a counter opened now follows.
+  static pid_t currentThread();
+
+  static uint64_t readCounter(int Fd);
+
+  /// Stop sampling and write flat and call-graph profiles per function and
+  /// block.  Throws std::runtime_error on I/O failure.
+  void writeReport(const std::string &Filename);
+
+private:
+  static constexpr unsigned kSampleDepth = 32;
+  static constexpr size_t kCapacity = size_t(1) << 15;
+
+  struct Sample {
+    uintptr_t pc;
+    bool native;
+    unsigned depth; // Frames recorded, innermost first
+    ShadowStack::Frame frames[kSampleDepth];
+  };
+
+  struct Region {
+    size_t size;
+    const llvm::BasicBlock* block;
+  };
+
+  static void handleSignal(int Sig, siginfo_t* Info, void* Context);
+
+  void stop();
+
+  unsigned hz;
+  bool running = false;
+  struct sigaction old_action;
+  std::unique_ptr<Sample[]> samples; // Pages are only touched once written
+  std::atomic<size_t> num_samples{0};
+  std::atomic<size_t> dropped{0};
+
+  std::mutex mutex;
+  std::map<uintptr_t, Region> regions;
+  std::map<const llvm::BasicBlock*, std::pair<uint64_t, uint64_t>> counters; // instructions, executions
+};
+
+#endif // SAMPLER_HPP
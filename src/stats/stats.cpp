@@ -0,0 +1,141 @@
+#include "stats.hpp"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/raw_ostream.h"
+
+std::string blockName(const llvm::BasicBlock* BB) {
+  std::string name = BB->getParent()->getName().str() + ":";
+  if (BB->hasName()) {
+    return name + BB->getName().str();
+  }
+  unsigned index = 0;
+  for (const llvm::BasicBlock &Other : *BB->getParent()) {
+    if (&Other == BB) {
+      break;
+    }
+    ++index;
+  }
+  return name + "#" + std::to_string(index);
+}
+
+void JITStats::print(llvm::raw_ostream &OS, size_t Top) const {
+  OS << "=== naive_ir_runner statistics ===\n";
+  if (has_load_info) {
+    OS << llvm::format("load:        %.2f ms", load.load_ms);
+    if (load.textual) {
+      OS << (load.parse_cache_hit ? " (parse cache hit)" : load.parse_cache_written ? " (parse cache written)" : " (parsed)");
+    }
+    OS << "\n";
+  }
+  OS << llvm::format("compile:     %llu blocks in %.2f ms, %llu left to the interpreter\n",
+                     (unsigned long long)blocks_compiled, compile_ms, (unsigned long long)compile_failures);
+  if (loops_vectorized) {
+    OS << llvm::format("vectorized:  %llu loops\n", (unsigned long long)loops_vectorized);
+  }
+  if (blocks_merged) {
+    OS << llvm::format("superblocks: %llu blocks merged into their predecessors\n", (unsigned long long)blocks_merged);
+  }
+  if (guards || loops_unrolled) {
+    OS << llvm::format("speculation: %llu guards, %llu deopts, %llu loops unrolled\n", (unsigned long long)guards,
+                       (unsigned long long)deopts, (unsigned long long)loops_unrolled);
+  }
+  if (loops_compiled) {
+    OS << llvm::format("loops:       %llu run in compiled code, %llu invariants hoisted, %llu GEPs strength-reduced\n",
+                       (unsigned long long)loops_compiled, (unsigned long long)invariants_hoisted,
+                       (unsigned long long)geps_reduced);
+  }
+  if (scalars_promoted) {
+    OS << llvm::format("promoted:    %llu alloca scalars kept in registers\n", (unsigned long long)scalars_promoted);
+  }
+  if (aot_ms > 0) {
+    OS << llvm::format("aot:         %.2f ms wall\n", aot_ms);
+  }
+  OS << llvm::format("code:        %llu bytes for %llu IR instructions (%.1f bytes/inst)\n",
+                     (unsigned long long)code_bytes, (unsigned long long)compiled_ir_instructions,
+                     compiled_ir_instructions ? (double)code_bytes / compiled_ir_instructions : 0.0);
+  OS << llvm::format("memory:      code arena %zu used / %zu mapped bytes, stack high water %zu bytes\n",
+                     code_used_bytes, code_mapped_bytes, stack_high_water);
+  if (!fallbacks.empty()) {
+    OS << "fallbacks:\n";
+    for (auto &it : fallbacks) {
+      OS << llvm::format("  %10llu  ", (unsigned long long)it.second) << it.first << "\n";
+    }
+  }
+  if (!has_execution_counts) {
+    return;
+  }
+  OS << llvm::format("executions:  %llu interpreted, %llu native\n", (unsigned long long)interpreted_executions,
+                     (unsigned long long)native_executions);
+  if (!blocks.empty()) {
+    OS << "hottest blocks:\n";
+    for (size_t i = 0; i < blocks.size() && i < Top; ++i) {
+      const Block &B = blocks[i];
+      OS << llvm::format("  %10llu  %10llu native  ", (unsigned long long)B.executions,
+                         (unsigned long long)B.native_executions)
+         << blockName(B.block) << "\n";
+    }
+  }
+}
+
+void JITStats::writeJSON(const std::string &Filename) const {
+  std::error_code EC;
+  llvm::raw_fd_ostream out(Filename, EC);
+  if (EC) {
+    throw std::runtime_error("Cannot write statistics " + Filename + ": " + EC.message());
+  }
+  llvm::json::OStream J(out, 2);
+  J.objectBegin();
+  if (has_load_info) {
+    J.attributeObject("load", [&] {
+      J.attribute("ms", load.load_ms);
+      J.attribute("textual", load.textual);
+      J.attribute("parse_cache_hit", load.parse_cache_hit);
+      J.attribute("parse_cache_written", load.parse_cache_written);
+    });
+  }
+  J.attributeObject("compile", [&] {
+    J.attribute("blocks", (int64_t)blocks_compiled);
+    J.attribute("failures", (int64_t)compile_failures);
+    J.attribute("ms", compile_ms);
+    J.attribute("aot_ms", aot_ms);
+    J.attribute("code_bytes", (int64_t)code_bytes);
+    J.attribute("ir_instructions", (int64_t)compiled_ir_instructions);
+    J.attribute("loops_vectorized", (int64_t)loops_vectorized);
+    J.attribute("blocks_merged", (int64_t)blocks_merged);
+    J.attribute("loops_unrolled", (int64_t)loops_unrolled);
+    J.attribute("guards", (int64_t)guards);
+    J.attribute("deopts", (int64_t)deopts);
+    J.attribute("loops_compiled", (int64_t)loops_compiled);
+    J.attribute("invariants_hoisted", (int64_t)invariants_hoisted);
+    J.attribute("geps_reduced", (int64_t)geps_reduced);
+    J.attribute("scalars_promoted", (int64_t)scalars_promoted);
+    J.attributeObject("fallbacks", [&] {
+      for (auto &it : fallbacks) {
+        J.attribute(it.first, (int64_t)it.second);
+      }
+    });
+  });
+  J.attributeObject("memory", [&] {
+    J.attribute("code_used_bytes", (int64_t)code_used_bytes);
+    J.attribute("code_mapped_bytes", (int64_t)code_mapped_bytes);
+    J.attribute("stack_high_water", (int64_t)stack_high_water);
+  });
+  if (has_execution_counts) {
+    J.attributeObject("executions", [&] {
+      J.attribute("interpreted", (int64_t)interpreted_executions);
+      J.attribute("native", (int64_t)native_executions);
+    });
+    J.attributeArray("blocks", [&] {
+      for (const Block &B : blocks) {
+        J.object([&] {
+          J.attribute("block", blockName(B.block));
+          J.attribute("executions", (int64_t)B.executions);
+          J.attribute("native", (int64_t)B.native_executions);
+          J.attribute("code_bytes", (int64_t)B.code_bytes);
+        });
+      }
+    });
+  }
+  J.objectEnd();
+  out << "\n";
+}
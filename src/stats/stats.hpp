@@ -0,0 +1,65 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <map>
+#include <string>
+#include <vector>
+#include "../util/util.hpp"
+#include "../parser/parser.hpp"
+
+/// Snapshot of what the runner did: how blocks were executed, what compiling
+/// them cost and how much memory it took.  Taken with JITRunner::stats() and
+/// printed with --jit-stats / --jit-stats-json.
+struct JITStats {
+  struct Block {
+    const llvm::BasicBlock* block;
+    uint64_t executions;        // All executions, interpreted or native
+    uint64_t native_executions; // Executions of compiled code
+    size_t code_bytes;          // 0 if the block is not compiled
+  };
+
+  // Loading, filled in by whoever loaded the module.
+  bool has_load_info = false;
+  LoadInfo load;
+
+  // Compilation.
+  uint64_t blocks_compiled = 0;
+  uint64_t compile_failures = 0;
+  double compile_ms = 0;
+  uint64_t code_bytes = 0;               // Code emitted for compiled blocks
+  uint64_t compiled_ir_instructions = 0; // IR instructions those blocks hold
+  uint64_t loops_vectorized = 0;         // Blocks compiled to RVV loops
+  uint64_t blocks_merged = 0;            // Blocks compiled into a superblock after its first
+  uint64_t loops_unrolled = 0;           // Small self-loops compiled as one copy per iteration
+  uint64_t guards = 0;                   // Checks of values compiled code was specialized on
+  uint64_t deopts = 0;                   // Guards that failed, returning to the interpreter
+  uint64_t loops_compiled = 0;           // Superblocks that go back to their head inside the code
+  uint64_t invariants_hoisted = 0;       // Instructions those loops compute once, before the first lap
+  uint64_t geps_reduced = 0;             // GEPs those loops advance by a constant each lap
+  uint64_t scalars_promoted = 0;         // Scalars of non-escaping allocas compiled code keeps in registers
+  std::map<std::string, uint64_t> fallbacks; // Why blocks were left to the interpreter
+  double aot_ms = 0;                     // Wall time of ahead-of-time compilation
+
+  // Execution.  Only counted with JITOptions::collect_stats.
+  bool has_execution_counts = false;
+  uint64_t interpreted_executions = 0;
+  uint64_t native_executions = 0;
+  std::vector<Block> blocks; // Hottest first
+
+  // Memory.
+  size_t code_used_bytes = 0;
+  size_t code_mapped_bytes = 0;
+  size_t stack_high_water = 0;
+
+  /// Human-readable summary listing the Top hottest blocks.
+  void print(llvm::raw_ostream &OS, size_t Top = 10) const;
+
+  /// Everything, including every block, as JSON.  Throws std::runtime_error
+  /// if the file cannot be written.
+  void writeJSON(const std::string &Filename) const;
+};
+
+/// "function:block", with unnamed blocks numbered by position.
+std::string blockName(const llvm::BasicBlock* BB);
+
+#endif // STATS_HPP
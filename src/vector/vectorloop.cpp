@@ -0,0 +1,456 @@
+#include "vectorloop.hpp"
+#include "../asm/asmvector.hpp"
+#include <algorithm>
+#include <map>
+
+namespace {
+
+bool isInvariant(const llvm::Value* V, const llvm::BasicBlock* BB) {
+  if (auto* I = llvm::dyn_cast<llvm::Instruction>(V)) {
+    return I->getParent() != BB;
+  }
+  return llvm::isa<llvm::Argument>(V) || llvm::isa<llvm::ConstantInt>(V) || llvm::isa<llvm::GlobalValue>(V);
+}
+
+bool usedOutside(const llvm::Instruction* I) {
+  for (const llvm::User* U : I->users()) {
+    if (llvm::cast<llvm::Instruction>(U)->getParent() != I->getParent()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool isElementwise(unsigned Opcode) {
+  switch (Opcode) {
+  case llvm::Instruction::Add:
+  case llvm::Instruction::Sub:
+  case llvm::Instruction::Mul:
+  case llvm::Instruction::And:
+  case llvm::Instruction::Or:
+  case llvm::Instruction::Xor:
+    return true;
+  default:
+    return false;
+  }
+}
+
+asmcode::varith::Opcode vectorOpcode(unsigned Opcode) {
+  switch (Opcode) {
+  case llvm::Instruction::Add: return asmcode::varith::ADD;
+  case llvm::Instruction::Sub: return asmcode::varith::SUB;
+  case llvm::Instruction::Mul: return asmcode::varith::MUL;
+  case llvm::Instruction::And: return asmcode::varith::AND;
+  case llvm::Instruction::Or: return asmcode::varith::OR;
+  default: return asmcode::varith::XOR;
+  }
+}
+
+} // namespace
+
+std::unique_ptr<VectorLoop> VectorLoop::match(llvm::BasicBlock* BB) {
+  auto L = std::make_unique<VectorLoop>();
+  L->block = BB;
+
+  // The exit test: br (icmp next, bound), BB, exit or the reverse.
+  L->branch = llvm::dyn_cast<llvm::BranchInst>(BB->getTerminator());
+  if (!L->branch || !L->branch->isConditional()) {
+    return nullptr;
+  }
+  bool again_on_true = L->branch->getSuccessor(0) == BB;
+  if (again_on_true == (L->branch->getSuccessor(1) == BB)) {
+    return nullptr;
+  }
+  L->compare = llvm::dyn_cast<llvm::ICmpInst>(L->branch->getCondition());
+  if (!L->compare || L->compare->getParent() != BB || !L->compare->hasOneUse()) {
+    return nullptr;
+  }
+  llvm::CmpInst::Predicate pred = L->compare->getPredicate();
+  llvm::Value* lhs = L->compare->getOperand(0);
+  llvm::Value* rhs = L->compare->getOperand(1);
+  if (isInvariant(lhs, BB)) {
+    std::swap(lhs, rhs);
+    pred = llvm::CmpInst::getSwappedPredicate(pred);
+  }
+  if (!again_on_true) {
+    pred = llvm::CmpInst::getInversePredicate(pred);
+  }
+  if (pred != llvm::CmpInst::ICMP_SLT && pred != llvm::CmpInst::ICMP_SLE && pred != llvm::CmpInst::ICMP_NE) {
+    return nullptr;
+  }
+  L->predicate = pred;
+  L->exit_compare = again_on_true ? 0 : 1;
+  L->bound = rhs;
+  if (!isInvariant(L->bound, BB) || llvm::isa<llvm::GlobalValue>(L->bound)) {
+    return nullptr;
+  }
+
+  // next = induction + 1, induction = phi [start, outside], [next, BB].
+  L->next = llvm::dyn_cast<llvm::BinaryOperator>(lhs);
+  if (!L->next || L->next->getParent() != BB || L->next->getOpcode() != llvm::Instruction::Add) {
+    return nullptr;
+  }
+  llvm::Value* step = L->next->getOperand(1);
+  L->induction = llvm::dyn_cast<llvm::PHINode>(L->next->getOperand(0));
+  if (!L->induction) {
+    step = L->next->getOperand(0);
+    L->induction = llvm::dyn_cast<llvm::PHINode>(L->next->getOperand(1));
+  }
+  auto* one = llvm::dyn_cast<llvm::ConstantInt>(step);
+  if (!L->induction || L->induction->getParent() != BB || !one || !one->isOne() ||
+      L->induction->getNumIncomingValues() != 2 || L->induction->getIncomingValueForBlock(BB) != L->next) {
+    return nullptr;
+  }
+  for (const llvm::User* U : L->next->users()) {
+    if (U != L->compare && U != L->induction && llvm::cast<llvm::Instruction>(U)->getParent() == BB) {
+      return nullptr;
+    }
+  }
+
+  // Everything else in the block.
+  std::map<const llvm::Value*, bool> vector_values; // Values held in a vector register
+  std::map<const llvm::GetElementPtrInst*, size_t> access_index;
+  unsigned width = 0;
+  auto setWidth = [&width](llvm::Type* T) {
+    if (!T->isIntegerTy()) {
+      return false;
+    }
+    unsigned bits = T->getIntegerBitWidth();
+    if (bits != 8 && bits != 16 && bits != 32 && bits != 64) {
+      return false;
+    }
+    if (width && width != bits) {
+      return false;
+    }
+    width = bits;
+    return true;
+  };
+  auto isOperand = [&](const llvm::Value* V) {
+    return vector_values.count(V) || (isInvariant(V, BB) && !llvm::isa<llvm::GlobalValue>(V));
+  };
+
+  for (llvm::Instruction &I : *BB) {
+    if (&I == L->induction || &I == L->next || &I == L->compare || &I == L->branch) {
+      continue;
+    }
+    if (auto* Phi = llvm::dyn_cast<llvm::PHINode>(&I)) {
+      // Only reductions: acc = phi [init, outside], [update, BB] with
+      // update = acc op x, and acc used by nothing else.
+      auto* update = Phi->getNumIncomingValues() == 2 ?
+        llvm::dyn_cast<llvm::BinaryOperator>(Phi->getIncomingValueForBlock(BB)) : nullptr;
+      if (!update || update->getParent() != BB || !Phi->hasOneUse() || !setWidth(Phi->getType())) {
+        return nullptr;
+      }
+      unsigned op = update->getOpcode();
+      if (op != llvm::Instruction::Add && op != llvm::Instruction::And && op != llvm::Instruction::Or &&
+          op != llvm::Instruction::Xor) {
+        return nullptr;
+      }
+      if (update->getOperand(0) != Phi && update->getOperand(1) != Phi) {
+        return nullptr;
+      }
+      L->reductions.push_back({Phi, update});
+      continue;
+    }
+    if (usedOutside(&I)) {
+      bool is_update = false;
+      for (const Reduction &R : L->reductions) {
+        is_update |= R.update == &I;
+      }
+      if (!is_update) {
+        return nullptr;
+      }
+    }
+    switch (I.getOpcode()) {
+    case llvm::Instruction::GetElementPtr: {
+      // base[c0]...[ck][induction] over integer elements: unit stride.
+      auto* GEP = llvm::cast<llvm::GetElementPtrInst>(&I);
+      if (!isInvariant(GEP->getPointerOperand(), BB) || GEP->getNumIndices() < 1 ||
+          *(GEP->idx_end() - 1) != L->induction || !setWidth(GEP->getResultElementType())) {
+        return nullptr;
+      }
+      for (auto it = GEP->idx_begin(); it + 1 != GEP->idx_end(); ++it) {
+        if (!isInvariant(*it, BB) || *it == L->induction) {
+          return nullptr;
+        }
+      }
+      for (const llvm::User* U : GEP->users()) {
+        auto* LI = llvm::dyn_cast<llvm::LoadInst>(U);
+        auto* SI = llvm::dyn_cast<llvm::StoreInst>(U);
+        if (!(LI && LI->getPointerOperand() == GEP) && !(SI && SI->getPointerOperand() == GEP)) {
+          return nullptr;
+        }
+      }
+      access_index[GEP] = L->accesses.size();
+      L->accesses.push_back(GEP);
+      L->stored.push_back(false);
+      break;
+    }
+    case llvm::Instruction::Load: {
+      auto* LI = llvm::cast<llvm::LoadInst>(&I);
+      auto* GEP = llvm::dyn_cast<llvm::GetElementPtrInst>(LI->getPointerOperand());
+      if (LI->isVolatile() || !GEP || !access_index.count(GEP) || !setWidth(LI->getType())) {
+        return nullptr;
+      }
+      vector_values[LI] = true;
+      break;
+    }
+    case llvm::Instruction::Store: {
+      auto* SI = llvm::cast<llvm::StoreInst>(&I);
+      auto* GEP = llvm::dyn_cast<llvm::GetElementPtrInst>(SI->getPointerOperand());
+      if (SI->isVolatile() || !GEP || !access_index.count(GEP) || !isOperand(SI->getValueOperand()) ||
+          !setWidth(SI->getValueOperand()->getType())) {
+        return nullptr;
+      }
+      L->stored[access_index[GEP]] = true;
+      break;
+    }
+    default: {
+      if (!isElementwise(I.getOpcode()) || !setWidth(I.getType())) {
+        return nullptr;
+      }
+      bool is_update = false;
+      for (const Reduction &R : L->reductions) {
+        if (R.update == &I) {
+          // The other operand has to vary per element.
+          llvm::Value* x = I.getOperand(0) == R.phi ? I.getOperand(1) : I.getOperand(0);
+          if (!vector_values.count(x)) {
+            return nullptr;
+          }
+          is_update = true;
+        }
+      }
+      if (is_update) {
+        break;
+      }
+      if (I.getOperand(0) == L->induction || I.getOperand(1) == L->induction) {
+        if (!setWidth(L->induction->getType())) {
+          return nullptr;
+        }
+        vector_values[L->induction] = true;
+      }
+      if (!isOperand(I.getOperand(0)) || !isOperand(I.getOperand(1)) ||
+          (!vector_values.count(I.getOperand(0)) && !vector_values.count(I.getOperand(1)))) {
+        return nullptr;
+      }
+      vector_values[&I] = true;
+      break;
+    }
+    }
+  }
+  // Every reduction update must have been seen after its phi; an update
+  // feeding anything in the block but its phi is a cross-iteration value.
+  for (const Reduction &R : L->reductions) {
+    for (const llvm::User* U : R.update->users()) {
+      if (U != R.phi && llvm::cast<llvm::Instruction>(U)->getParent() == BB) {
+        return nullptr;
+      }
+    }
+  }
+  if (L->accesses.empty() || !width) {
+    return nullptr;
+  }
+  L->sew = width;
+  return L;
+}
+
+bool VectorLoop::tripCount(int64_t Start, int64_t Bound, int64_t &Count) const {
+  unsigned bits = induction->getType()->getIntegerBitWidth();
+  int64_t max = bits >= 64 ? INT64_MAX : (int64_t(1) << (bits - 1)) - 1;
+  if (__builtin_sub_overflow(Bound, Start, &Count)) {
+    return false;
+  }
+  switch (predicate) {
+  case llvm::CmpInst::ICMP_SLT:
+    break;
+  case llvm::CmpInst::ICMP_SLE:
+    if (Bound >= max) {
+      return false; // next would wrap before exceeding the bound
+    }
+    ++Count;
+    break;
+  default: // ICMP_NE
+    if (Count <= 0) {
+      return false;
+    }
+    break;
+  }
+  // The current iteration always runs.
+  Count = std::max<int64_t>(Count, 1);
+  return Count < (int64_t(1) << 40);
+}
+
+bool VectorLoop::independent(const std::vector<int64_t> &Starts, int64_t Count) const {
+  int64_t bytes = Count * (sew / 8);
+  for (size_t i = 0; i < accesses.size(); ++i) {
+    if (!stored[i]) {
+      continue;
+    }
+    for (size_t j = 0; j < accesses.size(); ++j) {
+      if (j == i || Starts[i] == Starts[j]) {
+        continue;
+      }
+      if (Starts[i] < Starts[j] + bytes && Starts[j] < Starts[i] + bytes) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+void VectorLoop::emit(asmcode::AsmBlock &AB) const {
+  using asmcode::Register;
+  using asmcode::VRegister;
+  Register count("t0"), iv("t1"), vl("t2"), scratch("t3"), zero("zero");
+  static const char* pool[] = {"a1", "a2", "a3", "a4", "a5", "a6", "a7", "t4", "t5", "t6"};
+  std::map<const llvm::Value*, std::string> scalars;
+  std::map<const llvm::Value*, unsigned> vregs;
+  unsigned next_vreg = 1; // v0 is the mask register
+  auto scalar = [&](llvm::Value* V) {
+    auto it = scalars.find(V);
+    if (it != scalars.end()) {
+      return Register(it->second);
+    }
+    if (scalars.size() == sizeof(pool) / sizeof(pool[0])) {
+      throw std::runtime_error("Vector loop needs too many scalar registers.");
+    }
+    std::string name = pool[scalars.size()];
+    scalars[V] = name;
+    AB.loadSlot(Register(name), V);
+    return Register(name);
+  };
+  auto vreg = [&](const llvm::Value* V) {
+    auto it = vregs.find(V);
+    if (it != vregs.end()) {
+      return VRegister(it->second);
+    }
+    if (next_vreg == 32) {
+      throw std::runtime_error("Vector loop needs too many vector registers.");
+    }
+    vregs[V] = next_vreg;
+    return VRegister(next_vreg++);
+  };
+  auto isVector = [&](const llvm::Value* V) {
+    if (V == induction) {
+      return true;
+    }
+    auto* I = llvm::dyn_cast<llvm::Instruction>(V);
+    return I && I->getParent() == block;
+  };
+
+  AB.regSave(); // `li` of constant operands uses s3
+  AB.loadSlot(count, branch);
+  AB.loadSlot(iv, induction);
+  for (llvm::GetElementPtrInst* GEP : accesses) {
+    scalar(GEP);
+  }
+  bool iv_used = false;
+  for (llvm::Instruction &I : *block) {
+    if (&I == next || &I == compare || &I == branch || llvm::isa<llvm::PHINode>(&I) ||
+        llvm::isa<llvm::GetElementPtrInst>(&I) || llvm::isa<llvm::LoadInst>(&I)) {
+      continue;
+    }
+    for (llvm::Value* Op : I.operands()) {
+      if (Op == induction) {
+        iv_used = true;
+      } else if (!isVector(Op)) {
+        scalar(Op);
+      }
+    }
+  }
+
+  // Accumulators start at the identity and collect one partial result per
+  // element position; the tail-undisturbed policy keeps the positions past
+  // a short final strip intact.
+  if (!reductions.empty()) {
+    AB.append(new asmcode::vsetvli(vl, zero, sew, true));
+    for (const Reduction &R : reductions) {
+      int64_t identity = R.update->getOpcode() == llvm::Instruction::And ? -1 : 0;
+      AB.append(new asmcode::vmove(asmcode::vmove::V_I, vreg(R.phi), identity));
+    }
+  }
+
+  unsigned loop = AB.newLabel();
+  AB.append(new asmcode::label(loop));
+  AB.append(new asmcode::vsetvli(vl, count, sew, false));
+  if (iv_used) {
+    VRegister v = vreg(induction);
+    AB.append(new asmcode::vmove(asmcode::vmove::ID, v, zero));
+    AB.append(new asmcode::varith(asmcode::varith::ADD, v, v, iv));
+  }
+  for (llvm::Instruction &I : *block) {
+    if (&I == next || &I == compare || &I == branch || llvm::isa<llvm::PHINode>(&I) ||
+        llvm::isa<llvm::GetElementPtrInst>(&I)) {
+      continue;
+    }
+    if (auto* LI = llvm::dyn_cast<llvm::LoadInst>(&I)) {
+      AB.append(new asmcode::vmem(false, vreg(LI), Register(scalars[LI->getPointerOperand()]), sew));
+      continue;
+    }
+    if (auto* SI = llvm::dyn_cast<llvm::StoreInst>(&I)) {
+      llvm::Value* V = SI->getValueOperand();
+      VRegister v = vreg(isVector(V) ? V : SI);
+      if (!isVector(V)) {
+        AB.append(new asmcode::vmove(asmcode::vmove::V_X, v, scalar(V)));
+      }
+      AB.append(new asmcode::vmem(true, v, Register(scalars[SI->getPointerOperand()]), sew));
+      continue;
+    }
+    asmcode::varith::Opcode op = vectorOpcode(I.getOpcode());
+    const Reduction* R = nullptr;
+    for (const Reduction &Red : reductions) {
+      if (Red.update == &I) {
+        R = &Red;
+      }
+    }
+    if (R) {
+      llvm::Value* x = I.getOperand(0) == R->phi ? I.getOperand(1) : I.getOperand(0);
+      VRegister acc = vreg(R->phi);
+      AB.append(new asmcode::varith(op, acc, acc, vreg(x)));
+      continue;
+    }
+    llvm::Value* lhs = I.getOperand(0);
+    llvm::Value* rhs = I.getOperand(1);
+    VRegister vd = vreg(&I);
+    if (isVector(lhs) && isVector(rhs)) {
+      AB.append(new asmcode::varith(op, vd, vreg(lhs), vreg(rhs)));
+    } else if (isVector(lhs)) {
+      AB.append(new asmcode::varith(op, vd, vreg(lhs), scalar(rhs)));
+    } else {
+      // Scalar on the left: every operation but sub commutes.
+      if (op == asmcode::varith::SUB) {
+        op = asmcode::varith::RSUB;
+      }
+      AB.append(new asmcode::varith(op, vd, vreg(rhs), scalar(lhs)));
+    }
+  }
+  unsigned shift = sew == 8 ? 0 : sew == 16 ? 1 : sew == 32 ? 2 : 3;
+  AB.append(new asmcode::binaryi(asmcode::binaryi::SLLI, scratch, vl, asmcode::Immediate(shift)));
+  for (llvm::GetElementPtrInst* GEP : accesses) {
+    Register p(scalars[GEP]);
+    AB.append(new asmcode::binary(asmcode::binary::ADD, p, p, scratch));
+  }
+  AB.append(new asmcode::binary(asmcode::binary::ADD, iv, iv, vl));
+  AB.append(new asmcode::binary(asmcode::binary::SUB, count, count, vl));
+  AB.append(new asmcode::branch(asmcode::branch::BNE, count, zero, loop));
+
+  // Fold each accumulator, starting from the value the phi came in with.
+  if (!reductions.empty()) {
+    AB.append(new asmcode::vsetvli(vl, zero, sew, true));
+    VRegister tmp(0);
+    for (const Reduction &R : reductions) {
+      static const asmcode::varith::Opcode folds[] = {asmcode::varith::REDSUM, asmcode::varith::REDAND,
+                                                      asmcode::varith::REDOR, asmcode::varith::REDXOR};
+      unsigned op = R.update->getOpcode();
+      size_t fold = op == llvm::Instruction::Add ? 0 : op == llvm::Instruction::And ? 1 :
+        op == llvm::Instruction::Or ? 2 : 3;
+      AB.loadSlot(scratch, R.phi);
+      AB.append(new asmcode::vmove(asmcode::vmove::S_X, tmp, scratch));
+      AB.append(new asmcode::varith(folds[fold], tmp, vreg(R.phi), tmp));
+      AB.append(new asmcode::vmove(asmcode::vmove::X_S, tmp, scratch));
+      AB.storeSlot(scratch, R.update);
+    }
+  }
+  AB.regLoad();
+  AB.addRet();
+}
@@ -0,0 +1,55 @@
+#ifndef VECTORLOOP_HPP
+#define VECTORLOOP_HPP
+
+#include <memory>
+#include <vector>
+#include "../util/util.hpp"
+#include "../asm/asmstruct.hpp"
+
+/// A block that loops to itself and that the vector code generator can run
+/// to completion in one go: an induction variable stepping by one up to a
+/// loop-invariant bound, unit-stride array accesses indexed by it, integer
+/// element-wise arithmetic of a single element width, and add/and/or/xor
+/// reductions into scalars.  The generated code strip-mines the remaining
+/// iterations with RVV; the runner checks the trip count and aliasing before
+/// every entry and takes the scalar code when they do not allow it.
+struct VectorLoop {
+  struct Reduction {
+    llvm::PHINode* phi;         // Accumulator
+    llvm::BinaryOperator* update;
+  };
+
+  /// Analyze BB.  Returns null unless it is such a loop.
+  static std::unique_ptr<VectorLoop> match(llvm::BasicBlock* BB);
+
+  /// Code running the iterations left from the current values of the phis.
+  /// It reads the trip count from the slot of the loop's branch, the first
+  /// address of every access from the slot of its GEP, and leaves each
+  /// reduction's final value in the slot of its update.
+  void emit(asmcode::AsmBlock &AB) const;
+
+  /// Iterations left, counting the current one, when the induction variable
+  /// is at Start.  False if the count cannot be established (e.g. a `ne` exit
+  /// the loop would have to wrap around to reach).
+  bool tripCount(int64_t Start, int64_t Bound, int64_t &Count) const;
+
+  /// Whether Count iterations of the accesses, the i-th starting at Starts[i],
+  /// can run in vector order: every store either addresses exactly the same
+  /// elements as another access or does not overlap it at all.
+  bool independent(const std::vector<int64_t> &Starts, int64_t Count) const;
+
+  llvm::BasicBlock* block;
+  llvm::PHINode* induction;
+  llvm::BinaryOperator* next; // induction + 1
+  llvm::ICmpInst* compare;
+  llvm::BranchInst* branch;
+  llvm::Value* bound;
+  llvm::CmpInst::Predicate predicate; // The loop runs again while `next predicate bound`
+  int64_t exit_compare;                // Value of `compare` when the loop exits
+  unsigned sew;                        // Element width in bits
+  std::vector<llvm::GetElementPtrInst*> accesses;
+  std::vector<bool> stored;            // accesses[i] is stored through
+  std::vector<Reduction> reductions;
+};
+
+#endif // VECTORLOOP_HPP